@@ -0,0 +1,110 @@
+#pragma once
+
+// Client side of frame_protocol.h: turns video messages into a BGR canvas.
+
+#include <opencv2/opencv.hpp>
+#include "frame_protocol.h"
+#include "h264_decoder.h"
+
+// Per-connection decoding state. The scratch images keep their memory from
+// frame to frame, so a stream at a steady size decodes without allocating;
+// the canvas's memory is recycled too, so copy it to keep it past the next
+// message.
+struct FrameDecoder {
+    cv::Mat canvas;         // what the user should currently see
+    FrameHeader shown;      // header of the last message that changed the canvas
+    cv::Mat tile;           // scratch: one decoded tile
+    cv::Mat back;           // scratch: the next keyframe, swapped with canvas
+#ifdef WITH_AVCODEC
+    H264Decoder h264;
+#endif
+};
+
+inline void frame_decoder_reset(FrameDecoder& decoder) {
+    decoder.canvas.release();
+    decoder.tile.release();
+    decoder.back.release();
+    decoder.shown = FrameHeader{};
+#ifdef WITH_AVCODEC
+    h264_decoder_close(decoder.h264);
+#endif
+}
+
+// Draw a tile list (uint16 tile_count, then tiles) onto the canvas, decoding
+// each into `tile`. Tiles that are truncated or do not fit are skipped.
+inline bool apply_tiles(cv::Mat& canvas, cv::Mat& tile, const uint8_t* data, size_t size) {
+    if (size < 2) return false;
+    uint16_t tile_count = get_u16(data);
+    size_t offset = 2;
+    bool changed = false;
+
+    for (uint16_t i = 0; i < tile_count; i++) {
+        if (offset + FRAME_TILE_HEADER_SIZE > size) return changed;
+        const uint8_t* hdr = data + offset;
+        cv::Rect rect(get_u16(hdr), get_u16(hdr + 2), get_u16(hdr + 4), get_u16(hdr + 6));
+        uint32_t tile_size = get_u32(hdr + 8);
+        offset += FRAME_TILE_HEADER_SIZE;
+        if (offset + tile_size > size) return changed;
+
+        cv::Mat raw(1, (int)tile_size, CV_8UC1, (void*)(data + offset));
+        offset += tile_size;
+
+        if (rect.x + rect.width > canvas.cols || rect.y + rect.height > canvas.rows) continue;
+        cv::imdecode(raw, cv::IMREAD_COLOR, &tile);
+        if (tile.empty() || tile.cols != rect.width || tile.rows != rect.height) continue;
+        cv::Mat dst = canvas(rect);
+        tile.copyTo(dst);
+        changed = true;
+    }
+    return changed;
+}
+
+// Apply the payload of a `type` message to the decoder canvas. Returns true
+// when the canvas changed and should be presented. Deltas that arrive before
+// the first keyframe, or that do not fit the current canvas, are ignored.
+inline bool apply_frame_payload(FrameDecoder& decoder, uint8_t type, const uint8_t* data, size_t size) {
+    cv::Mat& canvas = decoder.canvas;
+
+    // Keyframes are decoded into the back image and swapped in, so a bad
+    // one leaves the canvas alone
+    if (type == FRAME_KEY) {
+        cv::Mat raw(1, (int)size, CV_8UC1, (void*)data);
+        cv::imdecode(raw, cv::IMREAD_COLOR, &decoder.back);
+        if (decoder.back.empty()) return false;
+        std::swap(canvas, decoder.back);
+        return true;
+    }
+
+    if (type == FRAME_DELTA) {
+        if (canvas.empty()) return false;
+        return apply_tiles(canvas, decoder.tile, data, size);
+    }
+
+    if (type == FRAME_KEY_TILES) {
+        if (size < 4) return false;
+        cv::Mat& frame = decoder.back;
+        frame.create(get_u16(data + 2), get_u16(data), CV_8UC3);
+        frame.setTo(cv::Scalar(0, 0, 0));
+        if (!apply_tiles(frame, decoder.tile, data + 4, size - 4)) return false;
+        std::swap(canvas, frame);
+        return true;
+    }
+
+#ifdef WITH_AVCODEC
+    if (type == FRAME_H264) {
+        return h264_decode(decoder.h264, data, size, canvas);
+    }
+#endif
+
+    return false;
+}
+
+// Apply one message (header + payload, no length prefix). Remembers the
+// header of what is now on the canvas, for the display ack.
+inline bool apply_frame_message(FrameDecoder& decoder, const uint8_t* data, size_t size) {
+    FrameHeader header;
+    if (!frame_header_parse(data, size, header)) return false;
+    if (!apply_frame_payload(decoder, header.type, data + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE)) return false;
+    decoder.shown = header;
+    return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Pool of reusable per-frame buffers, so a pipeline in steady state hands
+// the same memory round instead of allocating for every frame.
+//
+// A buffer is in use for as long as anybody but the pool holds a reference
+// to it. Frames simply drop their shared_ptr when they are done with it,
+// wherever that happens (sent, dropped from a queue, skipped by a viewer),
+// and the next acquire() finds it free again. Buffers keep whatever they
+// grew to, so after the first few frames at a resolution nothing is
+// allocated; the pool itself only grows when more frames are in flight
+// than ever before.
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+template <typename T>
+class FramePool {
+public:
+    // A buffer nobody else holds, or a new one if they are all in use
+    std::shared_ptr<T> acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const std::shared_ptr<T>& item : items_) {
+            if (item.use_count() == 1) {
+                // Pairs with the release in the last holder's decrement, so
+                // its use of the buffer is over before ours begins
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return item;
+            }
+        }
+        items_.push_back(std::make_shared<T>());
+        return items_.back();
+    }
+
+    // Buffers made so far
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<T>> items_;
+};
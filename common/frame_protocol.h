@@ -0,0 +1,98 @@
+#pragma once
+
+// Video stream framing shared by the server and the clients.
+//
+// Every message on the video socket is
+//
+//   uint32 length        bytes that follow (network order)
+//   uint8  type          FrameType
+//   uint32 seq           frame number, one per captured frame (wraps)
+//   uint64 capture_us    server clock at capture, microseconds
+//   ...    payload       length - FRAME_HEADER_SIZE bytes
+//
+// seq and capture_us mean nothing to the client; it echoes them in a display
+// ack (input_protocol.h) so the server can tell how old the frame was when it
+// was shown. Over UDP the message goes without the length prefix.
+//
+// FRAME_KEY    one JPEG covering the whole window. Replaces the client canvas.
+// FRAME_DELTA  uint16 tile_count, then per tile
+//                uint16 x, uint16 y, uint16 w, uint16 h, uint32 size, JPEG bytes
+//              Each tile is drawn onto the last frame at (x, y).
+// FRAME_H264   one H.264 access unit (Annex B). SPS/PPS are repeated in
+//              front of every IDR so a decoder can start on any keyframe.
+// FRAME_KEY_TILES
+//              uint16 width, uint16 height, then tiles as in FRAME_DELTA.
+//              A keyframe encoded in parallel stripes: replaces the canvas
+//              with a width x height frame built from the tiles.
+//
+// All integers are big endian.
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+enum FrameType : uint8_t {
+    FRAME_KEY = 0,
+    FRAME_DELTA = 1,
+    FRAME_H264 = 2,
+    FRAME_KEY_TILES = 3,
+};
+
+#define FRAME_HEADER_SIZE 13        // type, seq, capture_us
+#define FRAME_TILE_HEADER_SIZE 12
+
+struct FrameHeader {
+    uint8_t type = 0;
+    uint32_t seq = 0;
+    uint64_t capture_us = 0;
+};
+
+inline void put_u8(std::vector<uint8_t>& out, uint8_t v) {
+    out.push_back(v);
+}
+
+inline void put_u16(std::vector<uint8_t>& out, uint16_t v) {
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+inline void put_u32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back((uint8_t)(v >> 24));
+    out.push_back((uint8_t)(v >> 16));
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+inline void put_u64(std::vector<uint8_t>& out, uint64_t v) {
+    put_u32(out, (uint32_t)(v >> 32));
+    put_u32(out, (uint32_t)v);
+}
+
+inline void set_u32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+inline uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+inline uint32_t get_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+inline uint64_t get_u64(const uint8_t* p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+// Read the header of a message (after the length prefix). Returns false if
+// the message is too short to have one.
+inline bool frame_header_parse(const uint8_t* data, size_t size, FrameHeader& header) {
+    if (size < FRAME_HEADER_SIZE) return false;
+    header.type = data[0];
+    header.seq = get_u32(data + 1);
+    header.capture_us = get_u64(data + 5);
+    return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+// Bounded ring buffer used to hand frames between pipeline stages. Any
+// thread may push or pop: the stage steps run on a shared worker pool and
+// the event loop drains the last queue, so every operation takes the mutex.
+// At frame rates the lock is uncontended.
+//
+// With QueuePolicy::Block a full queue stalls the producer (back-pressure).
+// With QueuePolicy::DropOldest the producer never waits: the oldest queued
+// item is evicted and handed back to the caller so it can recycle whatever
+// the item owns.
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+enum class QueuePolicy {
+    Block,
+    DropOldest,
+};
+
+template <typename T>
+class FrameQueue {
+public:
+    FrameQueue(size_t capacity, QueuePolicy policy)
+        : slots_(capacity ? capacity : 1), policy_(policy) {}
+
+    // Queue an item. Returns false if the queue has been closed. When an item
+    // had to be evicted to make room it is moved into *dropped (if given) and
+    // *did_drop is set.
+    bool push(T item, T* dropped = nullptr, bool* did_drop = nullptr) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (did_drop) *did_drop = false;
+
+        if (policy_ == QueuePolicy::Block) {
+            not_full_.wait(lock, [this] { return closed_ || count_ < slots_.size(); });
+        } else if (!closed_ && count_ == slots_.size()) {
+            T old = std::move(slots_[head_]);
+            head_ = (head_ + 1) % slots_.size();
+            count_--;
+            drops_++;
+            if (dropped) *dropped = std::move(old);
+            if (did_drop) *did_drop = true;
+        }
+        if (closed_) return false;
+
+        slots_[(head_ + count_) % slots_.size()] = std::move(item);
+        count_++;
+        if (count_ > max_depth_) max_depth_ = count_;
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    // Wait for an item. Returns false once the queue is closed and drained.
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || count_ > 0; });
+        if (count_ == 0) return false;
+        take(out);
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    bool try_pop(T& out) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (count_ == 0) return false;
+        take(out);
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // Wake up every waiter; pushes fail from now on, pops drain what is left.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    size_t depth() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    // Highest depth seen since the last call
+    size_t take_max_depth() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t m = max_depth_;
+        max_depth_ = count_;
+        return m;
+    }
+
+    uint64_t drops() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return drops_;
+    }
+
+    size_t capacity() const { return slots_.size(); }
+
+private:
+    void take(T& out) {
+        out = std::move(slots_[head_]);
+        head_ = (head_ + 1) % slots_.size();
+        count_--;
+    }
+
+    std::vector<T> slots_;
+    QueuePolicy policy_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t max_depth_ = 0;
+    uint64_t drops_ = 0;
+    bool closed_ = false;
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
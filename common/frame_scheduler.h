@@ -0,0 +1,117 @@
+#pragma once
+
+// Deadline-based frame pacing.
+//
+// Instead of sleeping a fixed interval after the work is done, each frame is
+// given a deadline and the loop sleeps only for what is left of the budget,
+// so capture and encode time no longer stretch the frame period.
+//
+// The interval adapts to activity:
+//   - content changing:  target_fps
+//   - content unchanged: the interval grows step by step down to min_fps
+//   - after input:       max_fps for boost_ms, so interaction stays smooth
+// notify_input() may be called from any thread and cuts a long idle sleep
+// short.
+//
+// wait() sleeps on its own; an event loop that paces several streams calls
+// next_deadline() instead and checks take_woken() when it wakes up.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+struct FrameScheduler {
+    using clock = std::chrono::steady_clock;
+
+    double target_fps = 30;
+    double min_fps = 2;
+    double max_fps = 60;
+    int boost_ms = 500;
+
+    FrameScheduler() = default;
+    FrameScheduler(double target, double min, double max) : target_fps(target), min_fps(min), max_fps(max) {}
+
+    // Record user input: run at max_fps for the next boost_ms
+    void notify_input() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            boost_until_ = clock::now() + std::chrono::milliseconds(boost_ms);
+            woken_ = true;
+        }
+        wake_.notify_all();
+    }
+
+    // Cut the current sleep short without boosting (e.g. on shutdown)
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            woken_ = true;
+        }
+        wake_.notify_all();
+    }
+
+    // Call once per frame after its work. `changed` says whether this frame
+    // had new content. Returns when the next frame is due.
+    clock::time_point next_deadline(bool changed) {
+        auto now = clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        double fast = 1.0 / std::max(target_fps, 1.0);
+        double slow = 1.0 / std::max(min_fps, 0.1);
+        if (changed) {
+            interval_ = fast;
+        } else {
+            // Back off gradually so a short pause does not drop us to idle
+            interval_ = std::min(std::max(interval_, fast) * 1.5, slow);
+        }
+        if (now < boost_until_) {
+            interval_ = 1.0 / std::max(max_fps, 1.0);
+        }
+
+        if (next_ == clock::time_point()) next_ = now;
+        next_ += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(interval_));
+        // Overran the budget: start again from now rather than bursting to catch up
+        if (next_ < now) next_ = now;
+
+        woken_ = false;
+        return next_;
+    }
+
+    // True (once) if notify_input() or wake() came after the last deadline
+    // was set: the next frame should go now, and pacing restarts from here
+    bool take_woken() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!woken_) return false;
+        woken_ = false;
+        next_ = clock::now();
+        return true;
+    }
+
+    // Call once per loop iteration after the frame's work. Sleeps until the
+    // next deadline.
+    void wait(bool changed) {
+        clock::time_point deadline = next_deadline(changed);
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait_until(lock, deadline, [this] { return woken_; });
+        if (woken_) {
+            // Input arrived during the sleep: go now and pace from here
+            next_ = clock::now();
+        }
+    }
+
+    // Current frame interval in seconds (for logging)
+    double interval() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return interval_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    clock::time_point next_{};
+    clock::time_point boost_until_{};
+    double interval_ = 0;
+    bool woken_ = false;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+// Client side of FRAME_H264: decodes access units from the server's
+// libavcodec encoder into BGR. Only built with -DWITH_AVCODEC.
+
+#ifdef WITH_AVCODEC
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+struct H264Decoder {
+    AVCodecContext* ctx = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    cv::Mat yuv;
+};
+
+inline void h264_decoder_close(H264Decoder& dec) {
+    if (dec.ctx) avcodec_free_context(&dec.ctx);
+    if (dec.frame) av_frame_free(&dec.frame);
+    if (dec.packet) av_packet_free(&dec.packet);
+}
+
+inline bool h264_decoder_open(H264Decoder& dec) {
+    const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (!codec) return false;
+    dec.ctx = avcodec_alloc_context3(codec);
+    dec.ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    if (avcodec_open2(dec.ctx, codec, nullptr) < 0) {
+        h264_decoder_close(dec);
+        return false;
+    }
+    dec.frame = av_frame_alloc();
+    dec.packet = av_packet_alloc();
+    return true;
+}
+
+// Decode one access unit into `bgr`. Returns true when a picture came out.
+inline bool h264_decode(H264Decoder& dec, const uint8_t* data, size_t size, cv::Mat& bgr) {
+    if (!dec.ctx && !h264_decoder_open(dec)) return false;
+
+    dec.packet->data = (uint8_t*)data;
+    dec.packet->size = (int)size;
+    if (avcodec_send_packet(dec.ctx, dec.packet) < 0) return false;
+
+    bool got = false;
+    while (avcodec_receive_frame(dec.ctx, dec.frame) == 0) {
+        int w = dec.frame->width;
+        int h = dec.frame->height;
+        // Gather the three planes into one I420 buffer for cvtColor
+        dec.yuv.create(h * 3 / 2, w, CV_8UC1);
+        uint8_t* dst = dec.yuv.data;
+        for (int y = 0; y < h; y++, dst += w)
+            memcpy(dst, dec.frame->data[0] + y * dec.frame->linesize[0], w);
+        for (int p = 1; p <= 2; p++)
+            for (int y = 0; y < h / 2; y++, dst += w / 2)
+                memcpy(dst, dec.frame->data[p] + y * dec.frame->linesize[p], w / 2);
+        cv::cvtColor(dec.yuv, bgr, cv::COLOR_YUV2BGR_I420);
+        got = true;
+    }
+    return got;
+}
+
+#endif // WITH_AVCODEC
@@ -0,0 +1,53 @@
+#pragma once
+
+// JSON encoding of input events, for servers that predate the binary
+// protocol in input_protocol.h. Those only know clicks, double clicks and
+// whole key presses: a button press is sent as a click, and motion, button
+// releases and wheel steps are dropped.
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include "input_protocol.h"
+
+// What the old server's key handler understands: the character itself
+// (Escape as "\x1b"), or a name for XStringToKeysym. Empty if unsupported.
+inline std::string keysym_json_name(uint32_t keysym) {
+    switch (keysym) {
+    case INPUT_KEYSYM_ESCAPE: return std::string(1, (char)27);
+    case INPUT_KEYSYM_BACKSPACE: return "BackSpace";
+    case INPUT_KEYSYM_TAB: return "Tab";
+    case INPUT_KEYSYM_RETURN: return "Return";
+    case INPUT_KEYSYM_DELETE: return "Delete";
+    case INPUT_KEYSYM_LEFT: return "Left";
+    case INPUT_KEYSYM_UP: return "Up";
+    case INPUT_KEYSYM_RIGHT: return "Right";
+    case INPUT_KEYSYM_DOWN: return "Down";
+    }
+    // ASCII only: anything else would not be valid UTF-8 on its own
+    if (keysym >= 0x20 && keysym < 0x7f) return std::string(1, (char)keysym);
+    return std::string();
+}
+
+// Append one length-prefixed JSON message per supported event to `out`
+inline void input_encode_json(const InputEvent* events, size_t count, std::vector<uint8_t>& out) {
+    for (size_t i = 0; i < count; i++) {
+        const InputEvent& ev = events[i];
+        nlohmann::json msg;
+        if (ev.type == INPUT_CLICK || ev.type == INPUT_DCLICK || ev.type == INPUT_BUTTON_DOWN) {
+            msg = { {"type", ev.type == INPUT_DCLICK ? "dclick" : "click"},
+                    {"button", ev.button == 3 ? "right" : "left"},
+                    {"x", ev.x}, {"y", ev.y} };
+        } else if (ev.type == INPUT_KEY_DOWN) {
+            std::string key = keysym_json_name(ev.keysym);
+            if (key.empty()) continue;
+            msg = { {"type", "key"}, {"key", key} };
+        } else {
+            // Key up is implied by the JSON key press
+            continue;
+        }
+        std::string text = msg.dump();
+        put_u32(out, (uint32_t)text.size());
+        out.insert(out.end(), text.begin(), text.end());
+    }
+}
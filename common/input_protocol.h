@@ -0,0 +1,307 @@
+#pragma once
+
+// Binary input channel shared by the server and the C++ clients.
+//
+// Messages use the same framing as the JSON protocol they replace:
+//
+//   uint32 length        bytes that follow (network order)
+//   ...    payload
+//
+// Negotiation: right after connecting, a client sends a hello payload
+//
+//   "SDIN" uint8 version
+//
+// and waits briefly for the server to answer with the same five bytes,
+// carrying the version it will speak. A server that does not answer is an
+// old JSON-only one, and the client keeps sending JSON. Clients that never
+// say hello (client.py) just send JSON; the server tells the two apart by
+// the first payload byte ('{' for JSON, INPUT_MSG_BATCH for binary).
+//
+// Batch payload:
+//
+//   uint8  INPUT_MSG_BATCH
+//   uint8  event_count
+//   event_count x INPUT_EVENT_SIZE bytes:
+//     uint8  type          InputEventType
+//     uint8  button        1 left, 2 middle, 3 right
+//     uint16 modifiers     reserved, 0
+//     uint32 time_ms       client clock, milliseconds (wraps)
+//     int16  x, y          pointer position in frame coordinates
+//     int16  dx, dy        wheel steps (positive: right / up)
+//     uint32 keysym        X11 keysym for key events
+//
+// Display ack payload (version 2), sent by the client after it shows a
+// frame, echoing that frame's header (frame_protocol.h):
+//
+//   uint8  INPUT_MSG_ACK
+//   uint32 seq
+//   uint64 capture_us
+//
+// Viewport payload (version 3): the size in pixels the client shows the
+// stream at, sent on connect and whenever it changes. The server then
+// scales its output down to fit, and maps event coordinates, which stay in
+// frame pixels, back to the window. 0 x 0 asks for full size again.
+//
+//   uint8  INPUT_MSG_VIEWPORT
+//   uint16 width
+//   uint16 height
+//
+// Cursor payloads (version 4) go the other way, from the server to the
+// client on this same connection, so the client can draw the pointer
+// without waiting for a frame; window pixmaps never contain it. A shape is
+// sent once. Clients keep the last INPUT_CURSOR_CACHE shapes they received,
+// dropping the oldest, and the server sends a shape again only after it
+// has dropped out.
+//
+//   uint8  INPUT_MSG_CURSOR_SHAPE
+//   uint32 serial        names the shape
+//   uint16 width, height
+//   uint16 xhot, yhot    hotspot within the image
+//   width x height x 4   pixels, bytes B G R A, alpha premultiplied
+//
+//   uint8  INPUT_MSG_CURSOR
+//   uint32 serial        shape to draw
+//   int16  x, y          hotspot in frame coordinates
+//   uint8  visible       0: draw nothing (pointer on another screen)
+//
+// All integers are big endian.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "frame_protocol.h"
+
+#define INPUT_PROTOCOL_VERSION 4
+#define INPUT_ACK_VERSION 2         // first version with display acks
+#define INPUT_VIEWPORT_VERSION 3    // first version with viewport sizes
+#define INPUT_CURSOR_VERSION 4      // first version with the cursor channel
+#define INPUT_MAGIC "SDIN"
+#define INPUT_HELLO_SIZE 5
+#define INPUT_EVENT_SIZE 20
+#define INPUT_MAX_BATCH 255
+#define INPUT_MSG_BATCH 0x01
+#define INPUT_MSG_ACK 0x02
+#define INPUT_ACK_SIZE 13
+#define INPUT_MSG_VIEWPORT 0x03
+#define INPUT_VIEWPORT_SIZE 5
+#define INPUT_MSG_CURSOR_SHAPE 0x04
+#define INPUT_CURSOR_SHAPE_HEADER 13
+#define INPUT_MSG_CURSOR 0x05
+#define INPUT_CURSOR_SIZE 10
+#define INPUT_CURSOR_CACHE 32       // shapes a client keeps
+
+enum InputEventType : uint8_t {
+    INPUT_CLICK = 1,        // press + release
+    INPUT_DCLICK = 2,       // two clicks
+    INPUT_KEY_DOWN = 3,
+    INPUT_KEY_UP = 4,
+    INPUT_MOTION = 5,
+    INPUT_WHEEL = 6,
+    INPUT_BUTTON_DOWN = 7,  // press only, for drags; ends with INPUT_BUTTON_UP
+    INPUT_BUTTON_UP = 8,
+};
+
+// Keysyms the clients need that are not plain Latin-1 characters
+#define INPUT_KEYSYM_BACKSPACE 0xff08
+#define INPUT_KEYSYM_TAB 0xff09
+#define INPUT_KEYSYM_RETURN 0xff0d
+#define INPUT_KEYSYM_ESCAPE 0xff1b
+#define INPUT_KEYSYM_DELETE 0xffff
+#define INPUT_KEYSYM_LEFT 0xff51
+#define INPUT_KEYSYM_UP 0xff52
+#define INPUT_KEYSYM_RIGHT 0xff53
+#define INPUT_KEYSYM_DOWN 0xff54
+
+struct InputEvent {
+    uint8_t type = 0;
+    uint8_t button = 0;
+    uint16_t modifiers = 0;
+    uint32_t time_ms = 0;
+    int16_t x = 0;
+    int16_t y = 0;
+    int16_t dx = 0;
+    int16_t dy = 0;
+    uint32_t keysym = 0;
+};
+
+// Where to draw which cursor shape
+struct InputCursor {
+    uint32_t serial = 0;
+    int16_t x = 0;
+    int16_t y = 0;
+    bool visible = false;
+};
+
+// A decoded cursor shape; `pixels` points into the message
+struct InputCursorShape {
+    uint32_t serial = 0;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    uint16_t xhot = 0;
+    uint16_t yhot = 0;
+    const uint8_t* pixels = nullptr;
+};
+
+// Timestamp for InputEvent::time_ms
+inline uint32_t input_time_ms() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Map a character code from a GUI toolkit to a keysym. Latin-1 characters
+// are their own keysym; the usual control characters get their X names.
+inline uint32_t keysym_from_char(int c) {
+    switch (c) {
+    case 8: return INPUT_KEYSYM_BACKSPACE;
+    case 9: return INPUT_KEYSYM_TAB;
+    case 10:
+    case 13: return INPUT_KEYSYM_RETURN;
+    case 27: return INPUT_KEYSYM_ESCAPE;
+    case 127: return INPUT_KEYSYM_DELETE;
+    }
+    if (c >= 0x20 && c <= 0xff) return (uint32_t)c;
+    return 0;
+}
+
+inline void input_hello(std::vector<uint8_t>& out, uint8_t version = INPUT_PROTOCOL_VERSION) {
+    out.insert(out.end(), INPUT_MAGIC, INPUT_MAGIC + 4);
+    out.push_back(version);
+}
+
+// True if the payload is a hello (or ack); stores the version it carries
+inline bool input_is_hello(const uint8_t* data, size_t size, uint8_t& version) {
+    if (size != INPUT_HELLO_SIZE || memcmp(data, INPUT_MAGIC, 4) != 0) return false;
+    version = data[4];
+    return true;
+}
+
+// Append length-prefixed batch messages for `events` to `out`, split every
+// INPUT_MAX_BATCH events
+inline void input_encode_batch(const InputEvent* events, size_t count, std::vector<uint8_t>& out) {
+    while (count > INPUT_MAX_BATCH) {
+        input_encode_batch(events, INPUT_MAX_BATCH, out);
+        events += INPUT_MAX_BATCH;
+        count -= INPUT_MAX_BATCH;
+    }
+    if (count == 0) return;
+    put_u32(out, (uint32_t)(2 + count * INPUT_EVENT_SIZE));
+    put_u8(out, INPUT_MSG_BATCH);
+    put_u8(out, (uint8_t)count);
+    for (size_t i = 0; i < count; i++) {
+        const InputEvent& ev = events[i];
+        put_u8(out, ev.type);
+        put_u8(out, ev.button);
+        put_u16(out, ev.modifiers);
+        put_u32(out, ev.time_ms);
+        put_u16(out, (uint16_t)ev.x);
+        put_u16(out, (uint16_t)ev.y);
+        put_u16(out, (uint16_t)ev.dx);
+        put_u16(out, (uint16_t)ev.dy);
+        put_u32(out, ev.keysym);
+    }
+}
+
+// Decode a batch payload (without the length prefix). Returns false if it
+// is not a well-formed batch.
+inline bool input_decode_batch(const uint8_t* data, size_t size, std::vector<InputEvent>& events) {
+    events.clear();
+    if (size < 2 || data[0] != INPUT_MSG_BATCH) return false;
+    size_t count = data[1];
+    if (size != 2 + count * INPUT_EVENT_SIZE) return false;
+    const uint8_t* p = data + 2;
+    for (size_t i = 0; i < count; i++, p += INPUT_EVENT_SIZE) {
+        InputEvent ev;
+        ev.type = p[0];
+        ev.button = p[1];
+        ev.modifiers = get_u16(p + 2);
+        ev.time_ms = get_u32(p + 4);
+        ev.x = (int16_t)get_u16(p + 8);
+        ev.y = (int16_t)get_u16(p + 10);
+        ev.dx = (int16_t)get_u16(p + 12);
+        ev.dy = (int16_t)get_u16(p + 14);
+        ev.keysym = get_u32(p + 16);
+        events.push_back(ev);
+    }
+    return true;
+}
+
+// Append a length-prefixed display ack for the frame with `header`
+inline void input_encode_ack(const FrameHeader& header, std::vector<uint8_t>& out) {
+    put_u32(out, INPUT_ACK_SIZE);
+    put_u8(out, INPUT_MSG_ACK);
+    put_u32(out, header.seq);
+    put_u64(out, header.capture_us);
+}
+
+// Decode an ack payload (without the length prefix)
+inline bool input_decode_ack(const uint8_t* data, size_t size, FrameHeader& header) {
+    if (size != INPUT_ACK_SIZE || data[0] != INPUT_MSG_ACK) return false;
+    header.seq = get_u32(data + 1);
+    header.capture_us = get_u64(data + 5);
+    return true;
+}
+
+// Append a length-prefixed viewport message
+inline void input_encode_viewport(int width, int height, std::vector<uint8_t>& out) {
+    put_u32(out, INPUT_VIEWPORT_SIZE);
+    put_u8(out, INPUT_MSG_VIEWPORT);
+    put_u16(out, (uint16_t)std::min(width, 0xffff));
+    put_u16(out, (uint16_t)std::min(height, 0xffff));
+}
+
+// Decode a viewport payload (without the length prefix)
+inline bool input_decode_viewport(const uint8_t* data, size_t size, int& width, int& height) {
+    if (size != INPUT_VIEWPORT_SIZE || data[0] != INPUT_MSG_VIEWPORT) return false;
+    width = get_u16(data + 1);
+    height = get_u16(data + 3);
+    return true;
+}
+
+// Append a length-prefixed cursor shape; `bgra` holds width x height pixels
+inline void input_encode_cursor_shape(uint32_t serial, int width, int height, int xhot, int yhot,
+                                      const uint8_t* bgra, std::vector<uint8_t>& out) {
+    size_t bytes = (size_t)width * height * 4;
+    put_u32(out, (uint32_t)(INPUT_CURSOR_SHAPE_HEADER + bytes));
+    put_u8(out, INPUT_MSG_CURSOR_SHAPE);
+    put_u32(out, serial);
+    put_u16(out, (uint16_t)width);
+    put_u16(out, (uint16_t)height);
+    put_u16(out, (uint16_t)xhot);
+    put_u16(out, (uint16_t)yhot);
+    out.insert(out.end(), bgra, bgra + bytes);
+}
+
+// Decode a cursor shape payload (without the length prefix)
+inline bool input_decode_cursor_shape(const uint8_t* data, size_t size, InputCursorShape& shape) {
+    if (size < INPUT_CURSOR_SHAPE_HEADER || data[0] != INPUT_MSG_CURSOR_SHAPE) return false;
+    shape.serial = get_u32(data + 1);
+    shape.width = get_u16(data + 5);
+    shape.height = get_u16(data + 7);
+    shape.xhot = get_u16(data + 9);
+    shape.yhot = get_u16(data + 11);
+    shape.pixels = data + INPUT_CURSOR_SHAPE_HEADER;
+    return size == INPUT_CURSOR_SHAPE_HEADER + (size_t)shape.width * shape.height * 4;
+}
+
+// Append a length-prefixed cursor position
+inline void input_encode_cursor(const InputCursor& cursor, std::vector<uint8_t>& out) {
+    put_u32(out, INPUT_CURSOR_SIZE);
+    put_u8(out, INPUT_MSG_CURSOR);
+    put_u32(out, cursor.serial);
+    put_u16(out, (uint16_t)cursor.x);
+    put_u16(out, (uint16_t)cursor.y);
+    put_u8(out, cursor.visible ? 1 : 0);
+}
+
+// Decode a cursor position payload (without the length prefix)
+inline bool input_decode_cursor(const uint8_t* data, size_t size, InputCursor& cursor) {
+    if (size != INPUT_CURSOR_SIZE || data[0] != INPUT_MSG_CURSOR) return false;
+    cursor.serial = get_u32(data + 1);
+    cursor.x = (int16_t)get_u16(data + 5);
+    cursor.y = (int16_t)get_u16(data + 7);
+    cursor.visible = data[9] != 0;
+    return true;
+}
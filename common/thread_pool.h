@@ -0,0 +1,144 @@
+#pragma once
+
+// Fixed-size worker pool for data-parallel work inside one pipeline stage
+// (e.g. encoding the stripes of a frame on several cores).
+//
+// parallel_for() hands out indices to the workers and to the calling
+// thread, and returns once every index has been processed, so the caller
+// can treat it like a plain loop. A pool of size 1 has no workers and simply
+// runs the loop inline.
+//
+// submit() queues a task for the workers and returns at once, for pools that
+// run independent jobs (the server's session stages). Don't mix the two uses
+// in one pool: a parallel_for waiting on helpers stuck behind long tasks
+// would stall.
+//
+// Neither allocates once the pool is warm, as long as submitted tasks fit
+// std::function's inline storage (two pointers in libstdc++): the task queue
+// is a ring that only grows, and parallel_for's bookkeeping lives on the
+// caller's stack.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // `threads` counts the calling thread; 0 means one per core
+    explicit ThreadPool(int threads) {
+        if (threads <= 0) threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 1; i < threads; i++) {
+            workers_.emplace_back([this] { worker(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& t : workers_) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return (int)workers_.size() + 1; }
+
+    // Run fn(i) for every i in [0, count) and wait for all of them
+    void parallel_for(int count, const std::function<void(int)>& fn) {
+        int helpers = std::min(count - 1, (int)workers_.size());
+        if (helpers <= 0) {
+            for (int i = 0; i < count; i++) fn(i);
+            return;
+        }
+
+        // Shared with the helpers, which only get a pointer to it
+        struct Loop {
+            const std::function<void(int)>& fn;
+            int count;
+            int helpers;
+            std::atomic<int> next{0};
+            int finished = 0;
+            std::mutex done_mutex;
+            std::condition_variable done;
+
+            Loop(const std::function<void(int)>& fn, int count, int helpers)
+                : fn(fn), count(count), helpers(helpers) {}
+
+            void run() {
+                for (int i = next++; i < count; i = next++) fn(i);
+            }
+        } loop(fn, count, helpers);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int h = 0; h < helpers; h++) {
+                push_task([l = &loop] {
+                    l->run();
+                    std::lock_guard<std::mutex> done_lock(l->done_mutex);
+                    if (++l->finished == l->helpers) l->done.notify_one();
+                });
+            }
+        }
+        wake_.notify_all();
+
+        loop.run();
+        std::unique_lock<std::mutex> lock(loop.done_mutex);
+        loop.done.wait(lock, [&] { return loop.finished == loop.helpers; });
+    }
+
+    // Run fn on a worker without waiting for it; inline if there are none
+    void submit(std::function<void()> fn) {
+        if (workers_.empty()) {
+            fn();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            push_task(std::move(fn));
+        }
+        wake_.notify_one();
+    }
+
+private:
+    // Append to the task ring, doubling it when full; the caller holds mutex_
+    void push_task(std::function<void()> fn) {
+        if (task_count_ == tasks_.size()) {
+            std::vector<std::function<void()>> grown(std::max<size_t>(8, tasks_.size() * 2));
+            for (size_t i = 0; i < task_count_; i++) grown[i] = std::move(tasks_[(task_head_ + i) % tasks_.size()]);
+            tasks_.swap(grown);
+            task_head_ = 0;
+        }
+        tasks_[(task_head_ + task_count_) % tasks_.size()] = std::move(fn);
+        task_count_++;
+    }
+
+    void worker() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || task_count_ > 0; });
+                if (!task_count_) return;
+                task = std::move(tasks_[task_head_]);
+                task_head_ = (task_head_ + 1) % tasks_.size();
+                task_count_--;
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::vector<std::function<void()>> tasks_;     // ring of task_count_ from task_head_
+    size_t task_head_ = 0;
+    size_t task_count_ = 0;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
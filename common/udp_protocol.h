@@ -0,0 +1,348 @@
+#pragma once
+
+// UDP video transport shared by the server and the clients.
+//
+// Over TCP one lost packet holds back every later frame until it has been
+// retransmitted. Over UDP each video message (the frame_protocol.h message
+// without its length prefix) is cut into packets of at most
+// UDP_PAYLOAD_SIZE bytes, every packet carrying
+//
+//   uint8  kind          UdpPacketKind
+//   uint8  flags         UDP_FLAG_*
+//   uint8  fec_group     data packets per parity packet, 0: no parity
+//   uint8  reserved      0
+//   uint32 seq           per-sender packet counter, for loss statistics
+//   uint32 frame_id      per-sender frame counter
+//   uint32 frame_size    bytes in the whole frame message
+//   uint16 index         data packet index, or parity group index
+//   uint16 count         data packets in the frame
+//   ...    payload
+//
+// With parity enabled, each group of fec_group data packets gets one
+// UDP_PARITY packet holding the XOR of their payloads (zero padded to
+// UDP_PAYLOAD_SIZE), which restores any single lost packet of the group.
+// Parity packets are sent after all of the frame's data packets.
+//
+// The receiver only shows complete frames, and only in frame_id order:
+// a frame that completes after a newer one was shown is late and dropped,
+// and an older frame still incomplete when a newer one completes is given
+// up. Losing a frame means later deltas would be drawn onto the wrong
+// picture, so from then on only keyframes are shown, and the receiver asks
+// for one with UDP_KEY_REQUEST until it gets it.
+//
+// The client subscribes by sending UDP_HELLO to the server's video port
+// and repeats it as a keepalive; the server stops streaming when the hellos
+// stop. The server in turn sends a UDP_HELLO whenever it had no frame to
+// send for UDP_HELLO_INTERVAL_MS, so an idle window's stream is not taken
+// for a dead one. Control packets are a bare header.
+//
+// All integers are big endian.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "frame_protocol.h"
+
+#define UDP_HEADER_SIZE 20
+#define UDP_PAYLOAD_SIZE 1200           // keeps header + IP/UDP under a 1280 byte MTU
+#define UDP_MAX_PACKET (UDP_HEADER_SIZE + UDP_PAYLOAD_SIZE)
+#define UDP_FRAME_TIMEOUT_MS 250        // incomplete frames older than this are lost
+#define UDP_KEY_REQUEST_INTERVAL_MS 100 // resend keyframe requests this often
+#define UDP_HELLO_INTERVAL_MS 1000      // keepalive, both ways
+#define UDP_PEER_TIMEOUT_MS 5000        // silence after which the other side is gone
+
+enum UdpPacketKind : uint8_t {
+    UDP_DATA = 0,
+    UDP_PARITY = 1,
+    UDP_HELLO = 2,
+    UDP_KEY_REQUEST = 3,
+};
+
+#define UDP_FLAG_KEYFRAME 0x01
+
+struct UdpHeader {
+    uint8_t kind = UDP_DATA;
+    uint8_t flags = 0;
+    uint8_t fec_group = 0;
+    uint32_t seq = 0;
+    uint32_t frame_id = 0;
+    uint32_t frame_size = 0;
+    uint16_t index = 0;
+    uint16_t count = 0;
+};
+
+inline void udp_write_header(uint8_t* p, const UdpHeader& h) {
+    p[0] = h.kind;
+    p[1] = h.flags;
+    p[2] = h.fec_group;
+    p[3] = 0;
+    set_u32(p + 4, h.seq);
+    set_u32(p + 8, h.frame_id);
+    set_u32(p + 12, h.frame_size);
+    p[16] = (uint8_t)(h.index >> 8);
+    p[17] = (uint8_t)h.index;
+    p[18] = (uint8_t)(h.count >> 8);
+    p[19] = (uint8_t)h.count;
+}
+
+inline void udp_put_header(std::vector<uint8_t>& out, const UdpHeader& h) {
+    size_t at = out.size();
+    out.resize(at + UDP_HEADER_SIZE);
+    udp_write_header(out.data() + at, h);
+}
+
+inline bool udp_get_header(const uint8_t* p, size_t size, UdpHeader& h) {
+    if (size < UDP_HEADER_SIZE) return false;
+    h.kind = p[0];
+    h.flags = p[1];
+    h.fec_group = p[2];
+    h.seq = get_u32(p + 4);
+    h.frame_id = get_u32(p + 8);
+    h.frame_size = get_u32(p + 12);
+    h.index = get_u16(p + 16);
+    h.count = get_u16(p + 18);
+    return true;
+}
+
+// A bare control packet (UDP_HELLO, UDP_KEY_REQUEST)
+inline void udp_control_packet(std::vector<uint8_t>& out, UdpPacketKind kind, uint32_t frame_id = 0) {
+    out.clear();
+    UdpHeader h;
+    h.kind = kind;
+    h.frame_id = frame_id;
+    udp_put_header(out, h);
+}
+
+// Frame ids wrap; a is newer than b if it is ahead by less than half the range
+inline bool udp_newer(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) > 0;
+}
+
+// Cut one frame message into packets (data, with a parity packet after
+// every `fec_group` of them). `packets` is reused between frames. Returns
+// false if the frame is too large for the 16-bit packet index.
+inline bool udp_packetize(const uint8_t* frame, size_t size, uint32_t frame_id, uint8_t flags, int fec_group,
+                          uint32_t& seq, std::vector<std::vector<uint8_t>>& packets, size_t& packet_count) {
+    size_t count = (size + UDP_PAYLOAD_SIZE - 1) / UDP_PAYLOAD_SIZE;
+    if (count == 0) count = 1;
+    if (count > 0xffff) return false;
+    if (fec_group < 0 || fec_group > 0xff) fec_group = 0;
+    size_t groups = fec_group ? (count + fec_group - 1) / fec_group : 0;
+    packet_count = count + groups;
+    if (packets.size() < packet_count) packets.resize(packet_count);
+
+    UdpHeader h;
+    h.flags = flags;
+    h.fec_group = (uint8_t)fec_group;
+    h.frame_id = frame_id;
+    h.frame_size = (uint32_t)size;
+    h.count = (uint16_t)count;
+
+    size_t next = 0;
+    std::vector<uint8_t>* parity = nullptr;
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = i * UDP_PAYLOAD_SIZE;
+        size_t len = std::min<size_t>(UDP_PAYLOAD_SIZE, size - offset);
+
+        std::vector<uint8_t>& pkt = packets[next++];
+        pkt.clear();
+        h.kind = UDP_DATA;
+        h.seq = seq++;
+        h.index = (uint16_t)i;
+        udp_put_header(pkt, h);
+        pkt.insert(pkt.end(), frame + offset, frame + offset + len);
+
+        if (!fec_group) continue;
+        if (i % fec_group == 0) {
+            parity = &packets[count + i / fec_group];
+            parity->assign(UDP_HEADER_SIZE + UDP_PAYLOAD_SIZE, 0);
+        }
+        uint8_t* p = parity->data() + UDP_HEADER_SIZE;
+        for (size_t b = 0; b < len; b++) p[b] ^= frame[offset + b];
+    }
+
+    // Parity goes last so that a burst loss does not take out data packets
+    // and the parity that would restore them together
+    for (size_t g = 0; g < groups; g++) {
+        h.kind = UDP_PARITY;
+        h.seq = seq++;
+        h.index = (uint16_t)g;
+        udp_write_header(packets[count + g].data(), h);
+    }
+    return true;
+}
+
+// A frame being put back together
+struct UdpPartialFrame {
+    uint32_t size = 0;
+    uint16_t count = 0;
+    uint8_t flags = 0;
+    uint8_t fec_group = 0;
+    int received = 0;                       // data packets present
+    std::vector<uint8_t> data;              // count * UDP_PAYLOAD_SIZE, zero padded
+    std::vector<uint8_t> have;              // per data packet
+    std::vector<std::vector<uint8_t>> parity;   // per group, empty until received
+    std::chrono::steady_clock::time_point first_seen;
+};
+
+struct UdpReassembler {
+    std::map<uint32_t, UdpPartialFrame> pending;
+    bool started = false;
+    uint32_t last_done = 0;         // frame_id of the last frame shown or skipped
+    bool need_keyframe = true;      // deltas are useless until the next keyframe
+    std::chrono::steady_clock::time_point last_key_request{};
+
+    // Statistics
+    bool seq_started = false;
+    uint32_t next_seq = 0;
+    uint64_t packets = 0;
+    uint64_t lost_packets = 0;      // gaps in seq
+    uint64_t recovered = 0;         // data packets rebuilt from parity
+    uint64_t frames_shown = 0;
+    uint64_t frames_dropped = 0;    // given up, late, or waiting for a keyframe
+};
+
+// Rebuild the missing data packet of `group` if it is the only one missing
+// and the group's parity has arrived
+inline void udp_try_recover(UdpReassembler& r, UdpPartialFrame& f, int group) {
+    if (!f.fec_group || group >= (int)f.parity.size() || f.parity[group].empty()) return;
+    int first = group * f.fec_group;
+    int last = std::min<int>(first + f.fec_group, f.count);
+    int missing = -1;
+    for (int i = first; i < last; i++) {
+        if (f.have[i]) continue;
+        if (missing >= 0) return;
+        missing = i;
+    }
+    if (missing < 0) return;
+
+    uint8_t* out = f.data.data() + (size_t)missing * UDP_PAYLOAD_SIZE;
+    memcpy(out, f.parity[group].data(), UDP_PAYLOAD_SIZE);
+    for (int i = first; i < last; i++) {
+        if (i == missing) continue;
+        const uint8_t* p = f.data.data() + (size_t)i * UDP_PAYLOAD_SIZE;
+        for (int b = 0; b < UDP_PAYLOAD_SIZE; b++) out[b] ^= p[b];
+    }
+    // The rebuilt packet may be the short last one: keep the padding zero
+    size_t end = (size_t)(missing + 1) * UDP_PAYLOAD_SIZE;
+    if (end > f.size) memset(f.data.data() + f.size, 0, end - f.size);
+    f.have[missing] = 1;
+    f.received++;
+    r.recovered++;
+}
+
+// Hand out a completed frame if it can still be shown; anything older is
+// given up
+inline bool udp_complete(UdpReassembler& r, uint32_t frame_id, std::vector<uint8_t>& frame) {
+    auto it = r.pending.find(frame_id);
+    UdpPartialFrame f = std::move(it->second);
+    r.pending.erase(it);
+
+    // Older frames that never completed are lost now
+    for (auto p = r.pending.begin(); p != r.pending.end();) {
+        if (udp_newer(frame_id, p->first)) {
+            p = r.pending.erase(p);
+            r.frames_dropped++;
+            r.need_keyframe = true;
+        } else {
+            ++p;
+        }
+    }
+    // Frames that lost every packet never showed up in `pending` at all
+    if (r.started && frame_id != r.last_done + 1) r.need_keyframe = true;
+    r.started = true;
+    r.last_done = frame_id;
+
+    bool keyframe = f.flags & UDP_FLAG_KEYFRAME;
+    if (r.need_keyframe && !keyframe) {
+        r.frames_dropped++;
+        return false;
+    }
+    if (keyframe) r.need_keyframe = false;
+    f.data.resize(f.size);
+    frame.swap(f.data);
+    r.frames_shown++;
+    return true;
+}
+
+// Feed one received packet. Returns true when it completed a frame that
+// should be shown; the frame message (type byte first) is then in `frame`.
+inline bool udp_receive(UdpReassembler& r, const uint8_t* pkt, size_t size, std::vector<uint8_t>& frame) {
+    UdpHeader h;
+    if (!udp_get_header(pkt, size, h)) return false;
+    if (h.kind != UDP_DATA && h.kind != UDP_PARITY) return false;
+    const uint8_t* payload = pkt + UDP_HEADER_SIZE;
+    size_t payload_size = size - UDP_HEADER_SIZE;
+
+    r.packets++;
+    if (r.seq_started && udp_newer(h.seq, r.next_seq)) r.lost_packets += h.seq - r.next_seq;
+    if (!r.seq_started || udp_newer(h.seq + 1, r.next_seq)) r.next_seq = h.seq + 1;
+    r.seq_started = true;
+
+    // Late: the frame was already shown or given up
+    if (r.started && !udp_newer(h.frame_id, r.last_done)) return false;
+    if (h.count == 0 || h.frame_size > (size_t)h.count * UDP_PAYLOAD_SIZE) return false;
+
+    auto it = r.pending.find(h.frame_id);
+    if (it == r.pending.end()) {
+        UdpPartialFrame f;
+        f.size = h.frame_size;
+        f.count = h.count;
+        f.flags = h.flags;
+        f.fec_group = h.fec_group;
+        f.data.assign((size_t)h.count * UDP_PAYLOAD_SIZE, 0);
+        f.have.assign(h.count, 0);
+        if (h.fec_group) f.parity.resize((h.count + h.fec_group - 1) / h.fec_group);
+        f.first_seen = std::chrono::steady_clock::now();
+        it = r.pending.emplace(h.frame_id, std::move(f)).first;
+    }
+    UdpPartialFrame& f = it->second;
+    if (h.count != f.count || h.frame_size != f.size) return false;
+
+    int group = -1;
+    if (h.kind == UDP_DATA) {
+        if (h.index >= f.count || f.have[h.index]) return false;
+        size_t offset = (size_t)h.index * UDP_PAYLOAD_SIZE;
+        size_t expected = std::min<size_t>(UDP_PAYLOAD_SIZE, f.size - std::min<size_t>(f.size, offset));
+        if (payload_size != expected) return false;
+        memcpy(f.data.data() + offset, payload, payload_size);
+        f.have[h.index] = 1;
+        f.received++;
+        if (f.fec_group) group = h.index / f.fec_group;
+    } else {
+        if (h.index >= f.parity.size() || payload_size != UDP_PAYLOAD_SIZE) return false;
+        f.parity[h.index].assign(payload, payload + payload_size);
+        group = h.index;
+    }
+    if (group >= 0 && f.received < f.count) udp_try_recover(r, f, group);
+
+    if (f.received < f.count) return false;
+    return udp_complete(r, h.frame_id, frame);
+}
+
+// Give up on frames that have waited too long for their packets
+inline void udp_expire(UdpReassembler& r) {
+    auto now = std::chrono::steady_clock::now();
+    for (auto p = r.pending.begin(); p != r.pending.end();) {
+        if (now - p->second.first_seen > std::chrono::milliseconds(UDP_FRAME_TIMEOUT_MS)) {
+            p = r.pending.erase(p);
+            r.frames_dropped++;
+            r.need_keyframe = true;
+        } else {
+            ++p;
+        }
+    }
+}
+
+// True if a keyframe request should go out now (rate limited)
+inline bool udp_wants_keyframe(UdpReassembler& r) {
+    if (!r.need_keyframe) return false;
+    auto now = std::chrono::steady_clock::now();
+    if (now - r.last_key_request < std::chrono::milliseconds(UDP_KEY_REQUEST_INTERVAL_MS)) return false;
+    r.last_key_request = now;
+    return true;
+}
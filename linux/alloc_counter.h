@@ -0,0 +1,99 @@
+#pragma once
+
+// Process-wide count of heap allocations, to check that streaming in steady
+// state does not allocate per frame.
+//
+// Built with -DWITH_ALLOC_COUNTER, this replaces malloc and friends with thin
+// wrappers around glibc's own allocator that bump one counter, so it sees
+// every allocation in the process: operator new, OpenCV's aligned Mat
+// buffers, Xlib, libjpeg. The definitions are not inline, so include this
+// header from exactly one translation unit. Without the flag nothing is
+// replaced and alloc_count() is always 0.
+
+#include <cstdint>
+
+#ifdef WITH_ALLOC_COUNTER
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+void __libc_free(void* ptr);
+}
+
+// Constant-initialized, so usable by allocations before main
+inline std::atomic<uint64_t> alloc_counter{0};
+
+inline uint64_t alloc_count() {
+    return alloc_counter.load(std::memory_order_relaxed);
+}
+
+inline void alloc_counted() {
+    alloc_counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+    alloc_counted();
+    return __libc_malloc(size);
+}
+
+void free(void* ptr) noexcept {
+    __libc_free(ptr);
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+    alloc_counted();
+    return __libc_calloc(count, size);
+}
+
+// Growing or shrinking in place counts too: the caller can't tell
+void* realloc(void* ptr, size_t size) noexcept {
+    alloc_counted();
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+    alloc_counted();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) noexcept {
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+    void* ptr = memalign(alignment, size);
+    if (!ptr) return ENOMEM;
+    *out = ptr;
+    return 0;
+}
+
+void* valloc(size_t size) noexcept {
+    alloc_counted();
+    return __libc_valloc(size);
+}
+
+void* pvalloc(size_t size) noexcept {
+    alloc_counted();
+    return __libc_pvalloc(size);
+}
+
+}
+
+#else
+
+inline uint64_t alloc_count() {
+    return 0;
+}
+
+#endif // WITH_ALLOC_COUNTER
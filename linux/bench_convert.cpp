@@ -0,0 +1,131 @@
+// Microbenchmark for the capture conversion kernels (pixel_convert.h) and
+// the output scaler (pixel_scale.h) against the OpenCV paths they replace.
+// Runs on synthetic 32bpp BGRX data, no X server needed.
+//
+//   ./bench_convert [width] [height] [iterations] [scale]
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <vector>
+#include "pixel_convert.h"
+#include "pixel_scale.h"
+
+static const char* level_name(SimdLevel level) {
+    switch (level) {
+    case SIMD_AVX2: return "avx2";
+    case SIMD_SSE41: return "sse4.1";
+    default: return "scalar";
+    }
+}
+
+// Run `fn` `iterations` times and report megapixels per second
+static void bench(const char* name, int pixels, int iterations, const std::function<void()>& fn) {
+    fn();   // warm up caches and lazy allocations
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) fn();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double ms = s * 1000.0 / iterations;
+    std::cout << "  " << name << ": " << ms << " ms/frame, " << (double)pixels * iterations / s / 1e6 << " Mpix/s\n";
+}
+
+int main(int argc, char** argv) {
+    int width = argc > 1 ? atoi(argv[1]) : 1920;
+    int height = argc > 2 ? atoi(argv[2]) : 1080;
+    int iterations = argc > 3 ? atoi(argv[3]) : 200;
+    double scale = argc > 4 ? atof(argv[4]) : 0.6;
+
+    // XImage rows are padded to 32 bits, which for 32bpp means tightly packed;
+    // give the source some extra stride too, like a window inside a larger
+    // segment, so the per-row path is measured as well.
+    int stride = width * 4 + 64;
+    std::vector<uint8_t> src((size_t)stride * height);
+    for (auto& b : src) b = (uint8_t)rand();
+
+    std::cout << "Frame " << width << "x" << height << ", " << iterations << " iterations, best SIMD: "
+              << level_name(detect_simd_level()) << "\n";
+
+    cv::Mat bgra(height, width, CV_8UC4, src.data(), stride);
+    cv::Mat bgr, yuv;
+    int pixels = width * height;
+
+    std::cout << "BGRX -> BGR\n";
+    bench("cv::cvtColor", pixels, iterations, [&] { cv::cvtColor(bgra, bgr, cv::COLOR_BGRA2BGR); });
+    bench("copy + cv::cvtColor", pixels, iterations, [&] {
+        cv::Mat copy = bgra.clone();
+        cv::cvtColor(copy, bgr, cv::COLOR_BGRA2BGR);
+    });
+    for (SimdLevel level : {SIMD_SCALAR, SIMD_SSE41, SIMD_AVX2}) {
+        if (level > detect_simd_level()) break;
+        simd_level_limit() = level;
+        bgr.create(height, width, CV_8UC3);
+        bench(level_name(level), pixels, iterations, [&] {
+            convert_to_bgr(PIXEL_BGRX32, src.data(), stride, bgr.data, (int)bgr.step, width, height);
+        });
+    }
+
+    int even_w = (width + 1) & ~1;
+    int even_h = (height + 1) & ~1;
+    std::vector<uint8_t> y((size_t)even_w * even_h), u((size_t)even_w * even_h / 4), v(u.size());
+
+    std::cout << "BGRX -> I420\n";
+    bench("cv::cvtColor x2", pixels, iterations, [&] {
+        cv::cvtColor(bgra, bgr, cv::COLOR_BGRA2BGR);
+        cv::cvtColor(bgr, yuv, cv::COLOR_BGR2YUV_I420);
+    });
+    for (SimdLevel level : {SIMD_SCALAR, SIMD_SSE41, SIMD_AVX2}) {
+        if (level > detect_simd_level()) break;
+        simd_level_limit() = level;
+        bench(level_name(level), pixels, iterations, [&] {
+            convert_to_i420(PIXEL_BGRX32, src.data(), stride, width, height,
+                            y.data(), even_w, u.data(), even_w / 2, v.data(), even_w / 2);
+        });
+    }
+
+    // Damage tiles: many small conversions out of one large buffer
+    const int tile = 64;
+    int tiles = (width / tile) * (height / tile);
+    std::cout << "BGRX -> BGR, " << tiles << " tiles of " << tile << "x" << tile << "\n";
+    bench("cv::cvtColor", tiles * tile * tile, iterations, [&] {
+        for (int ty = 0; ty + tile <= height; ty += tile)
+            for (int tx = 0; tx + tile <= width; tx += tile)
+                cv::cvtColor(bgra(cv::Rect(tx, ty, tile, tile)), bgr, cv::COLOR_BGRA2BGR);
+    });
+    simd_level_limit() = SIMD_AVX2;
+    cv::Mat out(tile, tile, CV_8UC3);
+    bench(level_name(detect_simd_level()), tiles * tile * tile, iterations, [&] {
+        for (int ty = 0; ty + tile <= height; ty += tile)
+            for (int tx = 0; tx + tile <= width; tx += tile)
+                convert_to_bgr(PIXEL_BGRX32, src.data() + (size_t)ty * stride + tx * 4, stride,
+                               out.data, (int)out.step, tile, tile);
+    });
+
+    // Output scaling: a keyframe's BGR image and an I420 luma plane, at a
+    // ratio that is not a whole number like most viewport fits
+    cv::Size scaled_size(std::max(1, (int)(width * scale)), std::max(1, (int)(height * scale)));
+    cv::Mat plane(height, width, CV_8UC1, y.data(), even_w);
+    cv::Mat scaled;
+    bgr.create(height, width, CV_8UC3);
+    convert_to_bgr(PIXEL_BGRX32, src.data(), stride, bgr.data, (int)bgr.step, width, height);
+    for (const cv::Mat* image : {&bgr, &plane}) {
+        std::cout << (image == &bgr ? "BGR" : "Plane") << " area scale to "
+                  << scaled_size.width << "x" << scaled_size.height << "\n";
+        bench("cv::resize INTER_AREA", pixels, iterations, [&] {
+            cv::resize(*image, scaled, scaled_size, 0, 0, cv::INTER_AREA);
+        });
+        AreaScaler scaler;
+        for (SimdLevel level : {SIMD_SCALAR, SIMD_SSE41, SIMD_AVX2}) {
+            if (level > detect_simd_level()) break;
+            simd_level_limit() = level;
+            scaled.create(scaled_size, image->type());
+            bench(level_name(level), pixels, iterations, [&] {
+                scale_area(scaler, image->data, (int)image->step, image->cols, image->rows,
+                           scaled.data, (int)scaled.step, scaled.cols, scaled.rows, image->channels());
+            });
+        }
+    }
+    return 0;
+}
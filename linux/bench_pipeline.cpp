@@ -0,0 +1,496 @@
+// End-to-end benchmark of the capture server: capture -> convert -> encode ->
+// send, measured on synthetic windows in a headless X server.
+//
+// For every scene and size the benchmark starts Xvfb (once), opens a window
+// drawing the scene, runs capture_stream on it with --window and --trace,
+// and reads the stream on a local socket the way a client would, without
+// decoding. It reports frames per second and bytes per frame as seen by the
+// sink, and per-stage latency from the server's trace, as JSON.
+//
+//   ./bench_pipeline --server ./capture_stream [options] [-- server options]
+//
+// Scenes:
+//   static   a screen of text drawn once; measures the idle cost
+//   scroll   text scrolling by one line every frame, like a busy log
+//   noise    new random pixels over the whole window every frame
+//
+// The server listens on its usual fixed ports, so nothing else may be using
+// them while the benchmark runs.
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <nlohmann/json.hpp>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pipeline_stats.h"
+#include "../common/frame_protocol.h"
+
+#define BENCH_PORT 12345            // capture_window.cpp PORT
+#define CONNECT_TIMEOUT_S 10
+#define XVFB_TIMEOUT_S 10
+#define TEXT_LINE_HEIGHT 16
+
+extern char** environ;
+
+using clock_type = std::chrono::steady_clock;
+using json = nlohmann::json;
+
+struct BenchOptions {
+    std::string server;
+    std::string display;            // existing X server instead of Xvfb
+    double seconds = 5;
+    double warmup = 1;
+    double scene_fps = 60;
+    std::vector<std::pair<int, int>> sizes = {{640, 480}, {1280, 720}, {1920, 1080}};
+    std::vector<std::string> scenes = {"static", "scroll", "noise"};
+    std::string output;             // default stdout
+    std::string build_type = "unknown";  // how the server was built, for the report
+    std::vector<std::string> server_args;
+};
+
+// What the sink saw while measuring
+struct SinkStats {
+    std::atomic<bool> measuring{false};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> keyframes{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+static pid_t spawn(const std::vector<std::string>& args, const std::vector<std::string>& env, const char* log_path) {
+    std::vector<char*> argv;
+    for (const std::string& a : args) argv.push_back((char*)a.c_str());
+    argv.push_back(nullptr);
+
+    std::vector<std::string> env_strings = env;
+    for (char** e = environ; *e; e++) {
+        if (strncmp(*e, "DISPLAY=", 8) != 0) env_strings.push_back(*e);
+    }
+    std::vector<char*> envp;
+    for (const std::string& e : env_strings) envp.push_back((char*)e.c_str());
+    envp.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (log_path) {
+        posix_spawn_file_actions_addopen(&actions, 1, log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        posix_spawn_file_actions_adddup2(&actions, 1, 2);
+    }
+    pid_t pid = -1;
+    int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    if (err) {
+        std::cerr << "[BENCH] Cannot start " << args[0] << ": " << strerror(err) << "\n";
+        return -1;
+    }
+    return pid;
+}
+
+static void stop_process(pid_t pid) {
+    if (pid <= 0) return;
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+// Start Xvfb on a free display; it writes the number it picked to the pipe
+static pid_t start_xvfb(int width, int height, std::string& display) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    std::string screen = std::to_string(width) + "x" + std::to_string(height) + "x24";
+    pid_t pid = spawn({"Xvfb", "-displayfd", std::to_string(fds[1]), "-screen", "0", screen, "-nolisten", "tcp"},
+                      {}, nullptr);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    std::string number;
+    pollfd pfd{fds[0], POLLIN, 0};
+    char c;
+    while (poll(&pfd, 1, XVFB_TIMEOUT_S * 1000) > 0 && read(fds[0], &c, 1) == 1 && c != '\n') number += c;
+    close(fds[0]);
+    if (number.empty()) {
+        std::cerr << "[BENCH] Xvfb did not start\n";
+        stop_process(pid);
+        return -1;
+    }
+    display = ":" + number;
+    return pid;
+}
+
+static int connect_sink(double timeout_s) {
+    auto deadline = clock_type::now() + std::chrono::duration<double>(timeout_s);
+    while (clock_type::now() < deadline) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(BENCH_PORT);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0) return sock;
+        close(sock);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return -1;
+}
+
+// Read exactly `size` bytes, giving up when asked to stop
+static bool read_exact(int sock, uint8_t* data, size_t size, const SinkStats& stats) {
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = recv(sock, data + got, size - got, 0);
+        if (n > 0) {
+            got += (size_t)n;
+            continue;
+        }
+        if (n == 0) return false;
+        if ((errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) || stats.stop) return false;
+    }
+    return true;
+}
+
+// Read messages like a client, counting them instead of drawing them
+static void run_sink(int sock, SinkStats& stats) {
+    timeval tv{0, 200 * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    std::vector<uint8_t> payload;
+    uint8_t header[5];
+    while (!stats.stop) {
+        if (!read_exact(sock, header, sizeof(header), stats)) break;
+        uint32_t length = get_u32(header);
+        if (length < 1) break;
+        payload.resize(length - 1);
+        if (!read_exact(sock, payload.data(), payload.size(), stats)) break;
+        if (!stats.measuring) continue;
+        stats.frames++;
+        stats.bytes += 4 + length;
+        if (header[4] == FRAME_KEY || header[4] == FRAME_KEY_TILES) stats.keyframes++;
+    }
+}
+
+// A window drawing one of the scenes
+struct SceneWindow {
+    Display* dpy = nullptr;
+    Window window = 0;
+    GC gc = nullptr;
+    std::string scene;
+    int width = 0;
+    int height = 0;
+    int line = 0;
+    std::vector<uint32_t> noise;    // more than a frame, read at a random offset
+};
+
+static void draw_text_line(SceneWindow& w, int y) {
+    char text[128];
+    snprintf(text, sizeof(text), "%06d  The quick brown fox jumps over the lazy dog. 0123456789 ABCDEF", w.line++);
+    XDrawString(w.dpy, w.window, w.gc, 4, y, text, (int)strlen(text));
+}
+
+static void draw_full(SceneWindow& w) {
+    XSetForeground(w.dpy, w.gc, WhitePixel(w.dpy, DefaultScreen(w.dpy)));
+    XFillRectangle(w.dpy, w.window, w.gc, 0, 0, w.width, w.height);
+    XSetForeground(w.dpy, w.gc, BlackPixel(w.dpy, DefaultScreen(w.dpy)));
+    for (int y = TEXT_LINE_HEIGHT; y < w.height; y += TEXT_LINE_HEIGHT) draw_text_line(w, y);
+}
+
+static void draw_tick(SceneWindow& w) {
+    if (w.scene == "scroll") {
+        XCopyArea(w.dpy, w.window, w.window, w.gc, 0, TEXT_LINE_HEIGHT, w.width, w.height - TEXT_LINE_HEIGHT, 0, 0);
+        XSetForeground(w.dpy, w.gc, WhitePixel(w.dpy, DefaultScreen(w.dpy)));
+        XFillRectangle(w.dpy, w.window, w.gc, 0, w.height - TEXT_LINE_HEIGHT, w.width, TEXT_LINE_HEIGHT);
+        XSetForeground(w.dpy, w.gc, BlackPixel(w.dpy, DefaultScreen(w.dpy)));
+        draw_text_line(w, w.height - 4);
+    } else if (w.scene == "noise") {
+        size_t offset = (size_t)rand() % (w.noise.size() - (size_t)w.width * w.height);
+        XImage* image = XCreateImage(w.dpy, DefaultVisual(w.dpy, DefaultScreen(w.dpy)), 24, ZPixmap, 0,
+                                     (char*)(w.noise.data() + offset), w.width, w.height, 32, w.width * 4);
+        XPutImage(w.dpy, w.window, w.gc, image, 0, 0, 0, 0, w.width, w.height);
+        image->data = nullptr;      // not ours to free
+        XDestroyImage(image);
+    }
+    // Keep the server's work to this frame, not a backlog of requests
+    XSync(w.dpy, False);
+}
+
+static bool open_scene(SceneWindow& w, const std::string& display, const std::string& scene, int width,
+                       int height, const std::string& title) {
+    w.dpy = XOpenDisplay(display.c_str());
+    if (!w.dpy) {
+        std::cerr << "[BENCH] Cannot open display " << display << "\n";
+        return false;
+    }
+    w.scene = scene;
+    w.width = width;
+    w.height = height;
+    int screen = DefaultScreen(w.dpy);
+    w.window = XCreateSimpleWindow(w.dpy, RootWindow(w.dpy, screen), 0, 0, width, height, 0,
+                                   BlackPixel(w.dpy, screen), WhitePixel(w.dpy, screen));
+    XStoreName(w.dpy, w.window, title.c_str());
+    XSelectInput(w.dpy, w.window, ExposureMask | StructureNotifyMask);
+    w.gc = XCreateGC(w.dpy, w.window, 0, nullptr);
+    if (scene == "noise") {
+        w.noise.resize((size_t)width * height + 65536);
+        for (uint32_t& p : w.noise) p = (uint32_t)rand() & 0xFFFFFF;
+    }
+    XMapWindow(w.dpy, w.window);
+    XEvent ev;
+    do XNextEvent(w.dpy, &ev);
+    while (ev.type != MapNotify);
+    draw_full(w);
+    XSync(w.dpy, False);
+    return true;
+}
+
+static void close_scene(SceneWindow& w) {
+    if (!w.dpy) return;
+    XFreeGC(w.dpy, w.gc);
+    XDestroyWindow(w.dpy, w.window);
+    XCloseDisplay(w.dpy);
+    w = SceneWindow{};
+}
+
+// Per-stage latency from the server's trace. The file is unterminated if
+// the server was stopped before it closed it.
+static json stage_latency(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    std::string body = text.str();
+    while (!body.empty() && isspace((unsigned char)body.back())) body.pop_back();
+    if (body.empty()) return json::object();
+    if (body.back() != ']') body += "]";
+
+    json events = json::parse(body, nullptr, false);
+    if (!events.is_array()) return json::object();
+    PipelineStats stats;
+    for (const json& ev : events) {
+        if (ev.value("ph", "") != "X") continue;
+        std::string name = ev.value("name", "");
+        for (int stage = 0; stage < STAT_COUNT; stage++) {
+            if (name == stat_stage_name(stage)) histogram_record(stats.stages[stage], ev.value("dur", 0ull));
+        }
+    }
+    json out = json::object();
+    for (int stage = 0; stage < STAT_COUNT; stage++) {
+        HistogramSnapshot h;
+        histogram_take(stats.stages[stage], h);
+        out[stat_stage_name(stage)] = {
+            {"count", h.count},
+            {"p50_ms", histogram_percentile(h, 0.5) / 1000.0},
+            {"p99_ms", histogram_percentile(h, 0.99) / 1000.0},
+            {"max_ms", h.max_us / 1000.0},
+        };
+    }
+    return out;
+}
+
+// One scene at one size. Returns a null json if it could not run.
+static json run_case(const BenchOptions& opt, const std::string& display, const std::string& scene, int width,
+                     int height) {
+    std::string title = "bench " + scene + " " + std::to_string(width) + "x" + std::to_string(height);
+    std::string trace_path = "bench_trace_" + scene + "_" + std::to_string(width) + "x" + std::to_string(height) + ".json";
+    std::cerr << "[BENCH] " << title << "\n";
+    unlink(trace_path.c_str());
+
+    SceneWindow w;
+    if (!open_scene(w, display, scene, width, height, title)) return json();
+
+    std::vector<std::string> args = {opt.server, "--window", title, "--trace", trace_path, "--stats-interval", "0"};
+    args.insert(args.end(), opt.server_args.begin(), opt.server_args.end());
+    pid_t server = spawn(args, {"DISPLAY=" + display}, "bench_server.log");
+    int sock = server > 0 ? connect_sink(CONNECT_TIMEOUT_S) : -1;
+    if (sock < 0) {
+        std::cerr << "[BENCH] Server did not come up, see bench_server.log\n";
+        stop_process(server);
+        close_scene(w);
+        return json();
+    }
+
+    SinkStats sink;
+    std::thread reader(run_sink, sock, std::ref(sink));
+
+    auto interval = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(1.0 / opt.scene_fps));
+    auto start = clock_type::now();
+    auto measure_from = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(opt.warmup));
+    auto measure_to = measure_from + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(opt.seconds));
+    auto next = start;
+    while (true) {
+        auto now = clock_type::now();
+        if (now >= measure_to) break;
+        if (now >= measure_from && !sink.measuring) sink.measuring = true;
+        while (XPending(w.dpy)) {
+            XEvent ev;
+            XNextEvent(w.dpy, &ev);
+            if (ev.type == Expose && ev.xexpose.count == 0) draw_full(w);
+        }
+        draw_tick(w);
+        next += interval;
+        if (next < clock_type::now()) next = clock_type::now();
+        std::this_thread::sleep_until(std::min(next, measure_to));
+    }
+    sink.measuring = false;
+    double seconds = std::chrono::duration<double>(clock_type::now() - measure_from).count();
+
+    // Hanging up ends the session, which flushes the trace
+    sink.stop = true;
+    reader.join();
+    close(sock);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    stop_process(server);
+    close_scene(w);
+
+    uint64_t frames = sink.frames;
+    uint64_t bytes = sink.bytes;
+    return {
+        {"scene", scene},
+        {"width", width},
+        {"height", height},
+        {"seconds", seconds},
+        {"frames", frames},
+        {"keyframes", (uint64_t)sink.keyframes},
+        {"fps", frames / seconds},
+        {"bytes", bytes},
+        {"bytes_per_frame", frames ? (double)bytes / frames : 0.0},
+        {"mbit_per_s", bytes * 8 / seconds / 1e6},
+        {"stages_ms", stage_latency(trace_path)},
+    };
+}
+
+static std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> out;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) out.push_back(item);
+    }
+    return out;
+}
+
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " --server PATH [options] [-- server options]\n"
+              << "  --server PATH      capture_stream binary to measure\n"
+              << "  --display D        use this X server instead of starting Xvfb\n"
+              << "  --seconds S        measured time per case (default 5)\n"
+              << "  --warmup S         unmeasured time before that (default 1)\n"
+              << "  --scene-fps N      how often the scenes redraw (default 60)\n"
+              << "  --sizes WxH,...    window sizes (default 640x480,1280x720,1920x1080)\n"
+              << "  --scenes A,...     static, scroll, noise (default all)\n"
+              << "  --output FILE      write the JSON report to FILE instead of stdout\n"
+              << "  --build-type NAME  how the server was built, recorded in the report\n";
+}
+
+static bool parse_args(int argc, char** argv, BenchOptions& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--") {
+            opt.server_args.assign(argv + i + 1, argv + argc);
+            break;
+        } else if (arg == "--server" && has_value) {
+            opt.server = argv[++i];
+        } else if (arg == "--display" && has_value) {
+            opt.display = argv[++i];
+        } else if (arg == "--seconds" && has_value) {
+            opt.seconds = std::max(0.5, atof(argv[++i]));
+        } else if (arg == "--warmup" && has_value) {
+            opt.warmup = std::max(0.0, atof(argv[++i]));
+        } else if (arg == "--scene-fps" && has_value) {
+            opt.scene_fps = std::max(1.0, atof(argv[++i]));
+        } else if (arg == "--sizes" && has_value) {
+            opt.sizes.clear();
+            for (const std::string& size : split(argv[++i])) {
+                int w, h;
+                if (sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w < 16 || h < 16) return false;
+                opt.sizes.push_back({w, h});
+            }
+        } else if (arg == "--scenes" && has_value) {
+            opt.scenes = split(argv[++i]);
+            for (const std::string& scene : opt.scenes) {
+                if (scene != "static" && scene != "scroll" && scene != "noise") return false;
+            }
+        } else if (arg == "--output" && has_value) {
+            opt.output = argv[++i];
+        } else if (arg == "--build-type" && has_value) {
+            opt.build_type = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return !opt.server.empty() && !opt.sizes.empty() && !opt.scenes.empty();
+}
+
+int main(int argc, char** argv) {
+    BenchOptions opt;
+    if (!parse_args(argc, argv, opt)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string display = opt.display;
+    pid_t xvfb = -1;
+    if (display.empty()) {
+        int screen_width = 0, screen_height = 0;
+        for (const auto& size : opt.sizes) {
+            screen_width = std::max(screen_width, size.first);
+            screen_height = std::max(screen_height, size.second);
+        }
+        xvfb = start_xvfb(screen_width, screen_height, display);
+        if (xvfb < 0) return 1;
+        std::cerr << "[BENCH] Xvfb on " << display << "\n";
+    }
+
+    json results = json::array();
+    bool ok = true;
+    for (const auto& size : opt.sizes) {
+        for (const std::string& scene : opt.scenes) {
+            json result = run_case(opt, display, scene, size.first, size.second);
+            if (result.is_null()) {
+                ok = false;
+                continue;
+            }
+            results.push_back(result);
+        }
+    }
+    stop_process(xvfb);
+
+    json report = {
+        {"server", opt.server},
+        {"server_args", opt.server_args},
+        {"build_type", opt.build_type},
+        {"seconds", opt.seconds},
+        {"scene_fps", opt.scene_fps},
+        {"results", results},
+    };
+    if (opt.output.empty()) {
+        std::cout << report.dump(2) << "\n";
+    } else {
+        std::ofstream out(opt.output);
+        out << report.dump(2) << "\n";
+        std::cerr << "[BENCH] Report written to " << opt.output << "\n";
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+// Fan-out of one encoded stream to several TCP viewers.
+//
+// The pipeline captures and encodes once; every encoded message is shared
+// (not copied) into one bounded queue per viewer. Viewer sockets are
+// non-blocking and written by the server's event loop whenever they can take
+// more (viewer_flush), so a slow display only backs up its own queue and
+// costs no thread. When a viewer's queue is full it skips that frame, and
+// then every frame up to the next keyframe, since deltas are drawn on top of
+// the frame before. It also asks the pipeline for an early keyframe, at most
+// every BROADCAST_KEY_INTERVAL_MS so one slow viewer cannot make everybody
+// pay for keyframes. New viewers wait for a keyframe the same way; the
+// caller forces one when it adds them.
+//
+// A stream with a single viewer uses the same queue, but the caller only
+// offers a frame once the previous one is written, so the pipeline's own
+// queues decide what gets dropped.
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#define BROADCAST_KEY_INTERVAL_MS 1000
+
+// One encoded message, shared by every viewer queue it is in
+struct BroadcastFrame {
+    std::shared_ptr<const std::vector<uint8_t>> msg;
+    bool keyframe = false;
+};
+
+// A viewer's bounded queue: a ring made once, so queueing a frame never
+// allocates. Popping lets go of the frame, returning its buffer to the pool
+// once every viewer is done with it.
+class ViewerQueue {
+public:
+    explicit ViewerQueue(size_t capacity) : frames_(capacity) {}
+
+    bool empty() const { return count_ == 0; }
+    size_t size() const { return count_; }
+    const BroadcastFrame& front() const { return frames_[head_]; }
+
+    // The caller checks size() against the capacity first
+    void push_back(const BroadcastFrame& frame) {
+        frames_[(head_ + count_) % frames_.size()] = frame;
+        count_++;
+    }
+
+    void pop_front() {
+        frames_[head_] = BroadcastFrame();
+        head_ = (head_ + 1) % frames_.size();
+        count_--;
+    }
+
+private:
+    std::vector<BroadcastFrame> frames_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+};
+
+struct Viewer {
+    int sock;
+    ViewerQueue queue;
+    size_t offset = 0;              // bytes of queue.front() already written
+    bool waiting_for_key = true;
+    size_t written_bytes = 0;       // of messages finished since the caller last looked
+    bool polling_out = false;       // the caller is waiting for the socket to drain
+    uint64_t sent = 0;
+    uint64_t skipped = 0;
+
+    Viewer(int sock, size_t queue_depth) : sock(sock), queue(queue_depth) {}
+};
+
+struct Broadcast {
+    size_t queue_depth;
+    std::vector<std::unique_ptr<Viewer>> viewers;
+    // A viewer fell behind; the pipeline should start a keyframe
+    bool want_keyframe = false;
+    std::chrono::steady_clock::time_point last_key_request{};
+    uint64_t skipped = 0;           // by all viewers, past and present
+
+    explicit Broadcast(size_t queue_depth) : queue_depth(queue_depth ? queue_depth : 1) {}
+};
+
+// Start streaming to `sock`, which the broadcast now owns. The caller should
+// force a keyframe.
+inline Viewer& broadcast_add(Broadcast& b, int sock) {
+    b.viewers.emplace_back(new Viewer(sock, b.queue_depth));
+    std::cout << "[BROADCAST] Viewer " << sock << " joined, " << b.viewers.size() << " watching\n";
+    return *b.viewers.back();
+}
+
+// Disconnect viewer `index`
+inline void broadcast_remove(Broadcast& b, size_t index) {
+    Viewer& v = *b.viewers[index];
+    close(v.sock);
+    std::cout << "[BROADCAST] Viewer " << v.sock << " left (sent " << v.sent << ", skipped " << v.skipped << ")\n";
+    b.viewers.erase(b.viewers.begin() + index);
+}
+
+// Queue one message for every viewer that can take it
+inline void broadcast_offer(Broadcast& b, const BroadcastFrame& frame) {
+    for (std::unique_ptr<Viewer>& v : b.viewers) {
+        if (v->waiting_for_key && !frame.keyframe) {
+            v->skipped++;
+            b.skipped++;
+            continue;
+        }
+        if (v->queue.size() >= b.queue_depth) {
+            v->waiting_for_key = true;
+            v->skipped++;
+            b.skipped++;
+            auto now = std::chrono::steady_clock::now();
+            if (now - b.last_key_request >= std::chrono::milliseconds(BROADCAST_KEY_INTERVAL_MS)) {
+                b.last_key_request = now;
+                b.want_keyframe = true;
+            }
+            continue;
+        }
+        v->waiting_for_key = false;
+        v->queue.push_back(frame);
+    }
+}
+
+// Write as much of the viewer's queue as the socket takes. Returns 1 once
+// the queue is empty, 0 if the socket is full, -1 if the viewer is gone.
+inline int viewer_flush(Viewer& v) {
+    while (!v.queue.empty()) {
+        const std::vector<uint8_t>& msg = *v.queue.front().msg;
+        ssize_t n = send(v.sock, msg.data() + v.offset, msg.size() - v.offset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        v.offset += (size_t)n;
+        if (v.offset < msg.size()) continue;
+        v.written_bytes += msg.size();
+        v.offset = 0;
+        v.sent++;
+        v.queue.pop_front();
+    }
+    return 1;
+}
+
+// Disconnect everybody
+inline void broadcast_close(Broadcast& b) {
+    while (!b.viewers.empty()) broadcast_remove(b, b.viewers.size() - 1);
+}
@@ -5,66 +5,175 @@
 #include <X11/Xutil.h>
 #include <X11/extensions/XTest.h>
 #include <thread>
+#include <atomic>
+#include <chrono>
 #include <nlohmann/json.hpp>
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <string>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sstream>
+#include <iomanip>
 #include <X11/Xatom.h>
+#include "shm_capture.h"
+#include "pixel_convert.h"
+#include "pixel_scale.h"
+#include "damage_tracker.h"
+#include "../common/frame_protocol.h"
+#include "../common/frame_queue.h"
+#include "../common/frame_pool.h"
+#include "../common/frame_scheduler.h"
+#include "../common/thread_pool.h"
+#include "../common/input_protocol.h"
+#include "h264_encoder.h"
+#include "quality_controller.h"
+#include "input_session.h"
+#include "input_queue.h"
+#include "udp_transport.h"
+#include "socket_io.h"
+#include "broadcast.h"
+#include "edge_watcher.h"
+#include "cursor_tracker.h"
+#include "window_index.h"
+#include "window_capture.h"
+#include "pipeline_stats.h"
+#include "alloc_counter.h"
 #define PORT 12345
-bool is_running = true;
-Window inputBlocker;
-// Recursive function to find window by title substring
-Window findWindow(Display* dpy, Window root, const char* title_substr) {
-    Window ret = 0;
-    Window root_return, parent_return;
-    Window* children;
-    unsigned int nchildren;
-
-    char* window_name = nullptr;
-    if (XFetchName(dpy, root, &window_name)) {
-        if (window_name) {
-            if (strstr(window_name, title_substr)) {
-                ret = root;
-                XFree(window_name);
-                return ret;
-            }
-            XFree(window_name);
-        }
+#define INPUT_PORT 12346
+#define TILE_SIZE 64
+#define KEYFRAME_INTERVAL 60        // frames between forced full frames
+#define DELTA_MAX_COVERAGE 0.5      // above this dirty fraction a keyframe is cheaper
+#define TARGET_FPS 30               // while the window content changes
+#define MIN_FPS 2                   // idle rate when nothing changes
+#define MAX_FPS 60                  // boost rate right after input
+#define QUEUE_DEPTH 2               // frames buffered between pipeline stages
+#define STATS_INTERVAL_S 5
+#define JPEG_QUALITY 80
+#define H264_GOP 30
+#define STRIPE_MIN_PIXELS (640 * 480) // smaller keyframes are not worth splitting
+#define STRIPE_ALIGN 16             // stripe height multiple (JPEG 4:2:0 MCU)
+#define FOCUS_TIMEOUT_MS 100        // how long a click or key waits for FocusIn
+#define INPUT_QUEUE_CAPACITY 1024   // button/key/wheel events waiting for injection
+#define INPUT_MAX_MESSAGE (1 << 20) // larger input messages drop the client
+#define INPUT_LOBBY_BUFFER (64 * 1024) // input kept for a window that does not exist yet
+#define VIEWER_QUEUE_DEPTH 4        // frames a broadcast viewer may fall behind
+#define LISTEN_BACKLOG 8            // pending connections on the video and input ports
+#define SERVER_WORKERS 4            // threads running session steps, shared by all sessions
+#define MAX_EVENTS 64
+#define INPUT_FRAMES_TRACKED 64     // sent frames answering input, awaiting acks
+#define VIEWPORT_MIN_SCALE 0.1      // smallest output scale a client viewport can ask for
+
+enum class EncoderType {
+    Jpeg,
+    H264,
+};
+
+enum class Transport {
+    Tcp,
+    Udp,        // udp_transport.h: no head-of-line blocking, lost frames are skipped
+};
+
+enum class InputMode {
+    Fast,       // persistent blocker and focus per session (input_session.h)
+    Legacy,     // blocker, sleeps and focus polling around every message
+};
+
+// Runtime settings, filled from the command line in main
+struct StreamConfig {
+    size_t queue_depth = QUEUE_DEPTH;
+    QueuePolicy drop_policy = QueuePolicy::DropOldest;
+    EncoderType encoder = EncoderType::Jpeg;
+    int gop = H264_GOP;
+    double target_fps = TARGET_FPS;
+    double min_fps = MIN_FPS;
+    double max_fps = MAX_FPS;
+    int target_latency_ms = 0;      // 0: fixed JPEG_QUALITY
+    bool adaptive_scale = false;
+    double min_scale = 0.5;
+    bool fit_viewport = true;       // scale the output down to the client's viewport
+    int encode_threads = 1;         // JPEG encoder threads, 0: one per core
+    InputMode input_mode = InputMode::Fast;
+    Transport transport = Transport::Tcp;
+    int fec_group = 0;              // UDP data packets per parity packet, 0: none
+    double udp_loss = 0;            // simulated UDP packet loss, 0..1
+    bool broadcast = false;         // one encode for any number of TCP viewers
+    size_t viewer_queue = VIEWER_QUEUE_DEPTH;
+    int workers = SERVER_WORKERS;
+    size_t max_sessions = 0;        // windows streamed at once, 0: no limit
+    std::string window_title;       // stream this window without an edge drag
+    int stats_interval_s = STATS_INTERVAL_S;    // 0: no periodic stats
+    std::string trace_path;         // Chrome trace of every pipeline step
+};
+StreamConfig config;
+TraceWriter trace;
+// Convert a captured region to OpenCV Mat (BGR) in one pass over the capture
+// buffer, with the kernel for the server's pixel format (pixel_convert.h).
+void regionToMat(const CaptureRegion& region, cv::Mat& out) {
+    out.create(region.height, region.width, CV_8UC3);
+    if (!convert_to_bgr(region.format, (const uint8_t*)region.data, region.stride,
+                        out.data, (int)out.step, region.width, region.height)) {
+        // Unknown layout: treat it as 32bpp BGRX like we always did
+        cv::Mat bgra(region.height, region.width, CV_8UC4, (void*)region.data, region.stride);
+        cv::cvtColor(bgra, out, cv::COLOR_BGRA2BGR);
     }
+}
 
-    if (XQueryTree(dpy, root, &root_return, &parent_return, &children, &nchildren) == 0)
-        return 0;
+// Planar 4:2:0 picture for the H.264 encoder. Both dimensions are even; u and
+// v are half the size of y.
+struct Yuv420Image {
+    cv::Mat y, u, v;
+};
 
-    for (unsigned int i = 0; i < nchildren; i++) {
-        ret = findWindow(dpy, children[i], title_substr);
-        if (ret)
-            break;
-    }
+void yuv420Create(Yuv420Image& image, int width, int height) {
+    image.y.create(height, width, CV_8UC1);
+    image.u.create(height / 2, width / 2, CV_8UC1);
+    image.v.create(height / 2, width / 2, CV_8UC1);
+}
 
-    if (children)
-        XFree(children);
-    return ret;
+// The part of `image` that covers window rectangle `r`, padded to even like
+// regionToYuv's output. `r` has to start on even coordinates.
+Yuv420Image yuv420View(const Yuv420Image& image, const cv::Rect& r) {
+    int width = (r.width + 1) & ~1, height = (r.height + 1) & ~1;
+    cv::Rect chroma(r.x / 2, r.y / 2, width / 2, height / 2);
+    return {image.y(cv::Rect(r.x, r.y, width, height)), image.u(chroma), image.v(chroma)};
 }
 
-// Convert XImage to OpenCV Mat (BGRA)
-cv::Mat ximageToMat(XImage* image) {
-    int width = image->width;
-    int height = image->height;
-    cv::Mat mat(height, width, CV_8UC4);
-    memcpy(mat.data, image->data, width * height * 4);
+// Convert a captured region straight to I420, skipping the BGR image. Odd
+// sizes are padded to even by repeating the last row or column.
+void regionToYuv(const CaptureRegion& region, Yuv420Image& out) {
+    yuv420Create(out, (region.width + 1) & ~1, (region.height + 1) & ~1);
+    const uint8_t* src = (const uint8_t*)region.data;
+    int stride = region.stride;
+    PixelFormat format = region.format;
     cv::Mat bgr;
-    cv::cvtColor(mat, bgr, cv::COLOR_BGRA2BGR);
-    return bgr;
+    if (format == PIXEL_UNSUPPORTED) {
+        regionToMat(region, bgr);
+        src = bgr.data;
+        stride = (int)bgr.step;
+        format = PIXEL_BGR24;
+    }
+    convert_to_i420(format, src, stride, region.width, region.height,
+                    out.y.data, (int)out.y.step, out.u.data, (int)out.u.step, out.v.data, (int)out.v.step);
 }
 
-
 void setWindowOpacity(Display* dpy, Window win, unsigned long opacity) {
-    Atom property = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
+    // Only ever called on the server's display; intern the atom once
+    static Atom property = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
     if (property == None) {
         std::cerr << "No _NET_WM_WINDOW_OPACITY atom available\n";
         return;
@@ -90,445 +199,2130 @@ int wait_for_focus(Display* dpy, Window win, int timeout_ms = 5000) {
     return 0; // failed to get focus
 }
 
+// Decode a JSON input message (the original protocol, still used by
+// client.py) into events. A JSON key is a press and release. Missing or
+// mistyped fields throw, which drops just this message.
+void inputEventsFromJson(const nlohmann::json& msg, std::vector<InputEvent>& events) {
+    std::string type = msg.value("type", "");
+    InputEvent ev;
+    if (type == "click" || type == "dclick") {
+        ev.type = type == "click" ? INPUT_CLICK : INPUT_DCLICK;
+        ev.button = msg.value("button", "left") == "right" ? 3 : 1;
+        ev.x = (int16_t)msg.at("x").get<int>();
+        ev.y = (int16_t)msg.at("y").get<int>();
+        events.push_back(ev);
+    } else if (type == "key") {
+        std::string key_str = msg.at("key").get<std::string>();
+        ev.keysym = key_str.size() == 1 ? keysym_from_char((unsigned char)key_str[0])
+                                        : (uint32_t)XStringToKeysym(key_str.c_str());
+        if (ev.keysym == NoSymbol) {
+            std::cerr << "[INPUT] Unknown key: " << key_str << "\n";
+            return;
+        }
+        ev.type = INPUT_KEY_DOWN;
+        events.push_back(ev);
+        ev.type = INPUT_KEY_UP;
+        events.push_back(ev);
+    }
+}
 
-void handle_input_events(Display* dpy, Window window, int port) {
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    struct sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
-
-    bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr));
-    listen(sock_fd, 1);
-    std::cout << "[INPUT] Listening on port " << port << "...\n";
-    int client_fd = accept(sock_fd, nullptr, nullptr);
-    std::cout << "[INPUT] Client connected.\n";
-
-    char header[4];
-    std::vector<char> buffer;
-
-    XWindowAttributes attr;
-    XGetWindowAttributes(dpy, window, &attr);
+// Move the pointer to frame coordinates (x, y) of the streamed window; `scale`
+// is the session's output size / window size
+void warpToFrame(Display* dpy, Window window, int x, int y, double scale) {
     Window root = DefaultRootWindow(dpy);
+    int abs_x, abs_y;
+    Window dummy;
+    XTranslateCoordinates(dpy, window, root, 0, 0, &abs_x, &abs_y, &dummy);
+    XWarpPointer(dpy, None, root, 0, 0, 0, 0, abs_x + frame_to_window(x, scale), abs_y + frame_to_window(y, scale));
+}
 
-    while (true) {
-        int received = recv(client_fd, header, 4, MSG_WAITALL);
-        if (received != 4) break;
-
-        uint32_t msg_size;
-        memcpy(&msg_size, header, 4);
-        msg_size = ntohl(msg_size);
-
-        buffer.resize(msg_size);
-        received = recv(client_fd, buffer.data(), msg_size, MSG_WAITALL);
-        if (received != msg_size) break;
-
-        std::string json_str(buffer.begin(), buffer.end());
-        try {
-            auto msg = nlohmann::json::parse(json_str);
-            XWindowAttributes attr;
-            XGetWindowAttributes(dpy, window, &attr);
-            Window focus_window;
-            int revert_to;
-             XGetInputFocus(dpy, &focus_window, &revert_to);
-             Window root = DefaultRootWindow(dpy);
-            XSetWindowAttributes wa;
-            wa.override_redirect = True;  // Prevent window manager interference
-
-           inputBlocker = XCreateWindow(
-    dpy,
-    root,
-    attr.x, attr.y,
-    attr.width, attr.height,
-    0,                // border width
-    0,                // depth: 0 = default for InputOnly
-    InputOnly,        // class
-    CopyFromParent,   // visual
-    CWOverrideRedirect,
-    &wa
-);
-
-                XMapRaised(dpy, inputBlocker);
-                XFlush(dpy);
-            usleep(75000);
-            std::cout <<"Made blocker\n";
-            setWindowOpacity(dpy, window, 0x00000000);
+// Press and release `button` `count` times
+void clickButton(Display* dpy, int button, int count) {
+    for (int i = 0; i < count; i++) {
+        XTestFakeButtonEvent(dpy, button, True, CurrentTime);
+        XTestFakeButtonEvent(dpy, button, False, CurrentTime);
+    }
+}
+
+// Replay one event on the window. Returns false when the client asked to
+// stop streaming (Escape).
+bool injectEvent(Display* dpy, Window window, const InputEvent& ev, double scale) {
+    switch (ev.type) {
+    case INPUT_CLICK:
+    case INPUT_DCLICK: {
+        XWindowAttributes attr_check;
+        if (!XGetWindowAttributes(dpy, window, &attr_check) || attr_check.map_state != IsViewable) {
+            std::cerr << "[INPUT] Target window not viewable or mapped\n";
+            break;
+        }
+        warpToFrame(dpy, window, ev.x, ev.y, scale);
+        XFlush(dpy);
+        XSync(dpy, False);
+        int button = ev.button ? ev.button : 1;
+        clickButton(dpy, button, 1);
+        if (ev.type == INPUT_DCLICK) {
+            XFlush(dpy);
+            usleep(150000);
+            clickButton(dpy, button, 1);
+        }
+        XFlush(dpy);
+        XSync(dpy, False);
+        std::cout << "[INPUT] Click " << (int)button << " at (" << ev.x << "," << ev.y << ")\n";
+        XLowerWindow(dpy, window);
+        XSync(dpy, False);
+        usleep(75000);
+        break;
+    }
+    case INPUT_KEY_DOWN:
+    case INPUT_KEY_UP: {
+        if (ev.keysym == XK_Escape) {
+            if (ev.type == INPUT_KEY_UP) break;
+            std::cout << "[INPUT] Escape pressed, stopping output.\n";
+            return false;
+        }
+        KeyCode keycode = XKeysymToKeycode(dpy, ev.keysym);
+        if (!keycode) {
+            std::cerr << "[INPUT] No keycode for keysym 0x" << std::hex << ev.keysym << std::dec << "\n";
+            break;
+        }
+        if (ev.type == INPUT_KEY_DOWN) {
+            // Focus window before sending key
             XRaiseWindow(dpy, window);
             XSetInputFocus(dpy, window, RevertToParent, CurrentTime);
             XFlush(dpy);
-            XSync(dpy, False);
-            XFlush(dpy);
-            usleep(75000);
-            setWindowOpacity(dpy, window, 0x00000000);
-            if (!wait_for_focus(dpy, window, 5000)) {
-            std::cerr << "[INPUT] Warning: window did not gain input focus after 5000ms\n";
-            }
-            std::cout << "Handling msg\n";
-            if (msg["type"] == "click") {
-                XWindowAttributes attr_check;
-                if (!XGetWindowAttributes(dpy, window, &attr_check) || attr_check.map_state != IsViewable) {
-                    std::cerr << "[INPUT] Target window not viewable or mapped\n";
-                    continue;
-                }
+        }
+        XTestFakeKeyEvent(dpy, keycode, ev.type == INPUT_KEY_DOWN, CurrentTime);
+        XSync(dpy, False);
+        if (ev.type == INPUT_KEY_DOWN) {
+            std::cout << "[INPUT] Key press: 0x" << std::hex << ev.keysym << std::dec << "\n";
+        } else {
+            setWindowOpacity(dpy, window, 0xFFFFFFFF);
+        }
+        break;
+    }
+    case INPUT_MOTION:
+        warpToFrame(dpy, window, ev.x, ev.y, scale);
+        XFlush(dpy);
+        break;
+    case INPUT_BUTTON_DOWN:
+    case INPUT_BUTTON_UP:
+        warpToFrame(dpy, window, ev.x, ev.y, scale);
+        XTestFakeButtonEvent(dpy, ev.button ? ev.button : 1, ev.type == INPUT_BUTTON_DOWN, CurrentTime);
+        XFlush(dpy);
+        break;
+    case INPUT_WHEEL:
+        // X reports wheel steps as buttons 4/5 (vertical) and 6/7 (horizontal)
+        warpToFrame(dpy, window, ev.x, ev.y, scale);
+        clickButton(dpy, ev.dy > 0 ? 4 : 5, std::abs(ev.dy));
+        clickButton(dpy, ev.dx > 0 ? 7 : 6, std::abs(ev.dx));
+        XFlush(dpy);
+        break;
+    default:
+        std::cerr << "[INPUT] Unknown event type " << (int)ev.type << "\n";
+        break;
+    }
+    return true;
+}
 
-                int x = msg["x"];
-                int y = msg["y"];
-                std::string btn = msg["button"];
-                std::cout << "x:" << attr.x <<"|y:"<<attr.y <<"\n";
-                // Translate local coords to screen coords
-                XWindowAttributes attr;
-                XGetWindowAttributes(dpy, window, &attr);
-                Window root = DefaultRootWindow(dpy);
-
-                int abs_x, abs_y;
-                Window dummy;
-                XTranslateCoordinates(dpy, window, root, 0, 0, &abs_x, &abs_y, &dummy);
-
-                int win_x = abs_x + x;
-                int win_y = abs_y + y;
-
-                // Move mouse
-                XWarpPointer(dpy, None, root, 0, 0, 0, 0, win_x, win_y);
-                XFlush(dpy);
-                XSync(dpy, False);
-                // usleep(75000);
-                // Simulate click
-                int button = (btn == "right") ? 3 : 1;
-                XTestFakeButtonEvent(dpy, button, True, CurrentTime);
-                XTestFakeButtonEvent(dpy, button, False, CurrentTime);
-                XFlush(dpy);
-                XSync(dpy, False);
-                std::cout << "[INPUT] Click " << btn << " at (" << x << "," << y << ")\n";
-                XLowerWindow(dpy, window);
-                XSync(dpy, False);
-                XFlush(dpy);
-                usleep(75000);
-                // setWindowOpacity(dpy, window, 0xFFFFFFFF);
-                XFlush(dpy);
-            }
-            else if (msg["type"] == "dclick") {
-                setWindowOpacity(dpy, window, 0x00000000);
-                int x = msg["x"];
-                int y = msg["y"];
-                std::string btn = msg["button"];
-
-                // Translate local coords to screen coords
-                XWindowAttributes attr;
-                XGetWindowAttributes(dpy, window, &attr);
-                Window root = DefaultRootWindow(dpy);
-
-                int abs_x, abs_y;
-                Window dummy;
-                XTranslateCoordinates(dpy, window, root, 0, 0, &abs_x, &abs_y, &dummy);
-
-                int win_x = abs_x + x;
-                int win_y = abs_y + y;
-
-                // Move mouse
-                XWarpPointer(dpy, None, root, 0, 0, 0, 0, win_x, win_y);
-                XFlush(dpy);
-
-                // Simulate click
-                int button = (btn == "right") ? 3 : 1;
-                XTestFakeButtonEvent(dpy, button, True, CurrentTime);
-                XTestFakeButtonEvent(dpy, button, False, CurrentTime);
-                XFlush(dpy);
-                usleep(150000);
-                XTestFakeButtonEvent(dpy, button, True, CurrentTime);
-                XTestFakeButtonEvent(dpy, button, False, CurrentTime);
-                XFlush(dpy);
-                std::cout << "[INPUT] Click " << btn << " at (" << x << "," << y << ")\n";
-                XLowerWindow(dpy, window);
-                XSync(dpy, False);
-                XFlush(dpy);
-                usleep(75000);
-                // setWindowOpacity(dpy, window, 0xFFFFFFFF);
-                XFlush(dpy);
-            }
-            else if (msg["type"] == "key") {
-                    std::string key_str = msg["key"];
-                    
-                    // You need to map the key string to a keycode
-                    if (key_str.size() == 1 && key_str[0] == 27)
-                    {
-                        std::cout << "[INPUT] Escape pressed, stopping output.\n";
-                        is_running = false;
-                        if (inputBlocker) {
-                            std::cout <<"Killed blocker\n";
-                            XDestroyWindow(dpy, inputBlocker);
-                            inputBlocker = 0;
-                            XFlush(dpy);
-                            
-                        }
-                    setWindowOpacity(dpy, window, 0xFFFFFFFF);
-                        return;
-                    }
-                    KeySym keysym = XStringToKeysym(key_str.c_str());
-                    
-                    if (keysym == NoSymbol) {
-                        std::cerr << "[INPUT] Unknown key: " << key_str << "\n";
-                        if (inputBlocker) {
-                            std::cout <<"Killed blocker\n";
-                            XDestroyWindow(dpy, inputBlocker);
-                            inputBlocker = 0;
-                            XFlush(dpy);
-                        }
-                        setWindowOpacity(dpy, window, 0xFFFFFFFF);
-                        return;
-                    }
-                    if (keysym == XK_Escape)
-                    {
-                        std::cout << "[INPUT] Escape pressed, stopping output.\n";
-                    }
-                    KeyCode keycode = XKeysymToKeycode(dpy, keysym);
-
-                    // Focus window before sending key
-                    XRaiseWindow(dpy, window);
-                    XSetInputFocus(dpy, window, RevertToParent, CurrentTime);
-                    XFlush(dpy);
-                    // usleep(100000);
-
-                    // Send key press and release
-                    XTestFakeKeyEvent(dpy, keycode, True, CurrentTime);  // key down
-                    XTestFakeKeyEvent(dpy, keycode, False, CurrentTime); // key up
-                    XFlush(dpy);
-
-                    std::cout << "[INPUT] Key press: " << key_str << "\n";
-
-                    // XLowerWindow(dpy, window);
-                    XSync(dpy, False);
-                    XFlush(dpy);
-                    // usleep(75000);
-                    setWindowOpacity(dpy, window, 0xFFFFFFFF);
-                    XFlush(dpy);
+// Clock for frame timestamps and latencies: steady, in microseconds
+uint64_t frame_clock_us() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Where a frame came from, carried through the pipeline into its header
+struct FrameTiming {
+    uint32_t seq = 0;
+    uint64_t capture_us = 0;        // frame_clock_us() when the grab started
+    uint64_t input_us = 0;          // arrival of the input this is the first frame after, 0: none
+};
+
+// Start a video message: reserves the length prefix and writes the header
+void begin_message(std::vector<uint8_t>& msg, FrameType type, const FrameTiming& timing) {
+    msg.clear();
+    put_u32(msg, 0);
+    put_u8(msg, type);
+    put_u32(msg, timing.seq);
+    put_u64(msg, timing.capture_us);
+}
+
+// Fill in the length prefix of a finished message
+void end_message(std::vector<uint8_t>& msg) {
+    set_u32(msg.data(), msg.size() - 4);
+}
+
+// Frames as they move through a session's pipeline:
+//   capture -> convert -> encode -> send
+// Capture, convert and encode run as steps on the server's worker pool, one
+// frame per step and at most one step per stage and session at a time. They
+// hand frames on through bounded FrameQueues, so a slow encoder or network
+// only backs up its own queue. The event loop does the sending.
+
+// Everything a frame needs on its way through the pipeline. The capture
+// step takes one from the session's pool and the frame carries it along
+// until its message is sent or dropped, so in steady state no step
+// allocates (frame_pool.h). The images are window-sized and only change
+// with the window; converted tiles are views into them.
+struct FrameBuffers {
+    std::vector<CaptureRegion> regions;     // into the frame's capture slot
+    std::vector<cv::Rect> rects;
+    cv::Mat bgr;                            // for JPEG
+    Yuv420Image yuv;                        // for H.264, padded to even
+    std::vector<cv::Mat> images;            // views into bgr, one per rect
+    std::vector<Yuv420Image> planes;        // views into yuv, one per rect
+    std::vector<uint8_t> msg;               // the encoded message
+};
+
+// Raw pixels grabbed into one of the session's capture slots, described by
+// `buffers->regions`. `keyframe` means the whole window was grabbed;
+// `resync` additionally means the client has lost track (first frame,
+// resize, dropped frame) and an inter-frame encoder has to restart from an
+// IDR.
+struct CapturedFrame {
+    int slot = -1;
+    FrameTiming timing;
+    bool keyframe = false;
+    bool resync = false;
+    int width = 0;                  // of the window
+    int height = 0;
+    std::shared_ptr<FrameBuffers> buffers;
+};
+
+// Images ready for the encoder, one per rectangle in `buffers->rects`: BGR
+// for JPEG, I420 for H.264
+struct ConvertedFrame {
+    FrameTiming timing;
+    bool keyframe = false;
+    bool resync = false;
+    int width = 0;                  // of the window
+    int height = 0;
+    std::shared_ptr<FrameBuffers> buffers;
+};
+
+// A complete video message in `buffers->msg`, length prefix included
+struct EncodedFrame {
+    FrameTiming timing;
+    bool keyframe = false;
+    std::shared_ptr<FrameBuffers> buffers;
+};
+
+// One independently decodable JPEG tile of a message. `rect` is in output
+// coordinates; `image` is resized to it if the sizes differ.
+struct JpegTile {
+    cv::Rect rect;
+    cv::Mat image;
+    cv::Mat scaled;
+    AreaScaler scaler;
+    std::vector<uchar> jpeg;
+};
+
+// What the capture step carries from one frame to the next
+struct CaptureState {
+    WindowCapture window;
+    DamageTracker damage;
+    std::vector<XRectangle> damaged;
+    std::vector<cv::Rect> tiles;
+    int frames_since_key = KEYFRAME_INTERVAL;
+    uint32_t next_seq = 0;
+    int last_width = 0;
+    int last_height = 0;
+};
+
+// What the encode step carries from one frame to the next
+struct EncodeState {
+    double scale = 1.0;
+    std::vector<int> jpeg_params = {cv::IMWRITE_JPEG_QUALITY, JPEG_QUALITY};
+    std::vector<uchar> jpeg;
+    std::vector<JpegTile> tiles;
+    cv::Mat scaled;
+    AreaScaler scaler;
+#ifdef WITH_AVCODEC
+    // H.264 needs whole pictures, so the window contents are kept here and
+    // the converted tiles painted onto them before every encode
+    H264Encoder h264;
+    Yuv420Image canvas;     // window contents at full size, padded to even
+    Yuv420Image picture;    // scaled encoder input
+    AreaScaler plane_scalers[3];
+#endif
+};
+
+enum SessionStage {
+    STAGE_CAPTURE,
+    STAGE_CONVERT,
+    STAGE_ENCODE,
+    STAGE_INPUT,
+    STAGE_COUNT,
+};
+
+// The session's counters as of the last stats dump
+struct StatsTotals {
+    uint64_t frames = 0;
+    uint64_t keyframes = 0;
+    uint64_t encoded = 0;
+    uint64_t encoded_bytes = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t input_events = 0;
+    uint64_t drops = 0;
+    uint64_t allocs = 0;
+};
+
+struct Server;
+struct Session;
+
+// A step of one of a session's stages, as queued on the stage pool. The
+// session keeps one per stage so the queued task is a single pointer, which
+// std::function stores without allocating.
+struct StageTask {
+    Server* server = nullptr;
+    Session* session = nullptr;
+    SessionStage stage = STAGE_CAPTURE;
+};
+
+// One streamed window with its pipeline, its viewers (or UDP peer) and its
+// input client. Capture, encode and input state belong to that stage's step;
+// the event loop may only look at them while holding `mutex` with the stage
+// not busy. Sockets belong to the event loop.
+struct Session {
+    int id;
+    Display* dpy;
+    Window window;
+    // Set by whatever ends the session; the event loop frees it once no
+    // step is queued or running
+    std::atomic<bool> closing{false};
+    // Set whenever a frame is dropped; the next capture is then a keyframe
+    // so the client never composites deltas onto a frame it did not get.
+    std::atomic<bool> force_keyframe{true};
+    // Paces capture; input boosts it
+    FrameScheduler scheduler;
+    // Output size / window size of the frames the client is showing. Client
+    // coordinates are divided by it to get back to window coordinates.
+    std::atomic<double> stream_scale{1.0};
+    // The input client's viewport, width << 16 | height; 0 for none. The
+    // output is scaled down to fit it.
+    std::atomic<uint32_t> viewport{0};
+    QualityController quality;
+
+    std::vector<ShmCapture> slots;
+    FrameQueue<int> free_slots;
+    FramePool<FrameBuffers> frame_buffers;
+    FrameQueue<CapturedFrame> convert_queue;
+    FrameQueue<ConvertedFrame> encode_queue;
+    FrameQueue<EncodedFrame> send_queue;
+    CaptureState capture;
+    EncodeState encode;
+
+    std::mutex mutex;               // guards busy and next_capture
+    bool busy[STAGE_COUNT] = {};    // a step of the stage is queued or running
+    StageTask tasks[STAGE_COUNT];
+    std::chrono::steady_clock::time_point next_capture{};
+
+    // Output
+    Broadcast viewers;              // TCP viewers, only ever one without --broadcast
+    std::unique_ptr<UdpTransport> udp;
+    bool streaming = false;         // has had a viewer or UDP peer
+    in_addr client_addr{};          // of the first viewer, to pair input with
+    uint64_t key_requests = 0;
+
+    // Timings and counters; the event loop prints them every stats interval
+    PipelineStats stats;
+    StatsTotals printed;
+    std::chrono::steady_clock::time_point last_stats{};
+
+    // Input: the socket is read and decoded by the event loop, the events
+    // are injected by the input step
+    int input_fd = -1;
+    uint32_t input_watch = 0;       // epoll events asked for on input_fd
+    std::vector<uint8_t> input_buffer;
+    bool input_paused = false;      // queue full, socket not being read
+    std::atomic<bool> input_connected{false};
+    InputQueue input_queue{INPUT_QUEUE_CAPACITY};
+    bool fast_input = config.input_mode == InputMode::Fast;
+    bool input_opened = false;      // `input` is set up on the target
+    InputSession input;
+    std::vector<InputEvent> input_batch;
+    // Input latency: the loop notes when input arrives, the input step when
+    // it has been injected, and the next captured frame takes it from there
+    std::atomic<uint64_t> input_arrived_us{0};
+    std::atomic<uint64_t> input_injected_us{0};
+    std::deque<std::pair<uint32_t, uint64_t>> input_frames;  // sent seq, its input_us; awaiting acks
+
+    // Cursor channel, for an input client that speaks INPUT_CURSOR_VERSION.
+    // Messages wait in cursor_out until the socket takes them.
+    bool cursor_client = false;
+    std::vector<uint8_t> cursor_out;
+    std::deque<uint32_t> cursor_shapes;     // serials the client holds, newest last
+    uint64_t cursor_changes = 0;            // tracker changes already looked at
+    double cursor_scale = 0;                // stream_scale the last position was sent at
+    InputCursor cursor_sent;
+
+    Session(int id, Display* dpy, Window window)
+        : id(id), dpy(dpy), window(window),
+          slots(config.queue_depth + 2),
+          free_slots(config.queue_depth + 2, QueuePolicy::Block),
+          convert_queue(config.queue_depth, config.drop_policy),
+          encode_queue(config.queue_depth, config.drop_policy),
+          send_queue(config.queue_depth, config.drop_policy),
+          viewers(config.broadcast ? config.viewer_queue : 1) {
+        scheduler.target_fps = config.target_fps;
+        scheduler.min_fps = std::min(config.min_fps, config.target_fps);
+        scheduler.max_fps = std::max(config.max_fps, config.target_fps);
+        quality.target_latency_ms = config.target_latency_ms;
+        quality.allow_scale = config.adaptive_scale;
+        quality.min_scale = config.min_scale;
+        quality.quality = JPEG_QUALITY;
+
+        for (size_t i = 0; i < slots.size(); i++) {
+            shm_capture_init(slots[i], dpy);
+            free_slots.push((int)i);
+        }
+        if (!window_capture_open(capture.window, dpy, window)) closing = true;
+        damage_tracker_init(capture.damage, dpy, window);
+
+        stats.id = id;
+        if (trace.file) {
+            stats.trace = &trace;
+            std::string name = "session " + std::to_string(id);
+            trace_name_process(trace, id, name.c_str());
+        }
+        last_stats = std::chrono::steady_clock::now();
+    }
+};
+
+// Grab what changed into a free slot and queue it for conversion, then set
+// the next capture deadline. Returns false if the window can't be captured.
+bool capture_step(Session& s) {
+    CaptureState& cs = s.capture;
+    WindowCapture& win = cs.window;
+
+    // The event loop only runs this step with a slot free
+    int slot_index;
+    if (!s.free_slots.try_pop(slot_index)) return true;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t capture_us = frame_clock_us();
+
+    if (!window_capture_update(win)) {
+        std::cerr << "[CAPTURE] Window " << s.window << " was destroyed\n";
+        s.free_slots.push(slot_index);
+        return false;
+    }
+    // A new pixmap starts from scratch, like a new size
+    bool renamed = win.renamed;
+    win.renamed = false;
+
+    cs.damaged.clear();
+    cs.tiles.clear();
+    damage_tracker_collect(cs.damage, cs.damaged);
+
+    // Unmapped: keep the session, send nothing until the window is back
+    bool ready = window_capture_ready(win);
+    if (ready) build_dirty_tiles(cs.damaged, win.width, win.height, TILE_SIZE, cs.tiles);
+
+    long dirty_area = 0;
+    for (const cv::Rect& t : cs.tiles) dirty_area += t.area();
+
+    bool resync = s.force_keyframe.exchange(false) || renamed ||
+                  win.width != cs.last_width || win.height != cs.last_height;
+    bool keyframe = resync ||
+                    !cs.damage.available ||
+                    cs.frames_since_key >= KEYFRAME_INTERVAL ||
+                    dirty_area > (long)(win.width * win.height * DELTA_MAX_COVERAGE);
+    if (!ready) {
+        // Pick the forced keyframe up again once there is something to grab
+        if (resync && !renamed) s.force_keyframe = true;
+        keyframe = false;
+    }
+
+    bool changed = keyframe || !cs.tiles.empty();
+    if (changed) {
+        CapturedFrame captured;
+        captured.slot = slot_index;
+        captured.timing.seq = cs.next_seq++;
+        captured.timing.capture_us = capture_us;
+        // The first frame grabbed after input went in answers it
+        uint64_t injected = s.input_injected_us.exchange(0);
+        if (injected) {
+            captured.timing.input_us = injected;
+            histogram_record(s.stats.input_to_frame, capture_us > injected ? capture_us - injected : 0);
+        }
+        captured.keyframe = keyframe;
+        captured.resync = resync;
+        captured.width = win.width;
+        captured.height = win.height;
+        captured.buffers = s.frame_buffers.acquire();
+        std::vector<CaptureRegion>& regions = captured.buffers->regions;
+        regions.clear();
+        ShmCapture& slot = s.slots[slot_index];
+
+        bool ok = true;
+        if (keyframe) {
+            XImage* image = shm_capture_grab(slot, win.pixmap, win.visual, win.depth, win.width, win.height);
+            ok = image != nullptr;
+            if (ok) regions.push_back(full_region(image));
+            cs.last_width = win.width;
+            cs.last_height = win.height;
+            cs.frames_since_key = 0;
+        } else {
+            size_t offset = 0;
+            for (const cv::Rect& t : cs.tiles) {
+                CaptureRegion region;
+                if (!shm_capture_grab_region(slot, win.pixmap, win.visual, win.depth, win.width, win.height,
+                                             t.x, t.y, t.width, t.height, offset, region)) {
+                    ok = false;
+                    break;
                 }
-            if (inputBlocker) {
-                std::cout <<"Killed blocker\n";
-    XDestroyWindow(dpy, inputBlocker);
-    inputBlocker = 0;
-    XFlush(dpy);
+                regions.push_back(region);
+            }
+            cs.frames_since_key++;
+        }
+
+        if (!ok) {
+            std::cerr << "Failed to get XImage\n";
+            s.free_slots.push(slot_index);
+            return false;
+        }
+
+        CapturedFrame dropped;
+        bool did_drop = false;
+        s.convert_queue.push(std::move(captured), &dropped, &did_drop);
+        if (did_drop) {
+            s.free_slots.push(dropped.slot);
+            s.force_keyframe = true;
+        }
+        // Only frames that grabbed something; idle polls would drown them
+        stats_record(s.stats, STAT_CAPTURE, start, std::chrono::steady_clock::now());
+        s.stats.frames++;
+        if (keyframe) s.stats.keyframes++;
+    } else {
+        // Nothing changed, nothing to send
+        s.free_slots.push(slot_index);
+        cs.frames_since_key++;
+    }
+
+    auto deadline = s.scheduler.next_deadline(changed);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.next_capture = deadline;
+    return true;
 }
-            ;
-            
-        } catch (...) {
-            std::cerr << "[INPUT] JSON parse error\n";
+
+// Convert one captured frame for the encoder and give its slot back
+void convert_step(Session& s) {
+    CapturedFrame captured;
+    if (!s.convert_queue.try_pop(captured)) return;
+    StageTimer timer(s.stats, STAT_CONVERT);
+
+    // Convert into the frame's window-sized image, which only reallocates
+    // when the window size changes
+    FrameBuffers& fb = *captured.buffers;
+    size_t count = fb.regions.size();
+    bool planar = config.encoder == EncoderType::H264;
+    fb.rects.resize(count);
+    if (planar) {
+        yuv420Create(fb.yuv, (captured.width + 1) & ~1, (captured.height + 1) & ~1);
+        fb.planes.resize(count);
+    } else {
+        fb.bgr.create(captured.height, captured.width, CV_8UC3);
+        fb.images.resize(count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const CaptureRegion& region = fb.regions[i];
+        fb.rects[i] = cv::Rect(region.x, region.y, region.width, region.height);
+        if (planar) {
+            fb.planes[i] = yuv420View(fb.yuv, fb.rects[i]);
+            regionToYuv(region, fb.planes[i]);
+        } else {
+            fb.images[i] = fb.bgr(fb.rects[i]);
+            regionToMat(region, fb.images[i]);
         }
     }
+    s.free_slots.push(captured.slot);
+
+    ConvertedFrame converted;
+    converted.timing = captured.timing;
+    converted.keyframe = captured.keyframe;
+    converted.resync = captured.resync;
+    converted.width = captured.width;
+    converted.height = captured.height;
+    converted.buffers = std::move(captured.buffers);
+
+    bool did_drop = false;
+    s.encode_queue.push(std::move(converted), nullptr, &did_drop);
+    if (did_drop) s.force_keyframe = true;
+}
 
-    close(client_fd);
-    close(sock_fd);
+// Map a window rectangle to output coordinates at `scale`. Edges are rounded
+// outwards so scaled tiles always cover their area completely.
+cv::Rect scale_rect(const cv::Rect& r, double scale) {
+    if (scale == 1.0) return r;
+    int x0 = (int)std::floor(r.x * scale);
+    int y0 = (int)std::floor(r.y * scale);
+    int x1 = (int)std::ceil((r.x + r.width) * scale);
+    int y1 = (int)std::ceil((r.y + r.height) * scale);
+    return cv::Rect(x0, y0, x1 - x0, y1 - y0);
 }
-void stream_window(Display* dpy, Window target_win, int client_socket) {
-    while (is_running) {
-        Pixmap pixmap = XCompositeNameWindowPixmap(dpy, target_win);
-        XWindowAttributes attr{};
-        XGetWindowAttributes(dpy, target_win, &attr);
-        // XLowerWindow(dpy, target_win);
-        XSync(dpy, False);
-        XFlush(dpy);
-        // usleep(75000);
-        setWindowOpacity(dpy, target_win, 0xFFFFFFFF);
-        XFlush(dpy);
-        XImage* image = XGetImage(dpy, pixmap, 0, 0, attr.width, attr.height, AllPlanes, ZPixmap);
-        if (!image) {
-            std::cerr << "Failed to get XImage\n";
-            break;
+
+// Area-scale `src` into `dst` (pixel_scale.h), reusing dst's memory. Falls
+// back to OpenCV for layouts the scaler does not handle.
+void scaleArea(const cv::Mat& src, cv::Mat& dst, cv::Size size, AreaScaler& scaler) {
+    dst.create(size, src.type());
+    if (src.depth() != CV_8U ||
+        !scale_area(scaler, src.data, (int)src.step, src.cols, src.rows,
+                    dst.data, (int)dst.step, dst.cols, dst.rows, src.channels())) {
+        cv::resize(src, dst, size, 0, 0, cv::INTER_AREA);
+    }
+}
+
+// Output scale that fits a width x height window into the client's
+// viewport; 1 if it already fits or the client never said
+double viewport_scale(const Session& s, int width, int height) {
+    uint32_t viewport = s.viewport;
+    int view_w = viewport >> 16, view_h = viewport & 0xffff;
+    if (!config.fit_viewport || !view_w || !view_h || width <= 0 || height <= 0) return 1.0;
+    double fit = std::min((double)view_w / width, (double)view_h / height);
+    return std::min(1.0, std::max(VIEWPORT_MIN_SCALE, fit));
+}
+
+// The output scale may only change on a keyframe, since deltas are drawn
+// onto the client's previous frame. The scale is the viewport fit, lowered
+// further by the quality controller when it runs out of room. Adopt a new
+// scale on keyframes and ask for one as soon as it differs.
+double pick_scale(Session& s, const ConvertedFrame& converted, double current) {
+    double wanted = viewport_scale(s, converted.width, converted.height) * s.quality.scale;
+    if (wanted == current) return current;
+    if (converted.keyframe) {
+        s.stream_scale = wanted;
+        return wanted;
+    }
+    s.force_keyframe = true;
+    return current;
+}
+
+// Queue a finished message for the event loop to send
+void queue_encoded(Session& s, EncodedFrame& encoded) {
+    end_message(encoded.buffers->msg);
+    s.stats.encoded++;
+    s.stats.encoded_bytes += encoded.buffers->msg.size();
+    bool did_drop = false;
+    s.send_queue.push(std::move(encoded), nullptr, &did_drop);
+    if (did_drop) s.force_keyframe = true;
+}
+
+#ifdef WITH_AVCODEC
+// Paint the converted tiles onto the canvas and encode it. Everything stays
+// in I420; at full scale the canvas itself is the encoder input. Returns
+// false if the encoder fails.
+bool encode_step_h264(Session& s, ConvertedFrame& converted) {
+    EncodeState& es = s.encode;
+    H264Encoder& encoder = es.h264;
+    Yuv420Image& canvas = es.canvas;
+    Yuv420Image& picture = es.picture;
+    const int fps = (int)config.target_fps;
+
+    auto start = std::chrono::steady_clock::now();
+    bool force_idr = converted.resync;
+    es.scale = pick_scale(s, converted, es.scale);
+    double scale = es.scale;
+
+    FrameBuffers& fb = *converted.buffers;
+    if (converted.keyframe) {
+        // The keyframe's picture becomes the canvas, and the old canvas goes
+        // back to the pool in its place, so neither is copied or allocated
+        std::swap(canvas, fb.yuv);
+    } else {
+        if (canvas.y.empty()) return true;
+        // Tiles start on TILE_SIZE boundaries, so they line up with the
+        // chroma grid; their padding lands in the canvas padding.
+        for (size_t i = 0; i < fb.rects.size(); i++) {
+            const cv::Rect& rect = fb.rects[i];
+            const Yuv420Image& tile = fb.planes[i];
+            cv::Rect chroma(rect.x / 2, rect.y / 2, tile.u.cols, tile.u.rows);
+            cv::Mat y = canvas.y(cv::Rect(rect.x, rect.y, tile.y.cols, tile.y.rows));
+            cv::Mat u = canvas.u(chroma), v = canvas.v(chroma);
+            tile.y.copyTo(y);
+            tile.u.copyTo(u);
+            tile.v.copyTo(v);
+        }
+    }
+
+    cv::Rect out = scale_rect(cv::Rect(0, 0, canvas.y.cols, canvas.y.rows), scale);
+    if (((out.width + 1) & ~1) != encoder.width || ((out.height + 1) & ~1) != encoder.height) {
+        if (!h264_encoder_open(encoder, out.width, out.height, config.gop, fps)) return false;
+        // Odd scaled sizes are padded to even with black
+        yuv420Create(picture, encoder.width, encoder.height);
+        picture.y.setTo(cv::Scalar(16));
+        picture.u.setTo(cv::Scalar(128));
+        picture.v.setTo(cv::Scalar(128));
+        force_idr = true;
+    }
+    const Yuv420Image* input = &canvas;
+    if (scale != 1.0) {
+        cv::Rect chroma(0, 0, (out.width + 1) / 2, (out.height + 1) / 2);
+        cv::Mat y = picture.y(out), u = picture.u(chroma), v = picture.v(chroma);
+        scaleArea(canvas.y, y, y.size(), es.plane_scalers[0]);
+        scaleArea(canvas.u, u, u.size(), es.plane_scalers[1]);
+        scaleArea(canvas.v, v, v.size(), es.plane_scalers[2]);
+        input = &picture;
+    }
+
+    h264_set_quality(encoder, s.quality.quality);
+
+    uint8_t* planes[3] = {input->y.data, input->u.data, input->v.data};
+    int strides[3] = {(int)input->y.step, (int)input->u.step, (int)input->v.step};
+    EncodedFrame encoded;
+    encoded.timing = converted.timing;
+    encoded.buffers = std::move(converted.buffers);
+    std::vector<uint8_t>& msg = encoded.buffers->msg;
+    begin_message(msg, FRAME_H264, encoded.timing);
+    if (!h264_encode(encoder, planes, strides, force_idr, msg, encoded.keyframe)) return false;
+    auto end = std::chrono::steady_clock::now();
+    s.quality.encode_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    stats_record(s.stats, STAT_ENCODE, start, end);
+    if (msg.size() <= 4 + FRAME_HEADER_SIZE) return true;  // encoder produced nothing for this frame
+
+    queue_encoded(s, encoded);
+    return true;
+}
+#endif
+
+// Encode the tiles concurrently, then append tile_count and the tiles in order
+void encodeJpegTiles(ThreadPool& pool, std::vector<JpegTile>& tiles, const std::vector<int>& params,
+                     std::vector<uint8_t>& msg) {
+    pool.parallel_for((int)tiles.size(), [&](int i) {
+        JpegTile& tile = tiles[i];
+        const cv::Mat* image = &tile.image;
+        if (image->size() != tile.rect.size()) {
+            scaleArea(*image, tile.scaled, tile.rect.size(), tile.scaler);
+            image = &tile.scaled;
+        }
+        cv::imencode(".jpg", *image, tile.jpeg, params);
+    });
+
+    put_u16(msg, (uint16_t)tiles.size());
+    for (const JpegTile& tile : tiles) {
+        put_u16(msg, tile.rect.x);
+        put_u16(msg, tile.rect.y);
+        put_u16(msg, tile.rect.width);
+        put_u16(msg, tile.rect.height);
+        put_u32(msg, tile.jpeg.size());
+        msg.insert(msg.end(), tile.jpeg.begin(), tile.jpeg.end());
+    }
+}
+
+// Cut a keyframe into one horizontal stripe per encoder thread. Stripes are
+// views into `image`, not copies; the tiles keep their JPEG buffers.
+void splitStripes(const cv::Mat& image, int count, std::vector<JpegTile>& tiles) {
+    int height = (image.rows + count - 1) / count;
+    height = (height + STRIPE_ALIGN - 1) / STRIPE_ALIGN * STRIPE_ALIGN;
+    tiles.resize((image.rows + height - 1) / height);
+    for (size_t i = 0; i < tiles.size(); i++) {
+        int y = (int)i * height;
+        tiles[i].rect = cv::Rect(0, y, image.cols, std::min(height, image.rows - y));
+        tiles[i].image = image(tiles[i].rect);
+    }
+}
+
+// Encode one converted frame into a message for the send queue. `pool` is
+// shared by every session's encode step. Returns false if the encoder fails.
+bool encode_step(Session& s, ThreadPool& pool) {
+    ConvertedFrame converted;
+    if (!s.encode_queue.try_pop(converted)) return true;
+#ifdef WITH_AVCODEC
+    if (config.encoder == EncoderType::H264) return encode_step_h264(s, converted);
+#endif
+    EncodeState& es = s.encode;
+    auto start = std::chrono::steady_clock::now();
+    es.scale = pick_scale(s, converted, es.scale);
+    double scale = es.scale;
+    std::vector<int>& jpeg_params = es.jpeg_params;
+    jpeg_params[1] = s.quality.quality;
+
+    EncodedFrame encoded;
+    encoded.timing = converted.timing;
+    encoded.keyframe = converted.keyframe;
+    encoded.buffers = std::move(converted.buffers);
+    FrameBuffers& fb = *encoded.buffers;
+    std::vector<uint8_t>& msg = fb.msg;
+    std::vector<JpegTile>& tiles = es.tiles;
+
+    if (converted.keyframe) {
+        const cv::Mat* image = &fb.images[0];
+        if (scale != 1.0) {
+            cv::Rect out = scale_rect(cv::Rect(0, 0, image->cols, image->rows), scale);
+            scaleArea(*image, es.scaled, out.size(), es.scaler);
+            image = &es.scaled;
+        }
+        if (pool.size() > 1 && image->total() >= STRIPE_MIN_PIXELS) {
+            // Large frame: encode stripes in parallel, the client stitches them
+            splitStripes(*image, pool.size(), tiles);
+            begin_message(msg, FRAME_KEY_TILES, encoded.timing);
+            put_u16(msg, image->cols);
+            put_u16(msg, image->rows);
+            encodeJpegTiles(pool, tiles, jpeg_params, msg);
+        } else {
+            cv::imencode(".jpg", *image, es.jpeg, jpeg_params);
+            begin_message(msg, FRAME_KEY, encoded.timing);
+            msg.insert(msg.end(), es.jpeg.begin(), es.jpeg.end());
+        }
+    } else {
+        tiles.resize(fb.rects.size());
+        for (size_t i = 0; i < fb.rects.size(); i++) {
+            tiles[i].rect = scale_rect(fb.rects[i], scale);
+            tiles[i].image = fb.images[i];
         }
+        begin_message(msg, FRAME_DELTA, encoded.timing);
+        encodeJpegTiles(pool, tiles, jpeg_params, msg);
+    }
+    auto end = std::chrono::steady_clock::now();
+    s.quality.encode_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    stats_record(s.stats, STAT_ENCODE, start, end);
 
-        cv::Mat frame = ximageToMat(image);
+    queue_encoded(s, encoded);
+    return true;
+}
 
-        std::vector<uchar> buf;
-        cv::imencode(".jpg", frame, buf, {cv::IMWRITE_JPEG_QUALITY, 80});
+// The original injection path: put a blocker over the window, focus it and
+// poll for the focus, with sleeps around every batch. Uses the shared
+// display connection and keeps its worker busy throughout.
+bool inject_legacy(Session& s, const std::vector<InputEvent>& events) {
+    Display* dpy = s.dpy;
+    Window window = s.window;
 
-        uint32_t frame_size = htonl(buf.size());
-        if (send(client_socket, &frame_size, sizeof(frame_size), 0) < 0) {
-            perror("send frame size");
+    XWindowAttributes attr;
+    XGetWindowAttributes(dpy, window, &attr);
+    Window root = DefaultRootWindow(dpy);
+    XSetWindowAttributes wa;
+    wa.override_redirect = True;  // Prevent window manager interference
+
+    Window inputBlocker = XCreateWindow(
+        dpy,
+        root,
+        attr.x, attr.y,
+        attr.width, attr.height,
+        0,                // border width
+        0,                // depth: 0 = default for InputOnly
+        InputOnly,        // class
+        CopyFromParent,   // visual
+        CWOverrideRedirect,
+        &wa
+    );
+
+    XMapRaised(dpy, inputBlocker);
+    XFlush(dpy);
+    usleep(75000);
+    std::cout << "Made blocker\n";
+    setWindowOpacity(dpy, window, 0x00000000);
+    XRaiseWindow(dpy, window);
+    XSetInputFocus(dpy, window, RevertToParent, CurrentTime);
+    XSync(dpy, False);
+    usleep(75000);
+    setWindowOpacity(dpy, window, 0x00000000);
+    if (!wait_for_focus(dpy, window, 5000)) {
+        std::cerr << "[INPUT] Warning: window did not gain input focus after 5000ms\n";
+    }
+
+    bool keep_going = true;
+    for (const InputEvent& ev : events) {
+        if (!injectEvent(dpy, window, ev, s.stream_scale)) {
+            keep_going = false;
             break;
         }
+    }
+
+    std::cout << "Killed blocker\n";
+    XDestroyWindow(dpy, inputBlocker);
+    XFlush(dpy);
+    if (!keep_going) setWindowOpacity(dpy, window, 0xFFFFFFFF);
+    return keep_going;
+}
 
-        if (send(client_socket, buf.data(), buf.size(), 0) < 0) {
-            perror("send frame data");
+// Inject the batch through the session's own connection (input_session.h)
+bool inject_fast(Session& s, const std::vector<InputEvent>& events) {
+    input_session_pump(s.input);
+    if (!s.input.alive) {
+        std::cerr << "[INPUT] Target window is gone\n";
+        return false;
+    }
+    // Presses and keys need the focus; motion, wheel and releases follow
+    // the pointer
+    bool needs_focus = std::any_of(events.begin(), events.end(), [](const InputEvent& ev) {
+        return ev.type != INPUT_MOTION && ev.type != INPUT_WHEEL && ev.type != INPUT_BUTTON_UP;
+    });
+    if (needs_focus && !input_session_focus(s.input, FOCUS_TIMEOUT_MS)) {
+        std::cerr << "[INPUT] Warning: no FocusIn within " << FOCUS_TIMEOUT_MS << "ms, injecting anyway\n";
+    }
+    bool keep_going = true;
+    for (const InputEvent& ev : events) {
+        if (!input_session_inject(s.input, ev, s.stream_scale)) {
+            keep_going = false;
             break;
         }
+    }
+    XFlush(s.input.dpy);
+    return keep_going;
+}
 
-        XDestroyImage(image);
-        XFreePixmap(dpy, pixmap);
+// Inject what the client sent since the last step, setting the input
+// session up when a client connects and down when it leaves. Returns false
+// when the client asked to stop streaming (Escape) or the window is gone.
+bool input_step(Session& s) {
+    std::vector<InputEvent>& events = s.input_batch;
+    uint64_t arrived = s.input_arrived_us.exchange(0);
+    s.input_queue.try_pop_all(events);
+    bool connected = s.input_connected;
+
+    if (s.fast_input && !s.input_opened && (connected || !events.empty())) {
+        s.input_opened = input_session_open(s.input, DisplayString(s.dpy), s.window);
+        if (!s.input_opened) {
+            std::cerr << "[INPUT] Falling back to legacy input mode\n";
+            s.fast_input = false;
+        }
+    }
+
+    bool keep_going = true;
+    if (!events.empty()) {
+        StageTimer timer(s.stats, STAT_INPUT);
+        s.stats.input_events += events.size();
+        keep_going = s.fast_input ? inject_fast(s, events) : inject_legacy(s, events);
+    }
+    // Keep the oldest input no frame has answered yet
+    uint64_t none = 0;
+    if (arrived) s.input_injected_us.compare_exchange_strong(none, arrived);
 
-        usleep(33 * 1000);
+    if (s.input_opened && !connected) {
+        input_session_close(s.input);
+        s.input_opened = false;
     }
+    return keep_going;
 }
-bool is_window_offscreen(Display* dpy, Window win) {
-    XWindowAttributes attr;
-    XGetWindowAttributes(dpy, win, &attr);
 
-    int x, y;
-    Window child;
-    XTranslateCoordinates(dpy, win, DefaultRootWindow(dpy), 0, 0, &x, &y, &child);
+// Kinds of descriptor the event loop waits on, kept in the upper half of
+// epoll_event.data.u64 with the fd in the lower half
+enum FdKind : uint32_t {
+    FD_VIDEO_LISTEN,
+    FD_INPUT_LISTEN,
+    FD_UDP,
+    FD_WAKE,
+    FD_EDGE,            // the edge watcher's display connection
+    FD_CURSOR,          // the cursor tracker's display connection
+    FD_WINDOWS,         // the window index's display connection
+    FD_LOBBY_VIDEO,     // video client waiting for a window
+    FD_LOBBY_INPUT,     // input client waiting for a window
+    FD_VIEWER,
+    FD_INPUT,
+};
+
+// A client that turned up before there was a window for it
+struct LobbyClient {
+    int fd = -1;                    // TCP clients
+    sockaddr_in addr{};
+    long long last_heard_ms = 0;    // UDP clients
+    // Input clients: their hello is answered while they wait, and what they
+    // send after it is kept for the session they join
+    bool greeted = false;           // first message looked at
+    uint8_t input_version = 0;      // binary protocol version agreed, 0: JSON
+    std::vector<uint8_t> input_buffer;
+};
+
+// Everything the event loop owns. One thread runs the loop: it accepts
+// clients, reads input, writes video and watches for edge drags. The steps
+// of every session's pipeline run on the `stages` pool, so the number of
+// threads does not depend on the number of sessions.
+struct Server {
+    Display* dpy = nullptr;
+    int epoll_fd = -1;
+    int wake_fd = -1;               // eventfd, written by a worker after every step
+    int video_fd = -1;
+    int input_fd = -1;
+    int udp_fd = -1;
+    EdgeWatcher edge;
+    CursorTracker cursor;
+    WindowIndex windows;
+    // UDP peers are checked for timeouts while there are any
+    std::chrono::steady_clock::time_point next_udp_check{};
+
+    std::deque<LobbyClient> video_lobby;
+    std::deque<LobbyClient> udp_lobby;
+    std::deque<LobbyClient> input_lobby;
+
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::unordered_map<int, Session*> fd_sessions;  // viewer and input sockets
+    int next_id = 1;
+
+    std::unique_ptr<ThreadPool> encode_pool;        // JPEG stripes and tiles
+    // Declared last so it is destroyed first: no step outlives the sessions
+    std::unique_ptr<ThreadPool> stages;
+};
+
+void server_wake(Server& server) {
+    uint64_t one = 1;
+    ssize_t n = write(server.wake_fd, &one, sizeof(one));
+    (void)n;
+}
 
-    int screen_width = DisplayWidth(dpy, DefaultScreen(dpy));
-    int screen_height = DisplayHeight(dpy, DefaultScreen(dpy));
+void watch_fd(Server& server, int op, int fd, FdKind kind, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = (uint64_t)kind << 32 | (uint32_t)fd;
+    if (epoll_ctl(server.epoll_fd, op, fd, &ev) < 0) perror("epoll_ctl");
+}
 
-    // If part of window is outside screen bounds
-    return (x + attr.width < 0 || x > screen_width ||
-            y + attr.height < 0 || y > screen_height);
+bool has_output(const Session& s) {
+    return !s.viewers.viewers.empty() || s.udp;
+}
+
+// Queue one step of `stage` on the stage pool; the caller holds s.mutex.
+// Clearing the busy flag is the last thing the worker does with the
+// session, so the loop may free it as soon as no flag is set.
+void run_stage(Server& server, Session& s, SessionStage stage) {
+    s.busy[stage] = true;
+    s.tasks[stage] = StageTask{&server, &s, stage};
+    server.stages->submit([task = &s.tasks[stage]] {
+        Server& server = *task->server;
+        Session& s = *task->session;
+        SessionStage stage = task->stage;
+        bool ok = true;
+        switch (stage) {
+        case STAGE_CAPTURE: ok = capture_step(s); break;
+        case STAGE_CONVERT: convert_step(s); break;
+        case STAGE_ENCODE: ok = encode_step(s, *server.encode_pool); break;
+        case STAGE_INPUT: ok = input_step(s); break;
+        default: break;
+        }
+        if (!ok) s.closing = true;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.busy[stage] = false;
+        }
+        server_wake(server);
+    });
 }
-Window find_offscreen_window(Display* dpy) {
-    Window root = DefaultRootWindow(dpy);
-    Window root_return, parent_return;
-    Window* children;
-    unsigned int nchildren;
 
-    if (XQueryTree(dpy, root, &root_return, &parent_return, &children, &nchildren) == 0)
-        return 0;
+// Queue every step of the session that can make progress. A stage is ready
+// when it has something to work on and, with the block policy, room for its
+// output, so no step ever waits on a queue.
+void schedule_session(Server& server, Session& s, std::chrono::steady_clock::time_point now) {
+    bool block = config.drop_policy == QueuePolicy::Block;
+    auto has_room = [block](auto& queue) { return !block || queue.depth() < queue.capacity(); };
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!s.busy[STAGE_CAPTURE] && has_output(s)) {
+        if (s.scheduler.take_woken()) s.next_capture = now;
+        if (now >= s.next_capture && s.free_slots.depth() > 0 && has_room(s.convert_queue)) {
+            run_stage(server, s, STAGE_CAPTURE);
+        }
+    }
+    if (!s.busy[STAGE_CONVERT] && s.convert_queue.depth() > 0 && has_room(s.encode_queue)) {
+        run_stage(server, s, STAGE_CONVERT);
+    }
+    if (!s.busy[STAGE_ENCODE] && s.encode_queue.depth() > 0 && has_room(s.send_queue)) {
+        run_stage(server, s, STAGE_ENCODE);
+    }
+    if (!s.busy[STAGE_INPUT] &&
+        (s.input_queue.size() > 0 || (s.fast_input && s.input_opened != s.input_connected))) {
+        run_stage(server, s, STAGE_INPUT);
+    }
+}
 
-    for (unsigned int i = 0; i < nchildren; ++i) {
-        Window w = children[i];
+void remove_viewer(Server& server, Session& s, int fd) {
+    std::vector<std::unique_ptr<Viewer>>& viewers = s.viewers.viewers;
+    for (size_t i = 0; i < viewers.size(); i++) {
+        if (viewers[i]->sock != fd) continue;
+        server.fd_sessions.erase(fd);
+        broadcast_remove(s.viewers, i);
+        return;
+    }
+}
 
-        XWindowAttributes attr;
-        if (!XGetWindowAttributes(dpy, w, &attr) || attr.map_state != IsViewable)
-            continue;
+// Remember which sent frame answers input, until the client acks it
+void note_input_frame(Session& s, const EncodedFrame& encoded) {
+    if (!encoded.timing.input_us) return;
+    if (s.input_frames.size() >= INPUT_FRAMES_TRACKED) s.input_frames.pop_front();
+    s.input_frames.emplace_back(encoded.timing.seq, encoded.timing.input_us);
+}
+
+// The client showed frame `header.seq`. Capture to display is measured when
+// the ack arrives, so it includes the ack's trip back.
+void handle_display_ack(Session& s, const FrameHeader& header) {
+    uint64_t now = frame_clock_us();
+    histogram_record(s.stats.capture_to_display, now > header.capture_us ? now - header.capture_us : 0);
+    // Acks may skip frames the client never showed
+    while (!s.input_frames.empty() && (int32_t)(header.seq - s.input_frames.front().first) >= 0) {
+        if (s.input_frames.front().first == header.seq) {
+            uint64_t input_us = s.input_frames.front().second;
+            histogram_record(s.stats.input_to_display, now > input_us ? now - input_us : 0);
+        }
+        s.input_frames.pop_front();
+    }
+}
 
-        int x, y;
-        Window dummy;
-        XTranslateCoordinates(dpy, w, root, 0, 0, &x, &y, &dummy);
+// Hand encoded frames to the session's viewers or UDP peer and write what
+// the sockets take without blocking
+void pump_output(Server& server, Session& s) {
+    EncodedFrame encoded;
+    if (s.udp) {
+        while (s.send_queue.try_pop(encoded)) {
+            StageTimer timer(s.stats, STAT_SEND);
+            // The datagrams carry the message without its length prefix
+            const std::vector<uint8_t>& msg = encoded.buffers->msg;
+            if (!udp_transport_send(*s.udp, msg.data() + 4, msg.size() - 4, encoded.keyframe)) {
+                s.closing = true;
+                return;
+            }
+            s.stats.sent_bytes += msg.size() - 4;
+            note_input_frame(s, encoded);
+        }
+        return;
+    }
 
-        int screen_width = DisplayWidth(dpy, DefaultScreen(dpy));
-        int screen_height = DisplayHeight(dpy, DefaultScreen(dpy));
+    // Timed only when something was written or queued
+    auto start = std::chrono::steady_clock::now();
+    bool worked = false;
 
-        if (x + attr.width < 0 || x > screen_width ||
-            y + attr.height < 0 || y > screen_height) {
-            return w;
+    Broadcast& b = s.viewers;
+    while (true) {
+        for (size_t i = 0; i < b.viewers.size();) {
+            Viewer& v = *b.viewers[i];
+            int state = viewer_flush(v);
+            if (state < 0) {
+                perror("send frame");
+                remove_viewer(server, s, v.sock);
+                continue;
+            }
+            // The controller tracks one connection's send queue
+            if (v.written_bytes && !config.broadcast) quality_controller_update(s.quality, v.sock, v.written_bytes);
+            if (v.written_bytes) worked = true;
+            s.stats.sent_bytes += v.written_bytes;
+            v.written_bytes = 0;
+            bool want_out = state == 0;
+            if (want_out != v.polling_out) {
+                v.polling_out = want_out;
+                watch_fd(server, EPOLL_CTL_MOD, v.sock, FD_VIEWER, EPOLLRDHUP | (want_out ? EPOLLOUT : 0));
+            }
+            i++;
         }
+        if (b.viewers.empty()) break;
+        // A single viewer takes the next frame only once the last one is
+        // written, so the send queue's drop policy decides what is skipped
+        if (!config.broadcast && !b.viewers[0]->queue.empty()) break;
+        if (!s.send_queue.try_pop(encoded)) break;
+        note_input_frame(s, encoded);
+
+        BroadcastFrame frame;
+        // Shares the frame's buffers: they go back to the pool once the
+        // last viewer has written the message
+        frame.msg = std::shared_ptr<const std::vector<uint8_t>>(encoded.buffers, &encoded.buffers->msg);
+        frame.keyframe = encoded.keyframe;
+        broadcast_offer(b, frame);
+        worked = true;
     }
+    if (worked) stats_record(s.stats, STAT_SEND, start, std::chrono::steady_clock::now());
 
-    if (children)
-        XFree(children);
-    return 0; // No window offscreen
+    if (b.want_keyframe) {
+        b.want_keyframe = false;
+        s.force_keyframe = true;
+    }
+    if (s.streaming && b.viewers.empty()) {
+        std::cout << "[SESSION " << s.id << "] Last viewer left\n";
+        s.closing = true;
+    }
 }
 
-int main(int argc, char** argv) {
-    Display* dpy = XOpenDisplay(nullptr);
-    if (!dpy) {
-        std::cerr << "Cannot open display\n";
-        return 1;
+// Start the cursor channel over for a new input client; `enabled` if it
+// takes the cursor
+void reset_cursor(Session& s, bool enabled) {
+    s.cursor_client = enabled;
+    s.cursor_out.clear();
+    s.cursor_shapes.clear();
+    s.cursor_changes = 0;
+    s.cursor_sent = InputCursor{};
+}
+
+// The client shows the stream at view_w x view_h (0 x 0: any size). The next
+// keyframe picks the new output scale up; ask for it now, since an idle
+// window would not send one for a while.
+void set_viewport(Session& s, int view_w, int view_h) {
+    uint32_t viewport = view_w && view_h ? (uint32_t)view_w << 16 | (uint32_t)view_h : 0;
+    if (s.viewport.exchange(viewport) == viewport) return;
+    std::cout << "[SESSION " << s.id << "] Client viewport " << view_w << "x" << view_h
+              << (config.fit_viewport ? "" : " (not fitted, --no-fit-viewport)") << "\n";
+    if (!config.fit_viewport) return;
+    s.force_keyframe = true;
+    s.scheduler.wake();
+}
+
+// Answer a binary input client's hello with the version both sides speak,
+// which is returned; 0 if the answer could not be sent
+uint8_t answer_input_hello(int fd, uint8_t version) {
+    std::vector<uint8_t> ack;
+    put_u32(ack, INPUT_HELLO_SIZE);
+    input_hello(ack, std::min<uint8_t>(version, INPUT_PROTOCOL_VERSION));
+    if (!send_all(fd, ack.data(), ack.size())) return 0;
+    std::cout << "[INPUT] Binary input protocol v" << (int)ack.back() << "\n";
+    return ack.back();
+}
+
+// Decode the complete messages in the input buffer: answer the binary
+// protocol hello and queue events for the input step. Stops early once the
+// queue is full. Returns false if the client has to go.
+bool parse_input(Session& s) {
+    std::vector<uint8_t>& buffer = s.input_buffer;
+    std::vector<InputEvent> events;
+    size_t pos = 0;
+    bool ok = true;
+
+    while (!s.input_paused && buffer.size() - pos >= 4) {
+        uint32_t msg_size = get_u32(buffer.data() + pos);
+        if (msg_size > INPUT_MAX_MESSAGE) {
+            std::cerr << "[INPUT] Message of " << msg_size << " bytes, dropping client\n";
+            ok = false;
+            break;
+        }
+        if (buffer.size() - pos - 4 < msg_size) break;
+        const uint8_t* data = buffer.data() + pos + 4;
+        pos += 4 + msg_size;
+        if (msg_size == 0) continue;
+
+        // Binary clients open with a hello; answer with the version we speak
+        uint8_t version;
+        if (input_is_hello(data, msg_size, version)) {
+            version = answer_input_hello(s.input_fd, version);
+            if (!version) {
+                ok = false;
+                break;
+            }
+            reset_cursor(s, version >= INPUT_CURSOR_VERSION);
+            continue;
+        }
+
+        FrameHeader shown;
+        if (input_decode_ack(data, msg_size, shown)) {
+            handle_display_ack(s, shown);
+            continue;
+        }
+
+        int view_w, view_h;
+        if (input_decode_viewport(data, msg_size, view_w, view_h)) {
+            set_viewport(s, view_w, view_h);
+            continue;
+        }
+
+        if (data[0] == INPUT_MSG_BATCH) {
+            if (!input_decode_batch(data, msg_size, events)) {
+                std::cerr << "[INPUT] Malformed input batch\n";
+                continue;
+            }
+        } else {
+            events.clear();
+            try {
+                inputEventsFromJson(nlohmann::json::parse(data, data + msg_size), events);
+            } catch (...) {
+                std::cerr << "[INPUT] JSON parse error\n";
+                continue;
+            }
+        }
+        if (events.empty()) continue;
+        uint64_t none = 0;
+        s.input_arrived_us.compare_exchange_strong(none, frame_clock_us());
+        s.scheduler.notify_input();
+        // Over capacity: stop reading until the input step catches up, which
+        // pushes back on the client's socket
+        if (!s.input_queue.push_nowait(events)) s.input_paused = true;
     }
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+    return ok;
+}
 
-    int composite_event_base, composite_error_base;
-    if (!XCompositeQueryExtension(dpy, &composite_event_base, &composite_error_base)) {
-        std::cerr << "XComposite extension not available\n";
-        XCloseDisplay(dpy);
-        return 1;
+// Wait for input unless paused, and for room to write while the cursor
+// channel is backed up
+void watch_input(Server& server, Session& s) {
+    if (s.input_fd < 0) return;
+    uint32_t events = EPOLLRDHUP | (s.input_paused ? 0 : EPOLLIN) | (s.cursor_out.empty() ? 0 : EPOLLOUT);
+    if (events == s.input_watch) return;
+    s.input_watch = events;
+    watch_fd(server, EPOLL_CTL_MOD, s.input_fd, FD_INPUT, events);
+}
+
+// Write as much of the cursor channel as the socket takes; the rest waits
+// for EPOLLOUT. A failed write is left for the read side to notice.
+void flush_cursor(Server& server, Session& s) {
+    size_t sent = 0;
+    while (sent < s.cursor_out.size()) {
+        ssize_t n = send(s.input_fd, s.cursor_out.data() + sent, s.cursor_out.size() - sent,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sent += (size_t)n;
     }
+    s.cursor_out.erase(s.cursor_out.begin(), s.cursor_out.begin() + sent);
+    watch_input(server, s);
+}
 
-    int screen_width = DisplayWidth(dpy, DefaultScreen(dpy));
-    int screen_height = DisplayHeight(dpy, DefaultScreen(dpy));
+int16_t clamp_i16(long v) {
+    return (int16_t)std::min(32767L, std::max(-32768L, v));
+}
 
-    // Setup server socket
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("socket failed");
-        return 1;
+// Send the input client the pointer's position whenever it moved or the
+// output scale changed, preceded by its shape if the client does not hold
+// that one. Positions are only queued once the last ones are written, so a
+// client that falls behind gets the newest, not every one in between.
+void pump_cursor(Server& server, Session& s) {
+    CursorTracker& t = server.cursor;
+    if (!s.cursor_client || s.input_fd < 0 || !cursor_tracker_available(t)) return;
+    if (!s.cursor_out.empty()) flush_cursor(server, s);
+    double scale = s.stream_scale;
+    if (!s.cursor_out.empty() || (s.cursor_changes == t.changes && s.cursor_scale == scale)) return;
+    s.cursor_changes = t.changes;
+    s.cursor_scale = scale;
+
+    InputCursor cursor;
+    int x = 0, y = 0;
+    cursor.serial = t.serial;
+    cursor.visible = cursor_tracker_locate(t, s.window, x, y);
+    cursor.x = clamp_i16(std::lround(x * scale));
+    cursor.y = clamp_i16(std::lround(y * scale));
+    const InputCursor& sent = s.cursor_sent;
+    if (cursor.serial == sent.serial && cursor.x == sent.x && cursor.y == sent.y && cursor.visible == sent.visible) {
+        return;
     }
 
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt));
+    if (cursor.visible && std::find(s.cursor_shapes.begin(), s.cursor_shapes.end(), cursor.serial) == s.cursor_shapes.end()) {
+        if (const CachedCursor* shape = cursor_tracker_shape(t, cursor.serial)) {
+            s.cursor_out.insert(s.cursor_out.end(), shape->msg.begin(), shape->msg.end());
+            // Mirrors the client's cache, which drops its oldest shape too
+            s.cursor_shapes.push_back(cursor.serial);
+            if (s.cursor_shapes.size() > INPUT_CURSOR_CACHE) s.cursor_shapes.pop_front();
+        }
+    }
+    input_encode_cursor(cursor, s.cursor_out);
+    s.cursor_sent = cursor;
+    flush_cursor(server, s);
+}
 
-    struct sockaddr_in address{};
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+void drop_input(Server& server, Session& s) {
+    std::cout << "[SESSION " << s.id << "] Input client disconnected\n";
+    server.fd_sessions.erase(s.input_fd);
+    close(s.input_fd);
+    s.input_fd = -1;
+    s.input_buffer.clear();
+    s.input_paused = false;
+    s.input_connected = false;
+    // The next input client tells its own viewport, if it has one
+    set_viewport(s, 0, 0);
+    reset_cursor(s, false);
+}
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        perror("bind failed");
-        return 1;
+// Read whatever the input client sent
+void read_input(Server& server, Session& s) {
+    uint8_t chunk[16384];
+    while (!s.input_paused) {
+        ssize_t n = recv(s.input_fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            drop_input(server, s);
+            return;
+        }
+        s.input_buffer.insert(s.input_buffer.end(), chunk, chunk + n);
+        if (!parse_input(s)) {
+            drop_input(server, s);
+            return;
+        }
     }
+    if (s.input_paused) watch_input(server, s);
+}
 
-    if (listen(server_fd, 1) < 0) {
-        perror("listen");
-        return 1;
+// Start reading a paused input client again once its queue has room
+void resume_input(Server& server, Session& s) {
+    if (!s.input_paused || s.input_queue.size() >= s.input_queue.capacity()) return;
+    s.input_paused = false;
+    if (!parse_input(s)) {
+        drop_input(server, s);
+        return;
     }
+    if (!s.input_paused) watch_input(server, s);
+}
 
-    std::cout << "Watching for windows dragged to screen edge...\n";
+void attach_viewer(Server& server, Session& s, int fd, int op) {
+    if (!s.streaming) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        if (getpeername(fd, (sockaddr*)&addr, &len) == 0) s.client_addr = addr.sin_addr;
+        std::cout << "[SESSION " << s.id << "] Client connected, starting stream...\n";
+    }
+    broadcast_add(s.viewers, fd);
+    server.fd_sessions[fd] = &s;
+    watch_fd(server, op, fd, FD_VIEWER, EPOLLRDHUP);
+    // Each viewer starts from a keyframe right away instead of waiting for
+    // the next scheduled one
+    s.streaming = true;
+    s.force_keyframe = true;
+    s.scheduler.wake();
+}
 
-    int hold_counter = 0;
-    const int hold_threshold = 20; // 20 * 100ms = 2 seconds
+void attach_udp(Server& server, Session& s, const sockaddr_in& peer) {
+    s.udp.reset(new UdpTransport);
+    s.udp->fec_group = config.fec_group;
+    s.udp->loss = config.udp_loss;
+    udp_transport_open(*s.udp, server.udp_fd, peer);
+    std::cout << "[SESSION " << s.id << "] Client subscribed, starting stream...\n";
+    s.client_addr = peer.sin_addr;
+    s.streaming = true;
+    s.force_keyframe = true;
+    s.scheduler.wake();
+}
 
+// Give `client` to the session, along with whatever it said while waiting
+void attach_input(Server& server, Session& s, LobbyClient& client, int op) {
+    std::cout << "[SESSION " << s.id << "] Input client connected\n";
+    s.input_fd = client.fd;
+    s.input_connected = true;
+    s.input_watch = EPOLLIN | EPOLLRDHUP;
+    s.input_buffer.swap(client.input_buffer);
+    reset_cursor(s, client.input_version >= INPUT_CURSOR_VERSION);
+    server.fd_sessions[client.fd] = &s;
+    watch_fd(server, op, client.fd, FD_INPUT, s.input_watch);
+    if (s.input_buffer.empty()) return;
+    if (!parse_input(s)) drop_input(server, s);
+    else watch_input(server, s);
+}
+
+// Read what a waiting input client sent. Its hello is answered right away,
+// since clients wait only a moment for it; everything after that is kept.
+// Returns false if the client left or has to go.
+bool read_lobby_input(LobbyClient& client) {
+    std::vector<uint8_t>& buffer = client.input_buffer;
+    uint8_t chunk[4096];
     while (true) {
-        Window root = DefaultRootWindow(dpy);
-        Window ret_root, ret_child;
-        int root_x, root_y, win_x, win_y;
-        unsigned int mask;
-
-        if (!XQueryPointer(dpy, root, &ret_root, &ret_child,
-                           &root_x, &root_y, &win_x, &win_y, &mask)) {
-            usleep(100000);
-            continue;
+        ssize_t n = recv(client.fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return false;
+        buffer.insert(buffer.end(), chunk, chunk + n);
+        if (buffer.size() > INPUT_LOBBY_BUFFER) {
+            std::cerr << "[INPUT] Waiting client sent too much, dropping it\n";
+            return false;
+        }
+    }
+
+    // Only the first message can be a hello
+    if (client.greeted || buffer.size() < 4) return true;
+    uint32_t msg_size = get_u32(buffer.data());
+    if (buffer.size() - 4 < msg_size) return true;
+    client.greeted = true;
+    uint8_t version;
+    if (!input_is_hello(buffer.data() + 4, msg_size, version)) return true;
+    client.input_version = answer_input_hello(client.fd, version);
+    buffer.erase(buffer.begin(), buffer.begin() + 4 + msg_size);
+    return client.input_version != 0;
+}
+
+// A new video connection watches the oldest window nobody watches yet.
+// With --broadcast it may also join the newest stream.
+void place_video_client(Server& server, int fd, int op) {
+    for (std::unique_ptr<Session>& s : server.sessions) {
+        if (!s->closing && !s->streaming) {
+            attach_viewer(server, *s, fd, op);
+            return;
+        }
+    }
+    if (config.broadcast) {
+        for (auto it = server.sessions.rbegin(); it != server.sessions.rend(); ++it) {
+            if (!(*it)->closing) {
+                attach_viewer(server, **it, fd, op);
+                return;
+            }
+        }
+    }
+    // Video clients never send anything, so readable means gone
+    LobbyClient client;
+    client.fd = fd;
+    server.video_lobby.push_back(client);
+    watch_fd(server, op, fd, FD_LOBBY_VIDEO, EPOLLIN | EPOLLRDHUP);
+    std::cout << "[INFO] Video client waiting for a window\n";
+}
+
+// A new input connection drives the session watched from the same address,
+// or else the oldest session without input
+void place_input_client(Server& server, int fd, const sockaddr_in& addr, int op) {
+    Session* target = nullptr;
+    for (std::unique_ptr<Session>& s : server.sessions) {
+        if (s->closing || s->input_fd >= 0) continue;
+        if (s->streaming && s->client_addr.s_addr == addr.sin_addr.s_addr) {
+            target = s.get();
+            break;
+        }
+        if (!target) target = s.get();
+    }
+    LobbyClient client;
+    client.fd = fd;
+    client.addr = addr;
+    if (target) {
+        attach_input(server, *target, client, op);
+        return;
+    }
+    server.input_lobby.push_back(std::move(client));
+    watch_fd(server, op, fd, FD_LOBBY_INPUT, EPOLLIN | EPOLLRDHUP);
+    std::cout << "[INPUT] Client waiting for a window\n";
+}
+
+// Start streaming `window` to the clients that are already waiting
+void start_session(Server& server, Window window) {
+    for (std::unique_ptr<Session>& s : server.sessions) {
+        if (s->window == window && !s->closing) {
+            std::cout << "[INFO] Window " << window << " is already streaming in session " << s->id << "\n";
+            return;
         }
+    }
+    if (config.max_sessions && server.sessions.size() >= config.max_sessions) {
+        std::cerr << "[WARN] Already streaming " << server.sessions.size() << " windows (--max-sessions)\n";
+        return;
+    }
+
+    // Redirect for composite capture
+    XCompositeRedirectWindow(server.dpy, window, CompositeRedirectAutomatic);
+    XFlush(server.dpy);
 
-        bool is_pressed = mask & Button1Mask;
-        bool at_edge = (root_x <= 1 || root_y <= 1 ||
-                        root_x >= screen_width - 1 || root_y >= screen_height - 1);
+    server.sessions.emplace_back(new Session(server.next_id++, server.dpy, window));
+    Session& s = *server.sessions.back();
+    std::cout << "[SESSION " << s.id << "] Streaming window " << window << "\n";
 
-        if (is_pressed && at_edge) {
-            hold_counter++;
+    if (config.transport == Transport::Udp) {
+        if (!server.udp_lobby.empty()) {
+            attach_udp(server, s, server.udp_lobby.front().addr);
+            server.udp_lobby.pop_front();
         } else {
-            hold_counter = 0;
+            std::cout << "[INFO] Waiting for a UDP client on port " << PORT << "...\n";
         }
+    } else if (!server.video_lobby.empty()) {
+        do {
+            attach_viewer(server, s, server.video_lobby.front().fd, EPOLL_CTL_MOD);
+            server.video_lobby.pop_front();
+        } while (config.broadcast && !server.video_lobby.empty());
+    } else {
+        std::cout << "[INFO] Waiting for client to connect on port " << PORT << "...\n";
+    }
 
-        if (hold_counter >= hold_threshold) {
-            std::cout << "[INFO] Edge drag detected. Trying to stream window...\n";
-            hold_counter = 0;
+    if (!server.input_lobby.empty()) {
+        auto it = std::find_if(server.input_lobby.begin(), server.input_lobby.end(), [&](const LobbyClient& c) {
+            return s.streaming && c.addr.sin_addr.s_addr == s.client_addr.s_addr;
+        });
+        if (it == server.input_lobby.end()) it = server.input_lobby.begin();
+        LobbyClient client = std::move(*it);
+        server.input_lobby.erase(it);
+        attach_input(server, s, client, EPOLL_CTL_MOD);
+    }
+}
 
-            // Get active window
-            Atom actual_type;
-            int actual_format;
-            unsigned long nitems, bytes_after;
-            unsigned char* prop = nullptr;
-            Atom active = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", True);
-            Window active_win = 0;
+// Free everything the session holds. Only called once no step is queued or
+// running, so nothing else can reach it any more.
+void end_session(Server& server, size_t index) {
+    Session& s = *server.sessions[index];
+    for (std::unique_ptr<Viewer>& v : s.viewers.viewers) server.fd_sessions.erase(v->sock);
+    broadcast_close(s.viewers);
+    if (s.udp) {
+        std::cout << "[UDP] Sent " << s.udp->packets_sent << " packets, simulated loss " << s.udp->packets_dropped
+                  << ", keyframe requests " << s.key_requests << "\n";
+    }
+    if (s.input_fd >= 0) drop_input(server, s);
+    if (s.input_queue.coalesced()) std::cout << "[INPUT] Coalesced " << s.input_queue.coalesced() << " motion events\n";
+    input_session_close(s.input);
+
+    for (ShmCapture& slot : s.slots) shm_capture_release(slot);
+    damage_tracker_release(s.capture.damage);
+    window_capture_close(s.capture.window);
+#ifdef WITH_AVCODEC
+    h264_encoder_close(s.encode.h264);
+#endif
+    if (s.stats.trace) trace_flush(*s.stats.trace);
+    std::cout << "[SESSION " << s.id << "] Stream ended\n";
+    server.sessions.erase(server.sessions.begin() + index);
+}
 
-            if (XGetWindowProperty(dpy, root, active, 0, (~0L), False, AnyPropertyType,
-                                   &actual_type, &actual_format, &nitems, &bytes_after, &prop) == Success) {
-                if (nitems > 0) {
-                    active_win = *(Window*)prop;
-                }
-                XFree(prop);
+// Print a latency distribution since the last dump
+void print_histogram(std::ostream& out, const char* name, LatencyHistogram& histogram) {
+    HistogramSnapshot h;
+    histogram_take(histogram, h);
+    out << " " << name << " n=" << h.count;
+    if (!h.count) return;
+    out << " p50=" << histogram_percentile(h, 0.5) / 1000.0 << " p99=" << histogram_percentile(h, 0.99) / 1000.0
+        << " max=" << h.max_us / 1000.0;
+}
+
+// Every stats interval: queue depths, where frame time went and what came
+// in and out of the session since the last time
+void print_stats(Session& s, std::chrono::steady_clock::time_point now) {
+    if (!config.stats_interval_s || now - s.last_stats < std::chrono::seconds(config.stats_interval_s)) return;
+    double seconds = std::chrono::duration<double>(now - s.last_stats).count();
+    s.last_stats = now;
+
+    uint64_t queue_drops = s.convert_queue.drops() + s.encode_queue.drops() + s.send_queue.drops();
+    std::cout << "[PIPE " << s.id << "] queue depth (max/cap) convert=" << s.convert_queue.take_max_depth()
+              << "/" << s.convert_queue.capacity()
+              << " encode=" << s.encode_queue.take_max_depth() << "/" << s.encode_queue.capacity()
+              << " send=" << s.send_queue.take_max_depth() << "/" << s.send_queue.capacity()
+              << " drops=" << s.convert_queue.drops() << "/" << s.encode_queue.drops()
+              << "/" << s.send_queue.drops()
+              << " fps=" << 1.0 / s.scheduler.interval() << "\n";
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(2) << "[STATS " << s.id << "] ms:";
+    for (int stage = 0; stage < STAT_COUNT; stage++) print_histogram(line, stat_stage_name(stage), s.stats.stages[stage]);
+    std::cout << line.str() << "\n";
+
+    line.str("");
+    line << "[LATENCY " << s.id << "] ms:";
+    print_histogram(line, "capture->display", s.stats.capture_to_display);
+    print_histogram(line, "input->frame", s.stats.input_to_frame);
+    print_histogram(line, "input->display", s.stats.input_to_display);
+    std::cout << line.str() << "\n";
+
+    StatsTotals now_totals;
+    now_totals.frames = s.stats.frames;
+    now_totals.keyframes = s.stats.keyframes;
+    now_totals.encoded = s.stats.encoded;
+    now_totals.encoded_bytes = s.stats.encoded_bytes;
+    now_totals.sent_bytes = s.stats.sent_bytes;
+    now_totals.input_events = s.stats.input_events;
+    now_totals.drops = queue_drops + s.viewers.skipped;
+    now_totals.allocs = alloc_count();
+    const StatsTotals& last = s.printed;
+    line.str("");
+    line << std::fixed << std::setprecision(1) << "[STATS " << s.id << "] over " << seconds << "s: frames "
+         << now_totals.frames - last.frames << " (" << now_totals.keyframes - last.keyframes << " key), encoded "
+         << now_totals.encoded - last.encoded << ", "
+         << (now_totals.encoded_bytes - last.encoded_bytes) / seconds / 1024 << " KB/s encoded, "
+         << (now_totals.sent_bytes - last.sent_bytes) / seconds / 1024 << " KB/s sent, dropped "
+         << now_totals.drops - last.drops << ", input events " << now_totals.input_events - last.input_events
+         << ", frame buffers " << s.frame_buffers.size();
+#ifdef WITH_ALLOC_COUNTER
+    // Heap allocations by the whole process (every session, this dump
+    // included) per frame this session captured
+    uint64_t frames = now_totals.frames - last.frames;
+    if (frames) line << ", allocs/frame " << (double)(now_totals.allocs - last.allocs) / frames;
+#endif
+    std::cout << line.str() << "\n";
+    s.printed = now_totals;
+    if (s.stats.trace) trace_flush(*s.stats.trace);
+}
+
+// Move output along, resume input and queue steps for every session; free
+// the ones that have ended
+void service_sessions(Server& server) {
+    auto now = std::chrono::steady_clock::now();
+    bool cursor_wanted = false;
+    for (size_t i = 0; i < server.sessions.size();) {
+        Session& s = *server.sessions[i];
+        if (!s.closing) {
+            pump_output(server, s);
+            if (s.input_fd >= 0) resume_input(server, s);
+            pump_cursor(server, s);
+            cursor_wanted |= s.cursor_client;
+            if (has_output(s)) print_stats(s, now);
+        }
+        if (!s.closing) {
+            schedule_session(server, s, now);
+            i++;
+            continue;
+        }
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            idle = std::none_of(std::begin(s.busy), std::end(s.busy), [](bool b) { return b; });
+        }
+        if (idle) end_session(server, i);
+        else i++;
+    }
+    server.cursor.wanted = cursor_wanted;
+}
+
+// UDP has no connection to notice a client leaving, and loss is only seen
+// by the client: route its keepalives and keyframe requests by address.
+// Only hellos may come from a new address.
+void read_udp(Server& server) {
+    sockaddr_in from{};
+    int kind;
+    while (udp_socket_receive(server.udp_fd, from, kind)) {
+        if (kind < 0) continue;
+        long long now = udp_now_ms();
+
+        Session* owner = nullptr;
+        for (std::unique_ptr<Session>& s : server.sessions) {
+            if (s->udp && udp_same_peer(s->udp->peer, from)) {
+                owner = s.get();
+                break;
+            }
+        }
+        if (owner) {
+            owner->udp->last_heard_ms = now;
+            if (kind == UDP_KEY_REQUEST) {
+                owner->force_keyframe = true;
+                owner->key_requests++;
+                owner->scheduler.wake();
             }
+            continue;
+        }
+        if (kind != UDP_HELLO) continue;
 
-            if (!active_win) {
-                std::cerr << "[WARN] No active window found.\n";
-                continue;
+        auto known = std::find_if(server.udp_lobby.begin(), server.udp_lobby.end(),
+                                  [&](const LobbyClient& c) { return udp_same_peer(c.addr, from); });
+        if (known != server.udp_lobby.end()) {
+            known->last_heard_ms = now;
+            continue;
+        }
+        for (std::unique_ptr<Session>& s : server.sessions) {
+            if (!s->closing && !s->streaming) {
+                attach_udp(server, *s, from);
+                owner = s.get();
+                break;
             }
+        }
+        if (owner) continue;
+        LobbyClient client;
+        client.addr = from;
+        client.last_heard_ms = now;
+        server.udp_lobby.push_back(client);
+        std::cout << "[UDP] Client " << inet_ntoa(from.sin_addr) << ":" << ntohs(from.sin_port)
+                  << " waiting for a window\n";
+    }
+}
 
-            std::cout << "[INFO] Active window ID: " << active_win << "\n";
+// End UDP streams and forget waiting UDP clients that went quiet, and
+// keep idle streams alive for their clients
+void expire_udp_clients(Server& server) {
+    long long now = udp_now_ms();
+    for (std::unique_ptr<Session>& s : server.sessions) {
+        if (!s->udp || s->closing) continue;
+        if (!udp_transport_peer_alive(*s->udp)) {
+            std::cout << "[UDP] Client went quiet, ending stream\n";
+            s->closing = true;
+        } else {
+            udp_transport_keepalive(*s->udp);
+        }
+    }
+    while (!server.udp_lobby.empty() && now - server.udp_lobby.front().last_heard_ms >= UDP_PEER_TIMEOUT_MS) {
+        server.udp_lobby.pop_front();
+    }
+}
 
-            // Redirect for composite capture
-            XCompositeRedirectWindow(dpy, active_win, CompositeRedirectAutomatic);
-            XFlush(dpy);
+// A window was held against a screen edge: stream the active window
+void edge_drag_detected(Server& server) {
+    Display* dpy = server.dpy;
+    Window root = DefaultRootWindow(dpy);
 
-            // Start input thread
-            std::thread input_thread(handle_input_events, dpy, active_win, 12346);
-            input_thread.detach();
+    std::cout << "[INFO] Edge drag detected. Trying to stream window...\n";
 
-            std::cout << "[INFO] Waiting for client to connect on port " << PORT << "...\n";
-            socklen_t addrlen = sizeof(address);
-            int client_socket = accept(server_fd, (struct sockaddr*)&address, &addrlen);
-            if (client_socket < 0) {
-                perror("accept");
-                continue;
+    // Get active window
+    Atom actual_type;
+    int actual_format;
+    unsigned long nitems, bytes_after;
+    unsigned char* prop = nullptr;
+    Atom active = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", True);
+    Window active_win = 0;
+
+    if (XGetWindowProperty(dpy, root, active, 0, (~0L), False, AnyPropertyType,
+                           &actual_type, &actual_format, &nitems, &bytes_after, &prop) == Success) {
+        if (nitems > 0) {
+            active_win = *(Window*)prop;
+        }
+        XFree(prop);
+    }
+
+    // Without a window manager that reports the active window, take the
+    // window that was dragged off the screen
+    if (!active_win) active_win = window_index_find_offscreen(server.windows);
+    if (!active_win) {
+        std::cerr << "[WARN] No active or off-screen window found.\n";
+        return;
+    }
+
+    std::cout << "[INFO] Active window ID: " << active_win << "\n";
+    start_session(server, active_win);
+}
+
+void close_lobby_client(std::deque<LobbyClient>& lobby, int fd) {
+    for (auto it = lobby.begin(); it != lobby.end(); ++it) {
+        if (it->fd != fd) continue;
+        close(fd);
+        lobby.erase(it);
+        return;
+    }
+}
+
+void handle_event(Server& server, const epoll_event& ev) {
+    FdKind kind = (FdKind)(ev.data.u64 >> 32);
+    int fd = (int)(uint32_t)ev.data.u64;
+    bool hangup = ev.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+
+    switch (kind) {
+    case FD_EDGE:
+        edge_watcher_dispatch(server.edge);
+        break;
+    case FD_CURSOR:
+        cursor_tracker_dispatch(server.cursor);
+        break;
+    case FD_WINDOWS:
+        window_index_dispatch(server.windows);
+        break;
+    case FD_WAKE: {
+        uint64_t count;
+        ssize_t n = read(fd, &count, sizeof(count));
+        (void)n;
+        break;
+    }
+    case FD_VIDEO_LISTEN:
+    case FD_INPUT_LISTEN:
+        while (true) {
+            sockaddr_in addr{};
+            socklen_t addrlen = sizeof(addr);
+            int client = accept4(fd, (sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+                break;
             }
+            if (kind == FD_VIDEO_LISTEN) place_video_client(server, client, EPOLL_CTL_ADD);
+            else place_input_client(server, client, addr, EPOLL_CTL_ADD);
+        }
+        break;
+    case FD_UDP:
+        read_udp(server);
+        break;
+    case FD_LOBBY_VIDEO: {
+        char buf[256];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR))) break;
+        std::cout << "[INFO] Waiting video client left\n";
+        close_lobby_client(server.video_lobby, fd);
+        break;
+    }
+    case FD_LOBBY_INPUT: {
+        auto it = std::find_if(server.input_lobby.begin(), server.input_lobby.end(),
+                               [&](const LobbyClient& c) { return c.fd == fd; });
+        if (it == server.input_lobby.end() || read_lobby_input(*it)) break;
+        std::cout << "[INPUT] Waiting client left\n";
+        close_lobby_client(server.input_lobby, fd);
+        break;
+    }
+    case FD_VIEWER:
+    case FD_INPUT: {
+        auto it = server.fd_sessions.find(fd);
+        if (it == server.fd_sessions.end()) break;
+        Session& s = *it->second;
+        if (kind == FD_VIEWER) {
+            // Writability is handled by the output pump
+            if (hangup) remove_viewer(server, s, fd);
+        } else if (s.input_fd == fd) {
+            if (ev.events & EPOLLIN) read_input(server, s);
+            else if (hangup) drop_input(server, s);
+        }
+        break;
+    }
+    }
+}
+
+// --window: stream the first window whose title matches whenever it exists
+// and no session has it. Answered from the window index, so it is cheap
+// enough to ask on every pass.
+void stream_titled_window(Server& server) {
+    if (!server.windows.changed && !server.sessions.empty()) return;
+    server.windows.changed = false;
+    Window window = window_index_find_title(server.windows, config.window_title.c_str());
+    if (!window) return;
+    for (std::unique_ptr<Session>& s : server.sessions) {
+        if (s->window == window) return;
+    }
+    if (config.max_sessions && server.sessions.size() >= config.max_sessions) return;
+    std::cout << "[INFO] Window " << window << " matches \"" << config.window_title << "\"\n";
+    start_session(server, window);
+}
+
+bool has_udp_clients(Server& server) {
+    if (!server.udp_lobby.empty()) return true;
+    return std::any_of(server.sessions.begin(), server.sessions.end(),
+                       [](const std::unique_ptr<Session>& s) { return s->udp != nullptr; });
+}
 
-            std::cout << "[INFO] Client connected, starting stream...\n";
-            stream_window(dpy, active_win, client_socket);
-            close(client_socket);
+// Wait no longer than the next capture deadline, the end of an edge hold or
+// the next UDP timeout check; with nothing going on, wait for an event. A
+// capture that is due but waiting for a slot or queue room is woken by the
+// step that frees it.
+int loop_timeout(Server& server) {
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = std::min(edge_watcher_deadline(server.edge), cursor_tracker_deadline(server.cursor));
+    if (has_udp_clients(server)) deadline = std::min(deadline, server.next_udp_check);
+    for (std::unique_ptr<Session>& s : server.sessions) {
+        if (s->closing || !has_output(*s)) continue;
+        std::lock_guard<std::mutex> lock(s->mutex);
+        if (!s->busy[STAGE_CAPTURE] && s->next_capture > now) deadline = std::min(deadline, s->next_capture);
+    }
+    if (deadline == std::chrono::steady_clock::time_point::max()) return -1;
+    if (deadline <= now) return 0;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+    return (int)std::min<long long>(wait.count() + 1, 60 * 60 * 1000);
+}
 
-            std::cout << "[INFO] Stream ended. Watching for next edge drag...\n";
+void serve(Server& server) {
+    epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        // Each helper's fd only wakes the loop for bytes still in the socket.
+        // Xlib may already have read and queued events while waiting for a
+        // reply to a request, and those would sit unhandled until the next
+        // event arrived, so drain every helper's queue on each pass.
+        edge_watcher_dispatch(server.edge);
+        cursor_tracker_dispatch(server.cursor);
+        window_index_dispatch(server.windows);
+        int n = epoll_wait(server.epoll_fd, events, MAX_EVENTS, loop_timeout(server));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return;
+        }
+        for (int i = 0; i < n; i++) handle_event(server, events[i]);
+
+        auto now = std::chrono::steady_clock::now();
+        if (edge_watcher_check(server.edge, now)) edge_drag_detected(server);
+        cursor_tracker_check(server.cursor, now);
+        if (!config.window_title.empty()) stream_titled_window(server);
+        if (now >= server.next_udp_check && has_udp_clients(server)) {
+            server.next_udp_check = now + std::chrono::milliseconds(UDP_HELLO_INTERVAL_MS);
+            expire_udp_clients(server);
         }
+        service_sessions(server);
+    }
+}
 
-        usleep(100000); // 100 ms delay
+// Non-blocking TCP listener on `port`, or -1
+int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket failed");
+        return -1;
     }
 
-    close(server_fd);
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt));
+
+    struct sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        perror("bind failed");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, LISTEN_BACKLOG) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// A window that goes away mid-capture must end its own session, not the
+// server: log X errors instead of exiting
+int log_x_error(Display* dpy, XErrorEvent* ev) {
+    char text[256];
+    XGetErrorText(dpy, ev->error_code, text, sizeof(text));
+    std::cerr << "[X] " << text << " (request " << (int)ev->request_code << ")\n";
+    return 0;
+}
+
+void print_usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [options]\n"
+              << "  --queue-depth N           frames buffered between pipeline stages (default " << QUEUE_DEPTH << ")\n"
+              << "  --drop-policy P           block | drop-oldest (default drop-oldest)\n"
+              << "  --fps N                   frame rate while the window changes (default " << TARGET_FPS << ")\n"
+              << "  --min-fps N               idle frame rate (default " << MIN_FPS << ")\n"
+              << "  --max-fps N               frame rate right after input (default " << MAX_FPS << ")\n"
+              << "  --target-latency MS       adapt quality to keep the send backlog under MS (default off)\n"
+              << "  --adaptive-scale          also lower the output resolution when quality bottoms out\n"
+              << "  --min-scale S             smallest output scale for --adaptive-scale (default 0.5)\n"
+              << "  --no-fit-viewport         stream at window size even to clients showing it smaller\n"
+              << "  --encode-threads N        JPEG encoder threads, 0 for one per core (default 1)\n"
+              << "  --input-mode M            fast | legacy input injection (default fast)\n"
+              << "  --transport T             tcp | udp video transport (default tcp)\n"
+              << "  --fec K                   UDP: one XOR parity packet per K data packets (default off)\n"
+              << "  --udp-loss P              UDP: drop P percent of sent packets, for testing\n"
+              << "  --broadcast               share one capture and encode among all TCP viewers\n"
+              << "  --viewer-queue N          frames a broadcast viewer may fall behind (default " << VIEWER_QUEUE_DEPTH << ")\n"
+              << "  --workers N               threads running the pipelines of all sessions (default " << SERVER_WORKERS << ")\n"
+              << "  --max-sessions N          windows streamed at once, 0 for no limit (default 0)\n"
+              << "  --window TITLE            stream the window whose title contains TITLE, no edge drag needed\n"
+              << "  --stats-interval S        print pipeline stats every S seconds, 0 for never (default " << STATS_INTERVAL_S << ")\n"
+              << "  --trace FILE              write every pipeline step to FILE as a Chrome trace (chrome://tracing)\n"
+#ifdef WITH_AVCODEC
+              << "  --encoder E               jpeg | h264 (default jpeg)\n"
+              << "  --gop N                   H.264 keyframe interval in frames (default " << H264_GOP << ")\n"
+#endif
+              ;
+}
+
+// Returns false on a bad or unknown option
+bool parse_args(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--queue-depth" && has_value) {
+            config.queue_depth = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--drop-policy" && has_value) {
+            std::string policy = argv[++i];
+            if (policy == "block") config.drop_policy = QueuePolicy::Block;
+            else if (policy == "drop-oldest") config.drop_policy = QueuePolicy::DropOldest;
+            else return false;
+        } else if (arg == "--fps" && has_value) {
+            config.target_fps = std::max(1.0, atof(argv[++i]));
+        } else if (arg == "--min-fps" && has_value) {
+            config.min_fps = std::max(0.1, atof(argv[++i]));
+        } else if (arg == "--max-fps" && has_value) {
+            config.max_fps = std::max(1.0, atof(argv[++i]));
+        } else if (arg == "--target-latency" && has_value) {
+            config.target_latency_ms = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--adaptive-scale") {
+            config.adaptive_scale = true;
+        } else if (arg == "--min-scale" && has_value) {
+            config.min_scale = std::min(1.0, std::max(0.1, atof(argv[++i])));
+        } else if (arg == "--no-fit-viewport") {
+            config.fit_viewport = false;
+        } else if (arg == "--encode-threads" && has_value) {
+            config.encode_threads = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--input-mode" && has_value) {
+            std::string mode = argv[++i];
+            if (mode == "fast") config.input_mode = InputMode::Fast;
+            else if (mode == "legacy") config.input_mode = InputMode::Legacy;
+            else return false;
+        } else if (arg == "--transport" && has_value) {
+            std::string transport = argv[++i];
+            if (transport == "tcp") config.transport = Transport::Tcp;
+            else if (transport == "udp") config.transport = Transport::Udp;
+            else return false;
+        } else if (arg == "--fec" && has_value) {
+            config.fec_group = std::min(255, std::max(0, atoi(argv[++i])));
+        } else if (arg == "--udp-loss" && has_value) {
+            config.udp_loss = std::min(100.0, std::max(0.0, atof(argv[++i]))) / 100.0;
+        } else if (arg == "--broadcast") {
+            config.broadcast = true;
+        } else if (arg == "--viewer-queue" && has_value) {
+            config.viewer_queue = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--workers" && has_value) {
+            config.workers = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--max-sessions" && has_value) {
+            config.max_sessions = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--window" && has_value) {
+            config.window_title = argv[++i];
+        } else if (arg == "--stats-interval" && has_value) {
+            config.stats_interval_s = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--trace" && has_value) {
+            config.trace_path = argv[++i];
+#ifdef WITH_AVCODEC
+        } else if (arg == "--encoder" && has_value) {
+            std::string encoder = argv[++i];
+            if (encoder == "jpeg") config.encoder = EncoderType::Jpeg;
+            else if (encoder == "h264") config.encoder = EncoderType::H264;
+            else return false;
+        } else if (arg == "--gop" && has_value) {
+            config.gop = std::max(1, atoi(argv[++i]));
+#endif
+        } else {
+            return false;
+        }
+    }
+    // Broadcast fans out over TCP connections
+    if (config.broadcast && config.transport == Transport::Udp) return false;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (!parse_args(argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!config.trace_path.empty()) {
+        if (!trace_open(trace, config.trace_path.c_str())) return 1;
+        std::cout << "[INFO] Tracing pipeline steps to " << config.trace_path << "\n";
+    }
+
+    // Capture steps, legacy input and the event loop all talk to the same
+    // connection
+    XInitThreads();
+    Display* dpy = XOpenDisplay(nullptr);
+    if (!dpy) {
+        std::cerr << "Cannot open display\n";
+        return 1;
+    }
+
+    int composite_event_base, composite_error_base;
+    if (!XCompositeQueryExtension(dpy, &composite_event_base, &composite_error_base)) {
+        std::cerr << "XComposite extension not available\n";
+        XCloseDisplay(dpy);
+        return 1;
+    }
+    XSetErrorHandler(log_x_error);
+
+    Server server;
+    server.dpy = dpy;
+    if (!edge_watcher_open(server.edge, DisplayString(dpy))) return 1;
+    if (!cursor_tracker_open(server.cursor, DisplayString(dpy))) return 1;
+    if (!window_index_open(server.windows, DisplayString(dpy))) {
+        std::cerr << "Cannot open display\n";
+        return 1;
+    }
+    std::cout << "[INFO] Indexed " << server.windows.windows.size() << " windows\n";
+
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server.epoll_fd < 0 || server.wake_fd < 0) {
+        perror("epoll");
+        return 1;
+    }
+    watch_fd(server, EPOLL_CTL_ADD, server.wake_fd, FD_WAKE, EPOLLIN);
+    watch_fd(server, EPOLL_CTL_ADD, edge_watcher_fd(server.edge), FD_EDGE, EPOLLIN);
+    if (cursor_tracker_available(server.cursor)) {
+        watch_fd(server, EPOLL_CTL_ADD, cursor_tracker_fd(server.cursor), FD_CURSOR, EPOLLIN);
+    }
+    watch_fd(server, EPOLL_CTL_ADD, window_index_fd(server.windows), FD_WINDOWS, EPOLLIN);
+
+    if (config.transport == Transport::Udp) {
+        server.udp_fd = udp_socket_open(PORT);
+        if (server.udp_fd < 0) return 1;
+        watch_fd(server, EPOLL_CTL_ADD, server.udp_fd, FD_UDP, EPOLLIN);
+    } else {
+        server.video_fd = listen_on(PORT);
+        if (server.video_fd < 0) return 1;
+        watch_fd(server, EPOLL_CTL_ADD, server.video_fd, FD_VIDEO_LISTEN, EPOLLIN);
+    }
+    server.input_fd = listen_on(INPUT_PORT);
+    if (server.input_fd < 0) return 1;
+    watch_fd(server, EPOLL_CTL_ADD, server.input_fd, FD_INPUT_LISTEN, EPOLLIN);
+    std::cout << "[INPUT] Listening on port " << INPUT_PORT << "...\n";
+
+    server.encode_pool.reset(new ThreadPool(config.encode_threads));
+    if (server.encode_pool->size() > 1) {
+        std::cout << "[INFO] JPEG encoding on " << server.encode_pool->size() << " threads\n";
+    }
+    // The loop thread only schedules, so the pool gets `workers` threads of
+    // its own
+    server.stages.reset(new ThreadPool(config.workers + 1));
+    std::cout << "[INFO] " << config.workers << " pipeline workers\n";
+
+    std::cout << "Watching for windows dragged to screen edge...\n";
+    serve(server);
+
+    // Let queued steps finish, then free whatever is left
+    server.stages.reset();
+    while (!server.sessions.empty()) end_session(server, server.sessions.size() - 1);
+    for (LobbyClient& client : server.video_lobby) close(client.fd);
+    for (LobbyClient& client : server.input_lobby) close(client.fd);
+    if (server.video_fd >= 0) close(server.video_fd);
+    if (server.udp_fd >= 0) close(server.udp_fd);
+    close(server.input_fd);
+    close(server.wake_fd);
+    close(server.epoll_fd);
+    edge_watcher_close(server.edge);
+    cursor_tracker_close(server.cursor);
+    window_index_close(server.windows);
     XCloseDisplay(dpy);
+    trace_close(trace);
     return 0;
 }
@@ -0,0 +1,184 @@
+#pragma once
+
+// Follows the pointer's shape and movement for the cursor channel, so
+// clients draw the cursor themselves (input_protocol.h, version 4). The
+// window pixmaps the server captures never contain the cursor, and a
+// cursor drawn into frames would cost an encode per move.
+//
+// Like the edge watcher, the tracker has its own display connection whose
+// fd the event loop waits on. XFixes reports every change of the cursor
+// shape along with the new shape's serial; each serial's image is fetched
+// once and kept, ready encoded for the wire, in a small cache. XInput2 raw
+// motion says when the pointer moved, and each session then asks where it
+// is relative to its window. Without XInput 2.2 the tracker polls every
+// CURSOR_POLL_MS instead, but only while some client takes the cursor.
+// Without XFixes there is no cursor channel.
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/XInput2.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include "../common/input_protocol.h"
+
+#define CURSOR_POLL_MS 16           // pointer poll interval without XInput2
+#define CURSOR_SHAPES_KEPT 64       // shapes cached by serial
+
+// One cursor image as an INPUT_MSG_CURSOR_SHAPE message, length included
+struct CachedCursor {
+    uint32_t serial = 0;
+    std::vector<uint8_t> msg;
+};
+
+struct CursorTracker {
+    using clock = std::chrono::steady_clock;
+
+    Display* dpy = nullptr;         // private connection, null without XFixes
+    Window root = 0;
+    int xfixes_event = 0;           // XFixes event base
+    int xi_opcode = -1;             // -1: polling
+    bool wanted = false;            // some client takes the cursor; set by the server
+
+    uint32_t serial = 0;            // shape showing now
+    // Bumped whenever the shape changed or the pointer may have moved;
+    // sessions compare it to the count they last sent
+    uint64_t changes = 1;
+    std::deque<CachedCursor> shapes; // newest last
+    clock::time_point next_poll{};
+};
+
+// The cached shape with `serial`, or null
+inline const CachedCursor* cursor_tracker_shape(const CursorTracker& t, uint32_t serial) {
+    for (auto it = t.shapes.rbegin(); it != t.shapes.rend(); ++it) {
+        if (it->serial == serial) return &*it;
+    }
+    return nullptr;
+}
+
+// Make the current cursor the tracked one, fetching its image unless that
+// serial is cached already
+inline void cursor_tracker_fetch(CursorTracker& t) {
+    XFixesCursorImage* image = XFixesGetCursorImage(t.dpy);
+    if (!image) return;
+    t.serial = (uint32_t)image->cursor_serial;
+    if (!cursor_tracker_shape(t, t.serial)) {
+        // Pixels come as one 32-bit ARGB value per unsigned long
+        size_t count = (size_t)image->width * image->height;
+        std::vector<uint8_t> bgra(count * 4);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t p = (uint32_t)image->pixels[i];
+            bgra[i * 4] = (uint8_t)p;
+            bgra[i * 4 + 1] = (uint8_t)(p >> 8);
+            bgra[i * 4 + 2] = (uint8_t)(p >> 16);
+            bgra[i * 4 + 3] = (uint8_t)(p >> 24);
+        }
+        CachedCursor shape;
+        shape.serial = t.serial;
+        input_encode_cursor_shape(t.serial, image->width, image->height, image->xhot, image->yhot,
+                                  bgra.data(), shape.msg);
+        t.shapes.push_back(std::move(shape));
+        if (t.shapes.size() > CURSOR_SHAPES_KEPT) t.shapes.pop_front();
+    }
+    XFree(image);
+}
+
+// Open the tracker's connection. False only if the display can't be
+// opened; a server without XFixes just gets no cursor channel.
+inline bool cursor_tracker_open(CursorTracker& t, const char* display_name) {
+    t.dpy = XOpenDisplay(display_name);
+    if (!t.dpy) {
+        std::cerr << "[CURSOR] Cannot open display connection\n";
+        return false;
+    }
+    t.root = DefaultRootWindow(t.dpy);
+
+    int error;
+    if (!XFixesQueryExtension(t.dpy, &t.xfixes_event, &error)) {
+        std::cerr << "[CURSOR] XFixes not available, clients get no cursor\n";
+        XCloseDisplay(t.dpy);
+        t.dpy = nullptr;
+        return true;
+    }
+    XFixesSelectCursorInput(t.dpy, t.root, XFixesDisplayCursorNotifyMask);
+
+    int event, major = 2, minor = 2;
+    if (!XQueryExtension(t.dpy, "XInputExtension", &t.xi_opcode, &event, &error) ||
+        XIQueryVersion(t.dpy, &major, &minor) != Success) {
+        std::cerr << "[CURSOR] XInput 2.2 not available, polling the pointer every " << CURSOR_POLL_MS << "ms\n";
+        t.xi_opcode = -1;
+    } else {
+        unsigned char bits[XIMaskLen(XI_LASTEVENT)] = {};
+        XISetMask(bits, XI_RawMotion);
+        XIEventMask mask;
+        mask.deviceid = XIAllMasterDevices;
+        mask.mask_len = sizeof(bits);
+        mask.mask = bits;
+        XISelectEvents(t.dpy, t.root, &mask, 1);
+    }
+    cursor_tracker_fetch(t);
+    XFlush(t.dpy);
+    return true;
+}
+
+inline void cursor_tracker_close(CursorTracker& t) {
+    if (t.dpy) XCloseDisplay(t.dpy);
+    t = CursorTracker{};
+}
+
+inline bool cursor_tracker_available(const CursorTracker& t) {
+    return t.dpy != nullptr;
+}
+
+// The fd to wait on for events
+inline int cursor_tracker_fd(const CursorTracker& t) {
+    return ConnectionNumber(t.dpy);
+}
+
+// Handle whatever events have arrived, without blocking: note shape changes,
+// fetching a new shape once per burst, and count moves
+inline void cursor_tracker_dispatch(CursorTracker& t) {
+    if (!t.dpy) return;
+    bool changed = false;
+    bool new_shape = false;
+    while (XPending(t.dpy)) {
+        XEvent ev;
+        XNextEvent(t.dpy, &ev);
+        if (ev.type == t.xfixes_event + XFixesCursorNotify) {
+            const XFixesCursorNotifyEvent* notify = (const XFixesCursorNotifyEvent*)&ev;
+            t.serial = (uint32_t)notify->cursor_serial;
+            new_shape |= !cursor_tracker_shape(t, t.serial);
+            changed = true;
+        } else if (ev.xcookie.type == GenericEvent && ev.xcookie.extension == t.xi_opcode &&
+                   ev.xcookie.evtype == XI_RawMotion) {
+            changed = true;
+        }
+    }
+    // One fetch for a whole burst of shape changes
+    if (new_shape) cursor_tracker_fetch(t);
+    if (changed) t.changes++;
+}
+
+// When cursor_tracker_check() next has something to do
+inline CursorTracker::clock::time_point cursor_tracker_deadline(const CursorTracker& t) {
+    if (!t.dpy || t.xi_opcode >= 0 || !t.wanted) return CursorTracker::clock::time_point::max();
+    return t.next_poll;
+}
+
+// Polling without XInput2: count a possible move every CURSOR_POLL_MS
+inline void cursor_tracker_check(CursorTracker& t, CursorTracker::clock::time_point now) {
+    if (!t.dpy || t.xi_opcode >= 0 || !t.wanted || now < t.next_poll) return;
+    t.next_poll = now + std::chrono::milliseconds(CURSOR_POLL_MS);
+    t.changes++;
+}
+
+// Where the pointer is relative to `window`. False if it is on another
+// screen, or the window is gone.
+inline bool cursor_tracker_locate(CursorTracker& t, Window window, int& x, int& y) {
+    Window ret_root, ret_child;
+    int root_x, root_y;
+    unsigned int mask;
+    return XQueryPointer(t.dpy, window, &ret_root, &ret_child, &root_x, &root_y, &x, &y, &mask);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Tracks which parts of a redirected window changed since the last frame,
+// using XDamage. Damage is accumulated by the server and pulled once per frame
+// with XDamageSubtract, so there is no event round-trip per change.
+struct DamageTracker {
+    Display* dpy = nullptr;
+    Window window = 0;
+    Damage damage = 0;
+    XserverRegion region = 0;
+    int event_base = 0;
+    bool available = false;
+};
+
+inline bool damage_tracker_init(DamageTracker& tracker, Display* dpy, Window window) {
+    tracker.dpy = dpy;
+    tracker.window = window;
+
+    int error_base;
+    if (!XDamageQueryExtension(dpy, &tracker.event_base, &error_base)) {
+        std::cerr << "[WARN] XDamage not available, sending full frames\n";
+        tracker.available = false;
+        return false;
+    }
+
+    tracker.damage = XDamageCreate(dpy, window, XDamageReportNonEmpty);
+    tracker.region = XFixesCreateRegion(dpy, nullptr, 0);
+    tracker.available = true;
+    return true;
+}
+
+// Append the rectangles damaged since the last call (window coordinates) and
+// reset the accumulated damage.
+inline void damage_tracker_collect(DamageTracker& tracker, std::vector<XRectangle>& rects) {
+    if (!tracker.available) return;
+
+    // Drop the notify events; the region itself is what we care about
+    XEvent ev;
+    while (XCheckTypedWindowEvent(tracker.dpy, tracker.window, tracker.event_base + XDamageNotify, &ev)) {
+    }
+
+    XDamageSubtract(tracker.dpy, tracker.damage, None, tracker.region);
+
+    int count = 0;
+    XRectangle* parts = XFixesFetchRegion(tracker.dpy, tracker.region, &count);
+    if (parts) {
+        rects.insert(rects.end(), parts, parts + count);
+        XFree(parts);
+    }
+}
+
+inline void damage_tracker_release(DamageTracker& tracker) {
+    if (!tracker.available) return;
+    XDamageDestroy(tracker.dpy, tracker.damage);
+    XFixesDestroyRegion(tracker.dpy, tracker.region);
+    tracker.available = false;
+}
+
+// Snap damaged rectangles to a grid of `tile_size` tiles and return the dirty
+// area as rectangles, merging horizontally adjacent tiles of the same row so
+// each run is encoded as one JPEG.
+inline void build_dirty_tiles(const std::vector<XRectangle>& rects, int width, int height,
+                              int tile_size, std::vector<cv::Rect>& out) {
+    int cols = (width + tile_size - 1) / tile_size;
+    int rows = (height + tile_size - 1) / tile_size;
+    if (cols <= 0 || rows <= 0) return;
+    std::vector<uint8_t> dirty(cols * rows, 0);
+
+    for (const XRectangle& r : rects) {
+        int x0 = std::max<int>(r.x, 0);
+        int y0 = std::max<int>(r.y, 0);
+        int x1 = std::min<int>(r.x + r.width, width);
+        int y1 = std::min<int>(r.y + r.height, height);
+        if (x0 >= x1 || y0 >= y1) continue;
+        for (int ty = y0 / tile_size; ty <= (y1 - 1) / tile_size; ty++)
+            for (int tx = x0 / tile_size; tx <= (x1 - 1) / tile_size; tx++)
+                dirty[ty * cols + tx] = 1;
+    }
+
+    for (int ty = 0; ty < rows; ty++) {
+        int tx = 0;
+        while (tx < cols) {
+            if (!dirty[ty * cols + tx]) {
+                tx++;
+                continue;
+            }
+            int start = tx;
+            while (tx < cols && dirty[ty * cols + tx]) tx++;
+
+            int x = start * tile_size;
+            int y = ty * tile_size;
+            int w = std::min(tx * tile_size, width) - x;
+            int h = std::min(y + tile_size, height) - y;
+            out.emplace_back(x, y, w, h);
+        }
+    }
+}
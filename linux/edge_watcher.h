@@ -0,0 +1,157 @@
+#pragma once
+
+// Detects a window being held against a screen edge, the gesture that
+// starts a session.
+//
+// The watcher listens for XInput2 raw button and motion events on its own
+// display connection, whose fd the server's event loop waits on, so an idle
+// desktop costs no wakeups at all. Raw events reach the root window whatever
+// client has the pointer or a grab (a window being dragged), but carry no
+// screen position, so the pointer is queried on motion only while button 1
+// is down. Once it reaches an edge, edge_watcher_deadline() tells the loop
+// when the hold time is up and edge_watcher_check() fires right then.
+//
+// Without XInput 2.2 the watcher polls the pointer every EDGE_POLL_MS, like
+// the server always used to.
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XInput2.h>
+#include <chrono>
+#include <iostream>
+
+#define EDGE_POLL_MS 100            // pointer poll interval without XInput2
+#define EDGE_HOLD_MS 2000           // time at the edge that starts a session
+
+struct EdgeWatcher {
+    using clock = std::chrono::steady_clock;
+
+    Display* dpy = nullptr;         // private connection, owned by the watcher
+    Window root = 0;
+    int xi_opcode = -1;             // -1: polling
+    int screen_width = 0;
+    int screen_height = 0;
+
+    bool pressed = false;           // button 1 down
+    bool at_edge = false;           // and the pointer at an edge since edge_since
+    clock::time_point edge_since{};
+    clock::time_point next_poll{};
+};
+
+// Look at the pointer. `use_mask` takes the button state from the reply;
+// with raw events it comes from the events instead.
+inline void edge_watcher_sample(EdgeWatcher& w, bool use_mask) {
+    Window ret_root, ret_child;
+    int root_x, root_y, win_x, win_y;
+    unsigned int mask;
+    if (!XQueryPointer(w.dpy, w.root, &ret_root, &ret_child, &root_x, &root_y, &win_x, &win_y, &mask)) return;
+
+    if (use_mask) w.pressed = mask & Button1Mask;
+    bool at_edge = w.pressed && (root_x <= 1 || root_y <= 1 ||
+                                 root_x >= w.screen_width - 1 || root_y >= w.screen_height - 1);
+    if (at_edge && !w.at_edge) w.edge_since = EdgeWatcher::clock::now();
+    w.at_edge = at_edge;
+}
+
+inline bool edge_watcher_open(EdgeWatcher& w, const char* display_name) {
+    w.dpy = XOpenDisplay(display_name);
+    if (!w.dpy) {
+        std::cerr << "[EDGE] Cannot open display connection\n";
+        return false;
+    }
+    w.root = DefaultRootWindow(w.dpy);
+    w.screen_width = DisplayWidth(w.dpy, DefaultScreen(w.dpy));
+    w.screen_height = DisplayHeight(w.dpy, DefaultScreen(w.dpy));
+
+    int event, error, major = 2, minor = 2;
+    if (!XQueryExtension(w.dpy, "XInputExtension", &w.xi_opcode, &event, &error) ||
+        XIQueryVersion(w.dpy, &major, &minor) != Success) {
+        std::cerr << "[EDGE] XInput 2.2 not available, polling the pointer every " << EDGE_POLL_MS << "ms\n";
+        w.xi_opcode = -1;
+        return true;
+    }
+
+    unsigned char bits[XIMaskLen(XI_LASTEVENT)] = {};
+    XISetMask(bits, XI_RawButtonPress);
+    XISetMask(bits, XI_RawButtonRelease);
+    XISetMask(bits, XI_RawMotion);
+    XIEventMask mask;
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof(bits);
+    mask.mask = bits;
+    XISelectEvents(w.dpy, w.root, &mask, 1);
+    XFlush(w.dpy);
+
+    // In case the button is already down
+    edge_watcher_sample(w, true);
+    return true;
+}
+
+inline void edge_watcher_close(EdgeWatcher& w) {
+    if (w.dpy) XCloseDisplay(w.dpy);
+    w = EdgeWatcher{};
+}
+
+// The fd to wait on for events
+inline int edge_watcher_fd(const EdgeWatcher& w) {
+    return ConnectionNumber(w.dpy);
+}
+
+// Handle whatever raw events have arrived, without blocking
+inline void edge_watcher_dispatch(EdgeWatcher& w) {
+    if (w.xi_opcode < 0) return;
+    bool moved = false;
+    while (XPending(w.dpy)) {
+        XEvent ev;
+        XNextEvent(w.dpy, &ev);
+        XGenericEventCookie* cookie = &ev.xcookie;
+        if (cookie->type != GenericEvent || cookie->extension != w.xi_opcode || !XGetEventData(w.dpy, cookie)) {
+            continue;
+        }
+        const XIRawEvent* raw = (const XIRawEvent*)cookie->data;
+        switch (cookie->evtype) {
+        case XI_RawButtonPress:
+            if (raw->detail == 1) {
+                w.pressed = true;
+                moved = true;
+            }
+            break;
+        case XI_RawButtonRelease:
+            if (raw->detail == 1) {
+                w.pressed = false;
+                w.at_edge = false;
+                moved = false;
+            }
+            break;
+        case XI_RawMotion:
+            if (w.pressed) moved = true;
+            break;
+        }
+        XFreeEventData(w.dpy, cookie);
+    }
+    // One query for a whole burst of motion
+    if (moved && w.pressed) edge_watcher_sample(w, false);
+}
+
+// When edge_watcher_check() next has something to do
+inline EdgeWatcher::clock::time_point edge_watcher_deadline(const EdgeWatcher& w) {
+    if (w.xi_opcode < 0) return w.next_poll;
+    if (w.at_edge) return w.edge_since + std::chrono::milliseconds(EDGE_HOLD_MS);
+    return EdgeWatcher::clock::time_point::max();
+}
+
+// True once the pointer has been held at an edge for EDGE_HOLD_MS. Holding
+// on fires again after another EDGE_HOLD_MS.
+inline bool edge_watcher_check(EdgeWatcher& w, EdgeWatcher::clock::time_point now) {
+    if (w.xi_opcode < 0) {
+        if (now < w.next_poll) return false;
+        w.next_poll = now + std::chrono::milliseconds(EDGE_POLL_MS);
+        edge_watcher_sample(w, true);
+    }
+    if (!w.at_edge || now - w.edge_since < std::chrono::milliseconds(EDGE_HOLD_MS)) return false;
+
+    // A release may have been missed; make sure the button is still down
+    edge_watcher_sample(w, true);
+    if (!w.at_edge) return false;
+    w.edge_since = now;
+    return true;
+}
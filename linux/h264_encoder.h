@@ -0,0 +1,128 @@
+#pragma once
+
+// In-process H.264 encoder (libx264 through libavcodec) for the composite
+// capture path. Tuned like the ffmpeg pipeline in cmd_on_linux.txt:
+// ultrafast preset, zerolatency tune, no B-frames, so every captured frame
+// comes back out as exactly one Annex B access unit.
+//
+// Only built with -DWITH_AVCODEC.
+
+#ifdef WITH_AVCODEC
+
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+}
+
+struct H264Encoder {
+    AVCodecContext* ctx = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    int width = 0;          // encoded size, always even
+    int height = 0;
+    int64_t next_pts = 0;
+    int quality = -1;       // last value passed to h264_set_quality
+};
+
+inline void h264_encoder_close(H264Encoder& enc) {
+    if (enc.ctx) avcodec_free_context(&enc.ctx);
+    if (enc.frame) av_frame_free(&enc.frame);
+    if (enc.packet) av_packet_free(&enc.packet);
+    enc.width = enc.height = 0;
+}
+
+// Open an encoder for width x height input (rounded up to even for 4:2:0)
+inline bool h264_encoder_open(H264Encoder& enc, int width, int height, int gop, int fps) {
+    h264_encoder_close(enc);
+
+    const AVCodec* codec = avcodec_find_encoder_by_name("libx264");
+    if (!codec) codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (!codec) {
+        std::cerr << "[H264] No H.264 encoder available\n";
+        return false;
+    }
+
+    enc.width = (width + 1) & ~1;
+    enc.height = (height + 1) & ~1;
+
+    enc.ctx = avcodec_alloc_context3(codec);
+    enc.ctx->width = enc.width;
+    enc.ctx->height = enc.height;
+    enc.ctx->time_base = AVRational{1, fps};
+    enc.ctx->framerate = AVRational{fps, 1};
+    enc.ctx->gop_size = gop;
+    enc.ctx->max_b_frames = 0;
+    enc.ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc.ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    av_opt_set(enc.ctx->priv_data, "preset", "ultrafast", 0);
+    av_opt_set(enc.ctx->priv_data, "tune", "zerolatency", 0);
+    av_opt_set(enc.ctx->priv_data, "profile", "baseline", 0);
+    // Turn requested I-frames into IDRs so a client can join on them
+    av_opt_set(enc.ctx->priv_data, "forced-idr", "1", 0);
+
+    if (avcodec_open2(enc.ctx, codec, nullptr) < 0) {
+        std::cerr << "[H264] Failed to open encoder\n";
+        h264_encoder_close(enc);
+        return false;
+    }
+
+    enc.frame = av_frame_alloc();
+    enc.frame->format = AV_PIX_FMT_YUV420P;
+    enc.frame->width = enc.width;
+    enc.frame->height = enc.height;
+    enc.packet = av_packet_alloc();
+    enc.next_pts = 0;
+    enc.quality = -1;
+
+    std::cout << "[H264] Encoder open " << enc.width << "x" << enc.height << " gop=" << gop << "\n";
+    return true;
+}
+
+// Map the 0-100 JPEG-style quality used by the quality controller onto
+// x264's CRF (lower is better). libx264 picks up CRF changes between frames.
+inline void h264_set_quality(H264Encoder& enc, int quality) {
+    if (quality == enc.quality) return;
+    enc.quality = quality;
+    double crf = 18 + (100 - quality) * 0.33;
+    av_opt_set_double(enc.ctx->priv_data, "crf", crf, 0);
+}
+
+// Encode one I420 picture (already enc.width x enc.height, planes Y, U, V
+// with their strides) and append the resulting access unit to `out`.
+// Returns false on encoder error.
+inline bool h264_encode(H264Encoder& enc, uint8_t* const planes[3], const int strides[3], bool force_idr,
+                        std::vector<uint8_t>& out, bool& is_key) {
+    // Point the frame at the caller's planes; libavcodec copies
+    // non-refcounted input if it needs to keep it.
+    for (int i = 0; i < 3; i++) {
+        enc.frame->data[i] = planes[i];
+        enc.frame->linesize[i] = strides[i];
+    }
+    enc.frame->pts = enc.next_pts++;
+    enc.frame->pict_type = force_idr ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+    if (avcodec_send_frame(enc.ctx, enc.frame) < 0) {
+        std::cerr << "[H264] avcodec_send_frame failed\n";
+        return false;
+    }
+
+    is_key = false;
+    while (true) {
+        int ret = avcodec_receive_packet(enc.ctx, enc.packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
+        if (ret < 0) {
+            std::cerr << "[H264] avcodec_receive_packet failed\n";
+            return false;
+        }
+        out.insert(out.end(), enc.packet->data, enc.packet->data + enc.packet->size);
+        if (enc.packet->flags & AV_PKT_FLAG_KEY) is_key = true;
+        av_packet_unref(enc.packet);
+    }
+    return true;
+}
+
+#endif // WITH_AVCODEC
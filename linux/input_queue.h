@@ -0,0 +1,72 @@
+#pragma once
+
+// Queue between the event loop, which reads and decodes the input socket,
+// and the session's input step, which injects the events with XTest.
+//
+// Clients send pointer motion at their own input rate (120 Hz and up while
+// dragging), which is more than is worth replaying. Consecutive motion
+// events are coalesced as they are queued, so each injection batch moves the
+// pointer once per run of motion, to its latest position. Button, key and
+// wheel events are never merged or dropped, and motion is never reordered
+// across them, so a drag still presses, moves and releases where the client
+// did. Coalescing only happens while the injector is busy; an idle injector
+// takes every event as it arrives.
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "../common/input_protocol.h"
+
+class InputQueue {
+public:
+    // `capacity` bounds the non-motion backlog. Neither side ever waits: a
+    // reader that fills the queue stops reading the client's socket until
+    // the input step has made room, which pushes back on the client.
+    explicit InputQueue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    // Queue events in order. Returns false once the backlog has reached
+    // capacity: the caller should stop reading until size() goes down.
+    bool push_nowait(const std::vector<InputEvent>& events) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const InputEvent& ev : events) {
+            if (!coalesce(ev)) events_.push_back(ev);
+        }
+        return events_.size() < capacity_;
+    }
+
+    // Take whatever is queued. Returns false if nothing was.
+    bool try_pop_all(std::vector<InputEvent>& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.clear();
+        if (events_.empty()) return false;
+        out.swap(events_);
+        return true;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return events_.size();
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    // Motion events merged into a later one so far
+    size_t coalesced() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return coalesced_;
+    }
+
+private:
+    // Merge `ev` into a trailing motion event; true if it was
+    bool coalesce(const InputEvent& ev) {
+        if (ev.type != INPUT_MOTION || events_.empty() || events_.back().type != INPUT_MOTION) return false;
+        events_.back() = ev;
+        coalesced_++;
+        return true;
+    }
+
+    std::vector<InputEvent> events_;
+    size_t capacity_;
+    size_t coalesced_ = 0;
+    std::mutex mutex_;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+// Input injection for one client session.
+//
+// The blocker window, the target's opacity and its focus are set up once
+// when the session starts and torn down when it ends, instead of around
+// every message. Focus and geometry are tracked from X events (FocusIn /
+// FocusOut, ConfigureNotify) on a private Display connection, so injecting
+// an event needs no sleeps and no round trips: XTest requests are queued and
+// flushed once per batch.
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XTest.h>
+#include <X11/keysym.h>
+#include <poll.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include "../common/input_protocol.h"
+
+struct InputSession {
+    Display* dpy = nullptr;         // private connection, owned by the session
+    Window window = 0;
+    Window root = 0;
+    Window blocker = 0;
+    Atom opacity_atom = None;
+    bool focused = false;
+    bool alive = false;             // target still exists
+    int origin_x = 0;               // window position on the root
+    int origin_y = 0;
+    unsigned buttons_down = 0;      // bit per button held by INPUT_BUTTON_DOWN
+};
+
+inline void input_session_set_opacity(InputSession& s, unsigned long opacity) {
+    if (s.opacity_atom == None) return;
+    XChangeProperty(s.dpy, s.window, s.opacity_atom, XA_CARDINAL, 32, PropModeReplace,
+                    (unsigned char*)&opacity, 1);
+}
+
+// Re-read the window position and keep the blocker over it
+inline void input_session_update_geometry(InputSession& s) {
+    XWindowAttributes attr;
+    if (!XGetWindowAttributes(s.dpy, s.window, &attr)) return;
+    Window dummy;
+    XTranslateCoordinates(s.dpy, s.window, s.root, 0, 0, &s.origin_x, &s.origin_y, &dummy);
+    if (s.blocker) XMoveResizeWindow(s.dpy, s.blocker, s.origin_x, s.origin_y, attr.width, attr.height);
+}
+
+// Handle whatever X events are queued, without blocking
+inline void input_session_pump(InputSession& s) {
+    bool moved = false;
+    while (XPending(s.dpy)) {
+        XEvent ev;
+        XNextEvent(s.dpy, &ev);
+        switch (ev.type) {
+        case FocusIn:
+            if (ev.xfocus.detail != NotifyPointer) s.focused = true;
+            break;
+        case FocusOut:
+            if (ev.xfocus.detail != NotifyPointer && ev.xfocus.detail != NotifyInferior) s.focused = false;
+            break;
+        case ConfigureNotify:
+            moved = true;
+            break;
+        case DestroyNotify:
+            s.alive = false;
+            break;
+        }
+    }
+    if (moved && s.alive) input_session_update_geometry(s);
+}
+
+// Make sure the target has focus, waiting at most timeout_ms for the
+// FocusIn. Returns false if it did not arrive in time.
+inline bool input_session_focus(InputSession& s, int timeout_ms) {
+    input_session_pump(s);
+    if (s.focused) return true;
+
+    XRaiseWindow(s.dpy, s.window);
+    XSetInputFocus(s.dpy, s.window, RevertToParent, CurrentTime);
+    XFlush(s.dpy);
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!s.focused && s.alive) {
+        int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) break;
+        pollfd pfd{ConnectionNumber(s.dpy), POLLIN, 0};
+        if (poll(&pfd, 1, left) > 0) input_session_pump(s);
+    }
+    return s.focused;
+}
+
+// Open the session's connection, put the blocker up and focus the target
+inline bool input_session_open(InputSession& s, const char* display_name, Window window) {
+    s.dpy = XOpenDisplay(display_name);
+    if (!s.dpy) {
+        std::cerr << "[INPUT] Cannot open input display connection\n";
+        return false;
+    }
+    s.window = window;
+    s.root = DefaultRootWindow(s.dpy);
+    s.opacity_atom = XInternAtom(s.dpy, "_NET_WM_WINDOW_OPACITY", False);
+    s.alive = true;
+
+    XSelectInput(s.dpy, window, FocusChangeMask | StructureNotifyMask);
+    Window focus;
+    int revert;
+    XGetInputFocus(s.dpy, &focus, &revert);
+    s.focused = focus == window;
+
+    XSetWindowAttributes wa;
+    wa.override_redirect = True;  // Prevent window manager interference
+    s.blocker = XCreateWindow(s.dpy, s.root, 0, 0, 1, 1, 0, 0, InputOnly, CopyFromParent,
+                              CWOverrideRedirect, &wa);
+    input_session_update_geometry(s);
+    XMapRaised(s.dpy, s.blocker);
+    input_session_set_opacity(s, 0x00000000);
+    XRaiseWindow(s.dpy, window);
+    XFlush(s.dpy);
+    std::cout << "[INPUT] Session blocker up\n";
+    return true;
+}
+
+inline void input_session_close(InputSession& s) {
+    if (!s.dpy) return;
+    // Don't leave a drag hanging if the client went away mid-drag
+    for (int button = 1; button < 32; button++) {
+        if (s.buttons_down & (1u << button)) XTestFakeButtonEvent(s.dpy, button, False, CurrentTime);
+    }
+    if (s.blocker) XDestroyWindow(s.dpy, s.blocker);
+    if (s.alive) {
+        input_session_set_opacity(s, 0xFFFFFFFF);
+        XSelectInput(s.dpy, s.window, NoEventMask);
+    }
+    XCloseDisplay(s.dpy);
+    s = InputSession{};
+}
+
+inline void input_session_button(InputSession& s, int button, int count) {
+    for (int i = 0; i < count; i++) {
+        XTestFakeButtonEvent(s.dpy, button, True, CurrentTime);
+        XTestFakeButtonEvent(s.dpy, button, False, CurrentTime);
+    }
+}
+
+// Map a frame coordinate back to the window, where `scale` is the output
+// size / window size. A downscaled frame pixel stands for several window
+// pixels; pick the middle one.
+inline int frame_to_window(int v, double scale) {
+    if (scale == 1.0) return v;
+    return (int)std::floor((v + 0.5) / scale);
+}
+
+// Queue one event. `scale` maps frame coordinates back to the window.
+// Returns false when the client asked to stop streaming (Escape).
+inline bool input_session_inject(InputSession& s, const InputEvent& ev, double scale) {
+    int screen = DefaultScreen(s.dpy);
+    int x = s.origin_x + frame_to_window(ev.x, scale);
+    int y = s.origin_y + frame_to_window(ev.y, scale);
+
+    switch (ev.type) {
+    case INPUT_CLICK:
+    case INPUT_DCLICK:
+        XTestFakeMotionEvent(s.dpy, screen, x, y, CurrentTime);
+        input_session_button(s, ev.button ? ev.button : 1, ev.type == INPUT_DCLICK ? 2 : 1);
+        break;
+    case INPUT_KEY_DOWN:
+    case INPUT_KEY_UP: {
+        if (ev.keysym == XK_Escape) {
+            if (ev.type == INPUT_KEY_UP) break;
+            std::cout << "[INPUT] Escape pressed, stopping output.\n";
+            return false;
+        }
+        KeyCode keycode = XKeysymToKeycode(s.dpy, ev.keysym);
+        if (!keycode) {
+            std::cerr << "[INPUT] No keycode for keysym 0x" << std::hex << ev.keysym << std::dec << "\n";
+            break;
+        }
+        XTestFakeKeyEvent(s.dpy, keycode, ev.type == INPUT_KEY_DOWN, CurrentTime);
+        break;
+    }
+    case INPUT_MOTION:
+        XTestFakeMotionEvent(s.dpy, screen, x, y, CurrentTime);
+        break;
+    case INPUT_BUTTON_DOWN:
+    case INPUT_BUTTON_UP: {
+        int button = ev.button && ev.button < 32 ? ev.button : 1;
+        XTestFakeMotionEvent(s.dpy, screen, x, y, CurrentTime);
+        XTestFakeButtonEvent(s.dpy, button, ev.type == INPUT_BUTTON_DOWN, CurrentTime);
+        if (ev.type == INPUT_BUTTON_DOWN) s.buttons_down |= 1u << button;
+        else s.buttons_down &= ~(1u << button);
+        break;
+    }
+    case INPUT_WHEEL:
+        // X reports wheel steps as buttons 4/5 (vertical) and 6/7 (horizontal)
+        XTestFakeMotionEvent(s.dpy, screen, x, y, CurrentTime);
+        input_session_button(s, ev.dy > 0 ? 4 : 5, std::abs(ev.dy));
+        input_session_button(s, ev.dx > 0 ? 7 : 6, std::abs(ev.dx));
+        break;
+    default:
+        std::cerr << "[INPUT] Unknown event type " << (int)ev.type << "\n";
+        break;
+    }
+    return true;
+}
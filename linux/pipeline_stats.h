@@ -0,0 +1,197 @@
+#pragma once
+
+// Where a session's frame time goes: a latency histogram per pipeline stage,
+// counters for frames, bytes and drops, and an optional Chrome trace.
+//
+// Histograms are log-linear like HdrHistogram: exact below 16us, then eight
+// buckets per power of two, so any reported value is within 12.5% of the
+// true one. Recording is a few relaxed atomic adds; the stage steps run on
+// worker threads while the event loop reads and resets the histograms for
+// the periodic dump.
+//
+// The trace is Chrome's trace event format (chrome://tracing, Perfetto): one
+// complete event per timed step, with the session as the process and the
+// worker as the thread. The closing bracket is optional in that format, so
+// a server that was killed leaves a usable trace of everything flushed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+#define HISTOGRAM_EXACT 16          // values below this get a bucket each
+#define HISTOGRAM_SUB_BITS 3        // 2^3 buckets per power of two above
+#define HISTOGRAM_MAX_EXP 36        // about 19 hours in microseconds
+// Exact buckets, the log-linear ones from 16us up, and one for anything longer
+#define HISTOGRAM_BUCKETS (HISTOGRAM_EXACT + (HISTOGRAM_MAX_EXP - 4) * (1 << HISTOGRAM_SUB_BITS) + 1)
+
+enum StatStage {
+    STAT_CAPTURE,
+    STAT_CONVERT,
+    STAT_ENCODE,
+    STAT_SEND,
+    STAT_INPUT,
+    STAT_COUNT
+};
+
+inline const char* stat_stage_name(int stage) {
+    static const char* names[STAT_COUNT] = {"capture", "convert", "encode", "send", "input"};
+    return names[stage];
+}
+
+struct LatencyHistogram {
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint64_t> max_us{0};
+};
+
+// What a histogram held when it was last taken
+struct HistogramSnapshot {
+    uint64_t buckets[HISTOGRAM_BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t max_us = 0;
+};
+
+inline int histogram_bucket(uint64_t us) {
+    if (us < HISTOGRAM_EXACT) return (int)us;
+    int exp = 63 - __builtin_clzll(us);
+    if (exp >= HISTOGRAM_MAX_EXP) return HISTOGRAM_BUCKETS - 1;
+    int sub = (int)(us >> (exp - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return HISTOGRAM_EXACT + (exp - 4) * (1 << HISTOGRAM_SUB_BITS) + sub;
+}
+
+// Highest value that lands in `bucket`
+inline uint64_t histogram_bucket_top(int bucket) {
+    if (bucket < HISTOGRAM_EXACT) return (uint64_t)bucket;
+    int exp = 4 + (bucket - HISTOGRAM_EXACT) / (1 << HISTOGRAM_SUB_BITS);
+    uint64_t sub = (uint64_t)((bucket - HISTOGRAM_EXACT) % (1 << HISTOGRAM_SUB_BITS));
+    uint64_t width = 1ull << (exp - HISTOGRAM_SUB_BITS);
+    return ((1ull << HISTOGRAM_SUB_BITS) + sub) * width + width - 1;
+}
+
+inline void histogram_record(LatencyHistogram& h, uint64_t us) {
+    h.buckets[histogram_bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = h.max_us.load(std::memory_order_relaxed);
+    while (us > seen && !h.max_us.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {
+    }
+}
+
+// Copy the histogram out and start it over
+inline void histogram_take(LatencyHistogram& h, HistogramSnapshot& out) {
+    out.count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        out.buckets[i] = h.buckets[i].exchange(0, std::memory_order_relaxed);
+        out.count += out.buckets[i];
+    }
+    out.max_us = h.max_us.exchange(0, std::memory_order_relaxed);
+}
+
+// Value at `fraction` (0..1) of the recorded values, in microseconds
+inline uint64_t histogram_percentile(const HistogramSnapshot& h, double fraction) {
+    if (!h.count) return 0;
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)(fraction * h.count + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h.buckets[i];
+        if (seen >= rank) return std::min(histogram_bucket_top(i), h.max_us);
+    }
+    return h.max_us;
+}
+
+struct TraceWriter {
+    std::mutex mutex;
+    FILE* file = nullptr;
+    bool empty = true;              // no event written yet, so no comma needed
+    std::chrono::steady_clock::time_point epoch{};
+};
+
+inline bool trace_open(TraceWriter& t, const char* path) {
+    t.file = fopen(path, "w");
+    if (!t.file) {
+        perror("trace file");
+        return false;
+    }
+    t.epoch = std::chrono::steady_clock::now();
+    fputs("[", t.file);
+    return true;
+}
+
+inline void trace_close(TraceWriter& t) {
+    std::lock_guard<std::mutex> lock(t.mutex);
+    if (!t.file) return;
+    fputs("\n]\n", t.file);
+    fclose(t.file);
+    t.file = nullptr;
+}
+
+inline void trace_flush(TraceWriter& t) {
+    std::lock_guard<std::mutex> lock(t.mutex);
+    if (t.file) fflush(t.file);
+}
+
+// Small stable number for the calling thread, for the trace's tid
+inline int trace_thread_id() {
+    static std::atomic<int> next{1};
+    thread_local int id = next++;
+    return id;
+}
+
+// Label the process row that `pid`'s events are shown in
+inline void trace_name_process(TraceWriter& t, int pid, const char* name) {
+    std::lock_guard<std::mutex> lock(t.mutex);
+    if (!t.file) return;
+    fprintf(t.file, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+            t.empty ? "" : ",", pid, name);
+    t.empty = false;
+}
+
+inline void trace_complete(TraceWriter& t, const char* name, int pid, std::chrono::steady_clock::time_point start,
+                           std::chrono::steady_clock::time_point end) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    long long ts = duration_cast<microseconds>(start - t.epoch).count();
+    long long dur = duration_cast<microseconds>(end - start).count();
+    int tid = trace_thread_id();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    if (!t.file) return;
+    fprintf(t.file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d}",
+            t.empty ? "" : ",", name, ts, dur, pid, tid);
+    t.empty = false;
+}
+
+// One session's numbers. Counters only go up; the dump keeps what it
+// printed last to show the change.
+struct PipelineStats {
+    int id = 0;                     // session, the pid in the trace
+    TraceWriter* trace = nullptr;   // null: not tracing
+    LatencyHistogram stages[STAT_COUNT];
+    // End to end, from the frame header and the client's display acks
+    LatencyHistogram capture_to_display;
+    LatencyHistogram input_to_frame;     // input arrived -> next frame grabbed
+    LatencyHistogram input_to_display;   // input arrived -> that frame shown
+
+    std::atomic<uint64_t> frames{0};            // captured
+    std::atomic<uint64_t> keyframes{0};
+    std::atomic<uint64_t> encoded{0};
+    std::atomic<uint64_t> encoded_bytes{0};
+    std::atomic<uint64_t> sent_bytes{0};
+    std::atomic<uint64_t> input_events{0};
+};
+
+inline void stats_record(PipelineStats& stats, StatStage stage, std::chrono::steady_clock::time_point start,
+                         std::chrono::steady_clock::time_point end) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    histogram_record(stats.stages[stage], (uint64_t)std::max<long long>(0, us));
+    if (stats.trace) trace_complete(*stats.trace, stat_stage_name(stage), stats.id, start, end);
+}
+
+// Times the rest of the enclosing scope as one step of `stage`
+struct StageTimer {
+    PipelineStats& stats;
+    StatStage stage;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    StageTimer(PipelineStats& stats, StatStage stage) : stats(stats), stage(stage) {}
+    ~StageTimer() { stats_record(stats, stage, start, std::chrono::steady_clock::now()); }
+};
@@ -0,0 +1,432 @@
+#pragma once
+
+// Pixel conversion kernels from X server image formats straight into the
+// encoder's input format, in a single pass over the capture buffer.
+//
+//   convert_to_bgr   packed BGR for the JPEG encoder
+//   convert_to_i420  planar 4:2:0 for H.264 (BT.601 limited range like
+//                    cv::COLOR_BGR2YUV_I420; chroma is the average of each
+//                    2x2 block)
+//
+// Each source format gets its own template instantiation, so the per-pixel
+// unpacking is resolved at compile time. Rows that are tightly packed on
+// both sides are converted as one long row. On x86 the 32bpp formats have
+// SSE4.1 and AVX2 kernels picked at runtime; everything else, and any CPU
+// without those, uses the scalar code.
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_CONVERT_X86 1
+#endif
+
+enum PixelFormat {
+    PIXEL_BGRX32,       // bytes B G R X   (32bpp, LSBFirst, red_mask 0xff0000) - the usual one
+    PIXEL_XRGB32,       // bytes X R G B   (32bpp, MSBFirst)
+    PIXEL_RGBX32,       // bytes R G B X   (32bpp, LSBFirst, red_mask 0xff)
+    PIXEL_BGR24,        // bytes B G R     (24bpp, LSBFirst)
+    PIXEL_RGB24,        // bytes R G B     (24bpp, MSBFirst)
+    PIXEL_RGB565_LE,    // 16bpp 5-6-5, little endian
+    PIXEL_RGB565_BE,    // 16bpp 5-6-5, big endian
+    PIXEL_UNSUPPORTED,
+};
+
+inline int pixel_format_bytes(PixelFormat fmt) {
+    switch (fmt) {
+    case PIXEL_BGRX32:
+    case PIXEL_XRGB32:
+    case PIXEL_RGBX32: return 4;
+    case PIXEL_BGR24:
+    case PIXEL_RGB24: return 3;
+    case PIXEL_RGB565_LE:
+    case PIXEL_RGB565_BE: return 2;
+    default: return 0;
+    }
+}
+
+// Per-format unpacking, resolved at compile time
+template <PixelFormat F> struct PixelTraits;
+
+template <> struct PixelTraits<PIXEL_BGRX32> {
+    static constexpr int bytes = 4;
+    static void load(const uint8_t* p, int& r, int& g, int& b) { b = p[0]; g = p[1]; r = p[2]; }
+};
+template <> struct PixelTraits<PIXEL_XRGB32> {
+    static constexpr int bytes = 4;
+    static void load(const uint8_t* p, int& r, int& g, int& b) { r = p[1]; g = p[2]; b = p[3]; }
+};
+template <> struct PixelTraits<PIXEL_RGBX32> {
+    static constexpr int bytes = 4;
+    static void load(const uint8_t* p, int& r, int& g, int& b) { r = p[0]; g = p[1]; b = p[2]; }
+};
+template <> struct PixelTraits<PIXEL_BGR24> {
+    static constexpr int bytes = 3;
+    static void load(const uint8_t* p, int& r, int& g, int& b) { b = p[0]; g = p[1]; r = p[2]; }
+};
+template <> struct PixelTraits<PIXEL_RGB24> {
+    static constexpr int bytes = 3;
+    static void load(const uint8_t* p, int& r, int& g, int& b) { r = p[0]; g = p[1]; b = p[2]; }
+};
+template <> struct PixelTraits<PIXEL_RGB565_LE> {
+    static constexpr int bytes = 2;
+    static void load(const uint8_t* p, int& r, int& g, int& b) {
+        int v = p[0] | (p[1] << 8);
+        r = ((v >> 11) & 0x1f) * 255 / 31;
+        g = ((v >> 5) & 0x3f) * 255 / 63;
+        b = (v & 0x1f) * 255 / 31;
+    }
+};
+template <> struct PixelTraits<PIXEL_RGB565_BE> {
+    static constexpr int bytes = 2;
+    static void load(const uint8_t* p, int& r, int& g, int& b) {
+        int v = (p[0] << 8) | p[1];
+        r = ((v >> 11) & 0x1f) * 255 / 31;
+        g = ((v >> 5) & 0x3f) * 255 / 63;
+        b = (v & 0x1f) * 255 / 31;
+    }
+};
+
+// BT.601 limited range in 14-bit fixed point, small enough for 16-bit SIMD
+// multiplies; the scalar code uses the same constants so both agree exactly.
+#define YUV_SHIFT 14
+#define YUV_CRY 4211
+#define YUV_CGY 8258
+#define YUV_CBY 1606
+#define YUV_CRU -2425
+#define YUV_CGU -4768
+#define YUV_CBU 7193
+#define YUV_CGV -6030
+#define YUV_CBV -1163
+
+inline uint8_t rgb_to_y(int r, int g, int b) {
+    return (uint8_t)((YUV_CRY * r + YUV_CGY * g + YUV_CBY * b + (16 << YUV_SHIFT) + (1 << (YUV_SHIFT - 1))) >> YUV_SHIFT);
+}
+inline uint8_t rgb_to_u(int r, int g, int b) {
+    return (uint8_t)((YUV_CRU * r + YUV_CGU * g + YUV_CBU * b + (128 << YUV_SHIFT) + (1 << (YUV_SHIFT - 1))) >> YUV_SHIFT);
+}
+inline uint8_t rgb_to_v(int r, int g, int b) {
+    return (uint8_t)((YUV_CBU * r + YUV_CGV * g + YUV_CBV * b + (128 << YUV_SHIFT) + (1 << (YUV_SHIFT - 1))) >> YUV_SHIFT);
+}
+
+// ---- scalar kernels ----
+
+template <PixelFormat F>
+inline void row_to_bgr_scalar(const uint8_t* src, uint8_t* dst, int width) {
+    for (int x = 0; x < width; x++, src += PixelTraits<F>::bytes, dst += 3) {
+        int r, g, b;
+        PixelTraits<F>::load(src, r, g, b);
+        dst[0] = (uint8_t)b;
+        dst[1] = (uint8_t)g;
+        dst[2] = (uint8_t)r;
+    }
+}
+
+template <PixelFormat F>
+inline void row_to_y_scalar(const uint8_t* src, uint8_t* dst, int width) {
+    for (int x = 0; x < width; x++, src += PixelTraits<F>::bytes) {
+        int r, g, b;
+        PixelTraits<F>::load(src, r, g, b);
+        dst[x] = rgb_to_y(r, g, b);
+    }
+}
+
+// One row of chroma from two source rows. `width` is the source width; an
+// odd last column is paired with itself.
+template <PixelFormat F>
+inline void rows_to_uv(const uint8_t* row0, const uint8_t* row1, uint8_t* u, uint8_t* v, int width) {
+    const int bpp = PixelTraits<F>::bytes;
+    for (int x = 0; x < width; x += 2) {
+        int x1 = x + 1 < width ? x + 1 : x;
+        int r0, g0, b0, r1, g1, b1, r2, g2, b2, r3, g3, b3;
+        PixelTraits<F>::load(row0 + x * bpp, r0, g0, b0);
+        PixelTraits<F>::load(row0 + x1 * bpp, r1, g1, b1);
+        PixelTraits<F>::load(row1 + x * bpp, r2, g2, b2);
+        PixelTraits<F>::load(row1 + x1 * bpp, r3, g3, b3);
+        int r = (r0 + r1 + r2 + r3 + 2) >> 2;
+        int g = (g0 + g1 + g2 + g3 + 2) >> 2;
+        int b = (b0 + b1 + b2 + b3 + 2) >> 2;
+        u[x >> 1] = rgb_to_u(r, g, b);
+        v[x >> 1] = rgb_to_v(r, g, b);
+    }
+}
+
+// ---- SIMD kernels for the 32bpp formats ----
+
+#ifdef PIXEL_CONVERT_X86
+
+// Byte offsets of B, G, R inside a 4-byte pixel
+template <PixelFormat F> struct Layout32;
+template <> struct Layout32<PIXEL_BGRX32> { enum { B = 0, G = 1, R = 2, X = 3 }; };
+template <> struct Layout32<PIXEL_XRGB32> { enum { B = 3, G = 2, R = 1, X = 0 }; };
+template <> struct Layout32<PIXEL_RGBX32> { enum { B = 2, G = 1, R = 0, X = 3 }; };
+
+template <PixelFormat F>
+inline __m128i bgr_shuffle_mask() {
+    typedef Layout32<F> L;
+    return _mm_setr_epi8(L::B, L::G, L::R, 4 + L::B, 4 + L::G, 4 + L::R,
+                         8 + L::B, 8 + L::G, 8 + L::R, 12 + L::B, 12 + L::G, 12 + L::R,
+                         -1, -1, -1, -1);
+}
+
+// madd coefficients for one pixel unpacked to 4 x int16, repeated for two
+// pixels
+template <PixelFormat F>
+inline __m128i pixel_coefficients(int16_t cb, int16_t cg, int16_t cr) {
+    typedef Layout32<F> L;
+    int16_t c[4];
+    c[L::B] = cb;
+    c[L::G] = cg;
+    c[L::R] = cr;
+    c[L::X] = 0;
+    return _mm_setr_epi16(c[0], c[1], c[2], c[3], c[0], c[1], c[2], c[3]);
+}
+
+template <PixelFormat F>
+__attribute__((target("sse4.1")))
+inline void row_to_bgr_sse41(const uint8_t* src, uint8_t* dst, int width) {
+    const __m128i mask = bgr_shuffle_mask<F>();
+    int x = 0;
+    // Each store writes 16 bytes of which 12 are valid; keep 2 pixels of slack
+    for (; x + 6 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + x * 4));
+        _mm_storeu_si128((__m128i*)(dst + x * 3), _mm_shuffle_epi8(px, mask));
+    }
+    row_to_bgr_scalar<F>(src + x * 4, dst + x * 3, width - x);
+}
+
+template <PixelFormat F>
+__attribute__((target("avx2")))
+inline void row_to_bgr_avx2(const uint8_t* src, uint8_t* dst, int width) {
+    const __m128i m = bgr_shuffle_mask<F>();
+    const __m256i mask = _mm256_broadcastsi128_si256(m);
+    // Move the two 12-byte lane results next to each other
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    int x = 0;
+    // Each store writes 32 bytes of which 24 are valid; keep 3 pixels of slack
+    for (; x + 11 <= width; x += 8) {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(src + x * 4));
+        __m256i bgr = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(px, mask), pack);
+        _mm256_storeu_si256((__m256i*)(dst + x * 3), bgr);
+    }
+    row_to_bgr_sse41<F>(src + x * 4, dst + x * 3, width - x);
+}
+
+template <PixelFormat F>
+__attribute__((target("sse4.1")))
+inline void row_to_y_sse41(const uint8_t* src, uint8_t* dst, int width) {
+    const __m128i coef = pixel_coefficients<F>(YUV_CBY, YUV_CGY, YUV_CRY);
+    const __m128i offset = _mm_set1_epi32((16 << YUV_SHIFT) + (1 << (YUV_SHIFT - 1)));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + x * 4));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + x * 4 + 16));
+        __m128i a0 = _mm_madd_epi16(_mm_cvtepu8_epi16(a), coef);
+        __m128i a1 = _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(a, 8)), coef);
+        __m128i b0 = _mm_madd_epi16(_mm_cvtepu8_epi16(b), coef);
+        __m128i b1 = _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(b, 8)), coef);
+        __m128i ya = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(a0, a1), offset), YUV_SHIFT);
+        __m128i yb = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(b0, b1), offset), YUV_SHIFT);
+        __m128i y16 = _mm_packs_epi32(ya, yb);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(y16, y16));
+    }
+    row_to_y_scalar<F>(src + x * 4, dst + x, width - x);
+}
+
+template <PixelFormat F>
+__attribute__((target("avx2")))
+inline void row_to_y_avx2(const uint8_t* src, uint8_t* dst, int width) {
+    const __m256i coef = _mm256_broadcastsi128_si256(pixel_coefficients<F>(YUV_CBY, YUV_CGY, YUV_CRY));
+    const __m256i offset = _mm256_set1_epi32((16 << YUV_SHIFT) + (1 << (YUV_SHIFT - 1)));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // 4 pixels per 16-byte load, widened to 16 bits
+        __m256i p0 = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + x * 4))), coef);
+        __m256i p1 = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + x * 4 + 16))), coef);
+        __m256i p2 = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + x * 4 + 32))), coef);
+        __m256i p3 = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + x * 4 + 48))), coef);
+        // hadd works per lane; restore pixel order with a 64-bit permute
+        __m256i y01 = _mm256_permute4x64_epi64(_mm256_hadd_epi32(p0, p1), 0xD8);
+        __m256i y23 = _mm256_permute4x64_epi64(_mm256_hadd_epi32(p2, p3), 0xD8);
+        y01 = _mm256_srai_epi32(_mm256_add_epi32(y01, offset), YUV_SHIFT);
+        y23 = _mm256_srai_epi32(_mm256_add_epi32(y23, offset), YUV_SHIFT);
+        __m256i y16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(y01, y23), 0xD8);
+        __m128i y8 = _mm_packus_epi16(_mm256_castsi256_si128(y16), _mm256_extracti128_si256(y16, 1));
+        _mm_storeu_si128((__m128i*)(dst + x), y8);
+    }
+    row_to_y_sse41<F>(src + x * 4, dst + x, width - x);
+}
+
+// 2x2 block averages of pixels 4i..4i+3 of two rows, as two blocks of
+// 4 x int16 channel values
+__attribute__((target("sse4.1")))
+inline __m128i average_blocks(__m128i row0, __m128i row1) {
+    __m128i lo = _mm_add_epi16(_mm_cvtepu8_epi16(row0), _mm_cvtepu8_epi16(row1));
+    __m128i hi = _mm_add_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(row0, 8)),
+                               _mm_cvtepu8_epi16(_mm_srli_si128(row1, 8)));
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+template <PixelFormat F>
+__attribute__((target("sse4.1")))
+inline void rows_to_uv_sse41(const uint8_t* row0, const uint8_t* row1, uint8_t* u, uint8_t* v, int width) {
+    const __m128i coef_u = pixel_coefficients<F>(YUV_CBU, YUV_CGU, YUV_CRU);
+    const __m128i coef_v = pixel_coefficients<F>(YUV_CBV, YUV_CGV, YUV_CBU);
+    const __m128i offset = _mm_set1_epi32((128 << YUV_SHIFT) + (1 << (YUV_SHIFT - 1)));
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i a = average_blocks(_mm_loadu_si128((const __m128i*)(row0 + x * 4)),
+                                   _mm_loadu_si128((const __m128i*)(row1 + x * 4)));
+        __m128i b = average_blocks(_mm_loadu_si128((const __m128i*)(row0 + x * 4 + 16)),
+                                   _mm_loadu_si128((const __m128i*)(row1 + x * 4 + 16)));
+        __m128i u32 = _mm_hadd_epi32(_mm_madd_epi16(a, coef_u), _mm_madd_epi16(b, coef_u));
+        __m128i v32 = _mm_hadd_epi32(_mm_madd_epi16(a, coef_v), _mm_madd_epi16(b, coef_v));
+        u32 = _mm_srai_epi32(_mm_add_epi32(u32, offset), YUV_SHIFT);
+        v32 = _mm_srai_epi32(_mm_add_epi32(v32, offset), YUV_SHIFT);
+        __m128i uv16 = _mm_packs_epi32(u32, v32);
+        __m128i uv8 = _mm_packus_epi16(uv16, uv16);
+        uint32_t u4 = (uint32_t)_mm_cvtsi128_si32(uv8);
+        uint32_t v4 = (uint32_t)_mm_extract_epi32(uv8, 1);
+        memcpy(u + x / 2, &u4, 4);
+        memcpy(v + x / 2, &v4, 4);
+    }
+    rows_to_uv<F>(row0 + x * 4, row1 + x * 4, u + x / 2, v + x / 2, width - x);
+}
+
+#endif // PIXEL_CONVERT_X86
+
+// ---- dispatch ----
+
+typedef void (*RowKernel)(const uint8_t* src, uint8_t* dst, int width);
+typedef void (*ChromaKernel)(const uint8_t* row0, const uint8_t* row1, uint8_t* u, uint8_t* v, int width);
+
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE41, SIMD_AVX2 };
+
+inline SimdLevel detect_simd_level() {
+#ifdef PIXEL_CONVERT_X86
+    static const SimdLevel level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+        if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE41;
+        return SIMD_SCALAR;
+    }();
+    return level;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+// Lets the benchmark force a level; SIMD_AVX2 means "best available"
+inline SimdLevel& simd_level_limit() {
+    static SimdLevel limit = SIMD_AVX2;
+    return limit;
+}
+
+// Maps non-32bpp formats onto a 32bpp one so the SIMD templates still
+// instantiate; those branches are never taken
+template <PixelFormat F> struct Simd32 { static constexpr PixelFormat format = PIXEL_BGRX32; };
+template <> struct Simd32<PIXEL_XRGB32> { static constexpr PixelFormat format = PIXEL_XRGB32; };
+template <> struct Simd32<PIXEL_RGBX32> { static constexpr PixelFormat format = PIXEL_RGBX32; };
+
+template <PixelFormat F>
+inline void pick_kernels(RowKernel& bgr, RowKernel& y, ChromaKernel& uv) {
+    bgr = row_to_bgr_scalar<F>;
+    y = row_to_y_scalar<F>;
+    uv = rows_to_uv<F>;
+#ifdef PIXEL_CONVERT_X86
+    if (PixelTraits<F>::bytes == 4) {
+        SimdLevel level = detect_simd_level();
+        if (level > simd_level_limit()) level = simd_level_limit();
+        if (level == SIMD_AVX2) {
+            bgr = row_to_bgr_avx2<Simd32<F>::format>;
+            y = row_to_y_avx2<Simd32<F>::format>;
+            uv = rows_to_uv_sse41<Simd32<F>::format>;
+        } else if (level == SIMD_SSE41) {
+            bgr = row_to_bgr_sse41<Simd32<F>::format>;
+            y = row_to_y_sse41<Simd32<F>::format>;
+            uv = rows_to_uv_sse41<Simd32<F>::format>;
+        }
+    }
+#endif
+}
+
+template <PixelFormat F>
+inline void convert_to_bgr_impl(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride,
+                                int width, int height) {
+    RowKernel bgr, to_y;
+    ChromaKernel to_uv;
+    pick_kernels<F>(bgr, to_y, to_uv);
+    // Tightly packed on both sides: one long row, no per-row overhead
+    if (src_stride == width * PixelTraits<F>::bytes && dst_stride == width * 3) {
+        bgr(src, dst, width * height);
+        return;
+    }
+    for (int row = 0; row < height; row++) {
+        bgr(src + (size_t)row * src_stride, dst + (size_t)row * dst_stride, width);
+    }
+}
+
+template <>
+inline void convert_to_bgr_impl<PIXEL_BGR24>(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride,
+                                             int width, int height) {
+    for (int row = 0; row < height; row++) {
+        memcpy(dst + (size_t)row * dst_stride, src + (size_t)row * src_stride, (size_t)width * 3);
+    }
+}
+
+// Output planes are (width + 1) & ~1 by (height + 1) & ~1 luma; an odd last
+// row or column is replicated.
+template <PixelFormat F>
+inline void convert_to_i420_impl(const uint8_t* src, int src_stride, int width, int height,
+                                 uint8_t* y, int y_stride, uint8_t* u, int u_stride, uint8_t* v, int v_stride) {
+    RowKernel bgr, to_y;
+    ChromaKernel to_uv;
+    pick_kernels<F>(bgr, to_y, to_uv);
+    int even_w = (width + 1) & ~1;
+    for (int row = 0; row < height; row += 2) {
+        const uint8_t* row0 = src + (size_t)row * src_stride;
+        const uint8_t* row1 = row + 1 < height ? row0 + src_stride : row0;
+        uint8_t* y0 = y + (size_t)row * y_stride;
+        uint8_t* y1 = y0 + y_stride;
+        to_y(row0, y0, width);
+        to_y(row1, y1, width);
+        if (even_w != width) {
+            y0[width] = y0[width - 1];
+            y1[width] = y1[width - 1];
+        }
+        to_uv(row0, row1, u + (size_t)(row / 2) * u_stride, v + (size_t)(row / 2) * v_stride, width);
+    }
+}
+
+inline bool convert_to_bgr(PixelFormat fmt, const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride,
+                           int width, int height) {
+    switch (fmt) {
+    case PIXEL_BGRX32: convert_to_bgr_impl<PIXEL_BGRX32>(src, src_stride, dst, dst_stride, width, height); return true;
+    case PIXEL_XRGB32: convert_to_bgr_impl<PIXEL_XRGB32>(src, src_stride, dst, dst_stride, width, height); return true;
+    case PIXEL_RGBX32: convert_to_bgr_impl<PIXEL_RGBX32>(src, src_stride, dst, dst_stride, width, height); return true;
+    case PIXEL_BGR24: convert_to_bgr_impl<PIXEL_BGR24>(src, src_stride, dst, dst_stride, width, height); return true;
+    case PIXEL_RGB24: convert_to_bgr_impl<PIXEL_RGB24>(src, src_stride, dst, dst_stride, width, height); return true;
+    case PIXEL_RGB565_LE: convert_to_bgr_impl<PIXEL_RGB565_LE>(src, src_stride, dst, dst_stride, width, height); return true;
+    case PIXEL_RGB565_BE: convert_to_bgr_impl<PIXEL_RGB565_BE>(src, src_stride, dst, dst_stride, width, height); return true;
+    default: return false;
+    }
+}
+
+inline bool convert_to_i420(PixelFormat fmt, const uint8_t* src, int src_stride, int width, int height,
+                            uint8_t* y, int y_stride, uint8_t* u, int u_stride, uint8_t* v, int v_stride) {
+#define PIXEL_I420_CASE(F) \
+    case F: convert_to_i420_impl<F>(src, src_stride, width, height, y, y_stride, u, u_stride, v, v_stride); return true;
+    switch (fmt) {
+    PIXEL_I420_CASE(PIXEL_BGRX32)
+    PIXEL_I420_CASE(PIXEL_XRGB32)
+    PIXEL_I420_CASE(PIXEL_RGBX32)
+    PIXEL_I420_CASE(PIXEL_BGR24)
+    PIXEL_I420_CASE(PIXEL_RGB24)
+    PIXEL_I420_CASE(PIXEL_RGB565_LE)
+    PIXEL_I420_CASE(PIXEL_RGB565_BE)
+    default: return false;
+    }
+#undef PIXEL_I420_CASE
+}
@@ -0,0 +1,311 @@
+#pragma once
+
+// Area downscaling of 8-bit images, packed BGR or single planes, for the
+// session's output scale: every output pixel is the mean of the source
+// pixels it covers, partly covered ones weighted by coverage. That is the
+// filter cv::INTER_AREA uses for shrinking, without its slow path for
+// ratios that are not whole numbers (the usual case when fitting a window
+// to a client's viewport).
+//
+//   scale_area   resize with a cached AreaScaler plan
+//
+// The filter is separable. For each output row, the source rows it covers
+// are summed with their weights into one row of 32-bit sums; that pass
+// touches every source pixel, so it has SSE4.1 and AVX2 kernels picked at
+// runtime like pixel_convert.h. A second pass then sums each output pixel's
+// columns from that row, a BGR pixel per SSE4.1 vector or eight plane pixels
+// per AVX2 gather. Weights are fixed point, rows in 1/4096ths and
+// columns in 1/2048ths, so a whole output pixel of 255s still fits in 31
+// bits and every weight fits the int16 madd.
+//
+// Output sizes above the source work too: scaled tiles are rounded
+// outwards, so a one pixel tile can come out two pixels wide.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "pixel_convert.h"
+
+#define AREA_ROW_BITS 12
+#define AREA_COL_BITS 11
+
+// The source rows or columns one output row or column covers; its weights
+// start at `weights` in the scaler's weight array
+struct AreaSpan {
+    int first = 0;
+    int count = 0;
+    int weights = 0;
+};
+
+// Plan and scratch memory for one scaling size. Keep one per call site, and
+// per tile where tiles are scaled concurrently: it is only rebuilt when the
+// sizes change and then reuses its memory, so scaling in steady state does
+// not allocate.
+//
+// Column spans are padded with zero weights to the same tap count, and
+// their weights stored tap by tap (col_weights[tap * dst_width + x]), so
+// the horizontal pass runs a fixed loop and loads a tap's weights for
+// consecutive pixels in one go.
+struct AreaScaler {
+    int src_width = 0;
+    int src_height = 0;
+    int dst_width = 0;
+    int dst_height = 0;
+    std::vector<AreaSpan> rows;
+    std::vector<int16_t> row_weights;
+    std::vector<AreaSpan> cols;
+    std::vector<int32_t> col_span_weights;
+    int col_taps = 0;
+    std::vector<int32_t> col_first;
+    std::vector<int32_t> col_weights;
+    std::vector<int32_t> sums;      // one row of vertical sums, plus slack for the taps
+};
+
+// Spans and weights mapping `src` pixels onto `dst`. The weights are
+// rounded from the running coverage, so each span's add up to exactly
+// 1 << bits.
+template <typename W>
+inline void area_spans(int src, int dst, int bits, std::vector<AreaSpan>& spans, std::vector<W>& weights) {
+    const double ratio = (double)src / dst;
+    const int one = 1 << bits;
+    spans.resize(dst);
+    weights.clear();
+    for (int o = 0; o < dst; o++) {
+        double begin = o * ratio;
+        double end = std::min((double)src, (o + 1) * ratio);
+        AreaSpan& span = spans[o];
+        span.first = std::min(src - 1, (int)begin);
+        int last = std::max(span.first + 1, std::min(src, (int)std::ceil(end - 1e-9)));
+        span.count = last - span.first;
+        span.weights = (int)weights.size();
+        int given = 0;
+        for (int i = span.first; i < last; i++) {
+            int total = i + 1 == last ? one : (int)std::lround((i + 1 - begin) / ratio * one);
+            weights.push_back((W)(total - given));
+            given = total;
+        }
+    }
+}
+
+inline void area_scaler_plan(AreaScaler& s, int src_width, int src_height, int dst_width, int dst_height) {
+    if (s.src_width == src_width && s.src_height == src_height &&
+        s.dst_width == dst_width && s.dst_height == dst_height) return;
+    area_spans(src_height, dst_height, AREA_ROW_BITS, s.rows, s.row_weights);
+    area_spans(src_width, dst_width, AREA_COL_BITS, s.cols, s.col_span_weights);
+    s.col_taps = 0;
+    for (const AreaSpan& span : s.cols) s.col_taps = std::max(s.col_taps, span.count);
+    s.col_first.resize(dst_width);
+    s.col_weights.assign((size_t)s.col_taps * dst_width, 0);
+    for (int x = 0; x < dst_width; x++) {
+        const AreaSpan& span = s.cols[x];
+        s.col_first[x] = span.first;
+        for (int i = 0; i < span.count; i++)
+            s.col_weights[(size_t)i * dst_width + x] = s.col_span_weights[span.weights + i];
+    }
+    s.src_width = src_width;
+    s.src_height = src_height;
+    s.dst_width = dst_width;
+    s.dst_height = dst_height;
+}
+
+// ---- vertical pass: sums[x] = sum of row r at x times weights[r] ----
+
+inline void area_rows_scalar(const uint8_t* src, int stride, const int16_t* weights, int count,
+                             int32_t* sums, int x, int n) {
+    for (int i = x; i < n; i++) sums[i] = 0;
+    for (int r = 0; r < count; r++, src += stride) {
+        int32_t w = weights[r];
+        for (int i = x; i < n; i++) sums[i] += src[i] * w;
+    }
+}
+
+#ifdef PIXEL_CONVERT_X86
+
+// Rows go in pairs: their bytes are interleaved as int16 so a single madd
+// weighs both. An odd last row is paired with itself at weight 0.
+__attribute__((target("sse4.1")))
+inline __m128i area_row_pair_weights(const int16_t* weights, int r, int count) {
+    uint16_t w0 = (uint16_t)weights[r];
+    uint16_t w1 = r + 1 < count ? (uint16_t)weights[r + 1] : 0;
+    return _mm_set1_epi32((int)(w0 | ((uint32_t)w1 << 16)));
+}
+
+__attribute__((target("sse4.1")))
+inline void area_rows_sse41(const uint8_t* src, int stride, const int16_t* weights, int count,
+                            int32_t* sums, int x, int n) {
+    for (; x + 16 <= n; x += 16) {
+        __m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0;
+        for (int r = 0; r < count; r += 2) {
+            const uint8_t* row0 = src + (size_t)r * stride + x;
+            const uint8_t* row1 = r + 1 < count ? row0 + stride : row0;
+            __m128i w = area_row_pair_weights(weights, r, count);
+            __m128i a = _mm_loadu_si128((const __m128i*)row0);
+            __m128i b = _mm_loadu_si128((const __m128i*)row1);
+            __m128i a0 = _mm_cvtepu8_epi16(a), a1 = _mm_cvtepu8_epi16(_mm_srli_si128(a, 8));
+            __m128i b0 = _mm_cvtepu8_epi16(b), b1 = _mm_cvtepu8_epi16(_mm_srli_si128(b, 8));
+            s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(a0, b0), w));
+            s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(a0, b0), w));
+            s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi16(a1, b1), w));
+            s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi16(a1, b1), w));
+        }
+        _mm_storeu_si128((__m128i*)(sums + x), s0);
+        _mm_storeu_si128((__m128i*)(sums + x + 4), s1);
+        _mm_storeu_si128((__m128i*)(sums + x + 8), s2);
+        _mm_storeu_si128((__m128i*)(sums + x + 12), s3);
+    }
+    area_rows_scalar(src, stride, weights, count, sums, x, n);
+}
+
+__attribute__((target("avx2")))
+inline void area_rows_avx2(const uint8_t* src, int stride, const int16_t* weights, int count,
+                           int32_t* sums, int x, int n) {
+    for (; x + 32 <= n; x += 32) {
+        __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+        for (int r = 0; r < count; r += 2) {
+            const uint8_t* row0 = src + (size_t)r * stride + x;
+            const uint8_t* row1 = r + 1 < count ? row0 + stride : row0;
+            __m256i w = _mm256_broadcastsi128_si256(area_row_pair_weights(weights, r, count));
+            __m256i a0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)row0));
+            __m256i a1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row0 + 16)));
+            __m256i b0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)row1));
+            __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row1 + 16)));
+            // Unpacking works per lane: s0 holds columns 0-3 and 8-11, s1 4-7 and 12-15
+            s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi16(a0, b0), w));
+            s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi16(a0, b0), w));
+            s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi16(a1, b1), w));
+            s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi16(a1, b1), w));
+        }
+        _mm256_storeu_si256((__m256i*)(sums + x), _mm256_permute2x128_si256(s0, s1, 0x20));
+        _mm256_storeu_si256((__m256i*)(sums + x + 8), _mm256_permute2x128_si256(s0, s1, 0x31));
+        _mm256_storeu_si256((__m256i*)(sums + x + 16), _mm256_permute2x128_si256(s2, s3, 0x20));
+        _mm256_storeu_si256((__m256i*)(sums + x + 24), _mm256_permute2x128_si256(s2, s3, 0x31));
+    }
+    area_rows_sse41(src, stride, weights, count, sums, x, n);
+}
+
+#endif // PIXEL_CONVERT_X86
+
+// ---- horizontal pass: each output pixel from its taps of sums ----
+
+template <int C>
+inline void area_cols_scalar(const int32_t* sums, const int32_t* first, const int32_t* weights, int taps,
+                             uint8_t* dst, int x, int width) {
+    const uint32_t round = 1u << (AREA_ROW_BITS + AREA_COL_BITS - 1);
+    for (; x < width; x++) {
+        const int32_t* s = sums + first[x] * C;
+        uint32_t acc[C] = {};
+        for (int k = 0; k < taps; k++, s += C) {
+            uint32_t w = (uint32_t)weights[(size_t)k * width + x];
+            for (int c = 0; c < C; c++) acc[c] += (uint32_t)s[c] * w;
+        }
+        for (int c = 0; c < C; c++) dst[x * C + c] = (uint8_t)((acc[c] + round) >> (AREA_ROW_BITS + AREA_COL_BITS));
+    }
+}
+
+#ifdef PIXEL_CONVERT_X86
+
+// A BGR pixel's three sums in one vector (the fourth lane belongs to the
+// next pixel and gets dropped)
+__attribute__((target("sse4.1")))
+inline void area_cols_bgr_sse41(const int32_t* sums, const int32_t* first, const int32_t* weights, int taps,
+                                uint8_t* dst, int x, int width) {
+    const __m128i round = _mm_set1_epi32(1 << (AREA_ROW_BITS + AREA_COL_BITS - 1));
+    // Each store writes 4 bytes of which 3 are valid; leave the last pixel
+    // to the scalar code
+    for (; x + 1 < width; x++) {
+        const int32_t* s = sums + first[x] * 3;
+        __m128i acc = round;
+        for (int k = 0; k < taps; k++, s += 3) {
+            __m128i w = _mm_set1_epi32(weights[(size_t)k * width + x]);
+            acc = _mm_add_epi32(acc, _mm_mullo_epi32(_mm_loadu_si128((const __m128i*)s), w));
+        }
+        acc = _mm_srli_epi32(acc, AREA_ROW_BITS + AREA_COL_BITS);
+        acc = _mm_packus_epi32(acc, acc);
+        uint32_t px = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+        memcpy(dst + x * 3, &px, 4);
+    }
+    area_cols_scalar<3>(sums, first, weights, taps, dst, x, width);
+}
+
+// Eight plane pixels at a time, each tap's sums gathered
+__attribute__((target("avx2")))
+inline void area_cols_plane_avx2(const int32_t* sums, const int32_t* first, const int32_t* weights, int taps,
+                                 uint8_t* dst, int x, int width) {
+    const __m256i round = _mm256_set1_epi32(1 << (AREA_ROW_BITS + AREA_COL_BITS - 1));
+    for (; x + 8 <= width; x += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(first + x));
+        __m256i acc = round;
+        for (int k = 0; k < taps; k++) {
+            __m256i s = _mm256_i32gather_epi32((const int*)sums, index, 4);
+            __m256i w = _mm256_loadu_si256((const __m256i*)(weights + (size_t)k * width + x));
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(s, w));
+            index = _mm256_add_epi32(index, _mm256_set1_epi32(1));
+        }
+        acc = _mm256_srli_epi32(acc, AREA_ROW_BITS + AREA_COL_BITS);
+        __m128i px16 = _mm_packus_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(px16, px16));
+    }
+    area_cols_scalar<1>(sums, first, weights, taps, dst, x, width);
+}
+
+#endif // PIXEL_CONVERT_X86
+
+// ---- dispatch ----
+
+typedef void (*AreaRowsKernel)(const uint8_t* src, int stride, const int16_t* weights, int count,
+                               int32_t* sums, int x, int n);
+typedef void (*AreaColsKernel)(const int32_t* sums, const int32_t* first, const int32_t* weights, int taps,
+                               uint8_t* dst, int x, int width);
+
+template <int C>
+inline void pick_area_kernels(AreaRowsKernel& rows, AreaColsKernel& cols) {
+    rows = area_rows_scalar;
+    cols = area_cols_scalar<C>;
+#ifdef PIXEL_CONVERT_X86
+    SimdLevel level = detect_simd_level();
+    if (level > simd_level_limit()) level = simd_level_limit();
+    if (level == SIMD_AVX2) {
+        rows = area_rows_avx2;
+        cols = C == 3 ? area_cols_bgr_sse41 : area_cols_plane_avx2;
+    } else if (level == SIMD_SSE41) {
+        rows = area_rows_sse41;
+        if (C == 3) cols = area_cols_bgr_sse41;
+    }
+#endif
+}
+
+template <int C>
+inline void scale_area_impl(AreaScaler& s, const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride) {
+    AreaRowsKernel rows;
+    AreaColsKernel cols;
+    pick_area_kernels<C>(rows, cols);
+    int n = s.src_width * C;
+    // Padding taps read past the row (with weight 0), the BGR kernel one more
+    s.sums.resize(n + s.col_taps * C + 4);
+    for (int y = 0; y < s.dst_height; y++) {
+        const AreaSpan& span = s.rows[y];
+        rows(src + (size_t)span.first * src_stride, src_stride, s.row_weights.data() + span.weights, span.count,
+             s.sums.data(), 0, n);
+        cols(s.sums.data(), s.col_first.data(), s.col_weights.data(), s.col_taps,
+             dst + (size_t)y * dst_stride, 0, s.dst_width);
+    }
+}
+
+// Resize src to dst. `channels` is 1 (planes) or 3 (BGR); returns false for
+// anything else, or empty sizes, without touching dst.
+inline bool scale_area(AreaScaler& s, const uint8_t* src, int src_stride, int src_width, int src_height,
+                       uint8_t* dst, int dst_stride, int dst_width, int dst_height, int channels) {
+    if (channels != 1 && channels != 3) return false;
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) return false;
+    if (src_width == dst_width && src_height == dst_height) {
+        for (int y = 0; y < dst_height; y++)
+            memcpy(dst + (size_t)y * dst_stride, src + (size_t)y * src_stride, (size_t)dst_width * channels);
+        return true;
+    }
+    area_scaler_plan(s, src_width, src_height, dst_width, dst_height);
+    if (channels == 3) scale_area_impl<3>(s, src, src_stride, dst, dst_stride);
+    else scale_area_impl<1>(s, src, src_stride, dst, dst_stride);
+    return true;
+}
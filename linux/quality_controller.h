@@ -0,0 +1,111 @@
+#pragma once
+
+// Congestion-aware quality control for the video socket.
+//
+// After every sent frame we look at how much data is still sitting in the
+// kernel send queue (SIOCOUTQ) and at the connection RTT (TCP_INFO). With an
+// estimate of how fast the queue drains, that gives the age a frame queued
+// right now would have when it reaches the client:
+//
+//   latency ~= encode time + unsent bytes / drain rate + rtt / 2
+//
+// Above the target we cut JPEG quality multiplicatively, and once quality is
+// at its floor shrink the output resolution (if allowed). Well below the
+// target we creep back up, resolution first. The encoder reads `quality` and
+// `scale` for every frame.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+struct QualityController {
+    // Settings
+    int target_latency_ms = 0;      // 0 disables adaptation
+    int min_quality = 30;
+    int max_quality = 90;
+    bool allow_scale = false;
+    double min_scale = 0.5;
+
+    // Decisions, read by the encoder
+    std::atomic<int> quality{80};
+    std::atomic<double> scale{1.0};
+
+    // Measurements
+    std::atomic<double> encode_ms{0};
+    double drain_rate = 0;          // bytes/s, EWMA
+    int last_outq = 0;
+    std::chrono::steady_clock::time_point last_sample{};
+    std::chrono::steady_clock::time_point last_log{};
+};
+
+// Unsent bytes in the socket send queue and smoothed RTT in microseconds
+inline bool socket_backlog(int sock, int& outq, int& rtt_us) {
+    if (ioctl(sock, SIOCOUTQ, &outq) < 0) return false;
+    struct tcp_info info{};
+    socklen_t len = sizeof(info);
+    rtt_us = 0;
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+        rtt_us = info.tcpi_rtt;
+    }
+    return true;
+}
+
+// Feed one sent frame of `bytes` into the controller
+inline void quality_controller_update(QualityController& qc, int sock, size_t bytes) {
+    if (qc.target_latency_ms <= 0) return;
+
+    int outq = 0, rtt_us = 0;
+    if (!socket_backlog(sock, outq, rtt_us)) return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (qc.last_sample != std::chrono::steady_clock::time_point()) {
+        double dt = std::chrono::duration<double>(now - qc.last_sample).count();
+        // What left the queue since last time: what was there + what we added - what is left
+        double drained = (double)qc.last_outq + (double)bytes - (double)outq;
+        if (dt > 0 && drained > 0) {
+            double rate = drained / dt;
+            qc.drain_rate = qc.drain_rate > 0 ? qc.drain_rate * 0.8 + rate * 0.2 : rate;
+        }
+    }
+    qc.last_sample = now;
+    qc.last_outq = outq;
+
+    double queue_ms = qc.drain_rate > 0 ? outq * 1000.0 / qc.drain_rate : 0;
+    double latency_ms = qc.encode_ms + queue_ms + rtt_us / 2000.0;
+
+    int quality = qc.quality;
+    double scale = qc.scale;
+
+    if (latency_ms > qc.target_latency_ms) {
+        if (quality > qc.min_quality) {
+            quality = std::max(qc.min_quality, (int)(quality * 0.85));
+        } else if (qc.allow_scale && scale > qc.min_scale) {
+            scale = std::max(qc.min_scale, scale * 0.85);
+        }
+    } else if (latency_ms < qc.target_latency_ms * 0.5) {
+        if (scale < 1.0) {
+            scale = std::min(1.0, scale + 0.05);
+        } else if (quality < qc.max_quality) {
+            quality = std::min(qc.max_quality, quality + 2);
+        }
+    }
+
+    bool changed = quality != qc.quality || std::fabs(scale - qc.scale) > 1e-6;
+    qc.quality = quality;
+    qc.scale = scale;
+
+    // Log every decision, but at most twice a second
+    if (changed && now - qc.last_log > std::chrono::milliseconds(500)) {
+        qc.last_log = now;
+        std::cout << "[QUALITY] latency=" << (int)latency_ms << "ms (encode=" << (int)qc.encode_ms
+                  << " queue=" << (int)queue_ms << " rtt=" << rtt_us / 1000 << ") outq=" << outq
+                  << " -> quality=" << quality << " scale=" << scale << "\n";
+    }
+}
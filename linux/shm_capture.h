@@ -0,0 +1,282 @@
+#pragma once
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include "pixel_convert.h"
+
+// Persistent MIT-SHM capture buffer. One shared segment is created per session
+// and reused for every frame, so XShmGetImage writes the pixels straight into
+// our memory instead of pushing them through the X socket into a fresh XImage.
+// When the extension is missing (remote display, no SysV shm) it degrades to
+// the plain XGetImage path.
+struct ShmCapture {
+    Display* dpy = nullptr;
+    XImage* image = nullptr;      // owned by the capture, never XDestroyImage it yourself
+    XShmSegmentInfo shminfo{};
+    bool use_shm = false;
+    bool attached = false;
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+};
+
+// One captured rectangle, pointing into a ShmCapture buffer
+struct CaptureRegion {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    const char* data = nullptr;
+    int stride = 0;
+    PixelFormat format = PIXEL_UNSUPPORTED;
+};
+
+// Memory layout of an image's pixels, for picking a conversion kernel
+inline PixelFormat pixel_format_of(const XImage* image) {
+    bool lsb = image->byte_order == LSBFirst;
+    switch (image->bits_per_pixel) {
+    case 32:
+        if (image->red_mask == 0xff0000 && image->blue_mask == 0xff) return lsb ? PIXEL_BGRX32 : PIXEL_XRGB32;
+        if (image->red_mask == 0xff && image->blue_mask == 0xff0000 && lsb) return PIXEL_RGBX32;
+        break;
+    case 24:
+        if (image->red_mask == 0xff0000 && image->blue_mask == 0xff) return lsb ? PIXEL_BGR24 : PIXEL_RGB24;
+        break;
+    case 16:
+        if (image->red_mask == 0xf800 && image->green_mask == 0x07e0 && image->blue_mask == 0x1f) {
+            return lsb ? PIXEL_RGB565_LE : PIXEL_RGB565_BE;
+        }
+        break;
+    }
+    return PIXEL_UNSUPPORTED;
+}
+
+// The error handler is process-wide while sessions attach from several
+// threads at once, so attaches take turns, and the trap only claims the
+// error for the attach request in progress. Every other error goes on to
+// the handler installed before.
+struct ShmAttachTrap {
+    std::mutex mutex;                           // one attach at a time
+    std::atomic<Display*> dpy{nullptr};
+    std::atomic<unsigned long> serial{0};       // of the XShmAttach request
+    std::atomic<bool> failed{false};
+    std::atomic<XErrorHandler> previous{nullptr};
+};
+
+inline ShmAttachTrap& shm_attach_trap() {
+    static ShmAttachTrap trap;
+    return trap;
+}
+
+inline int shm_attach_error_handler(Display* dpy, XErrorEvent* ev) {
+    ShmAttachTrap& trap = shm_attach_trap();
+    if (dpy == trap.dpy && ev->serial == trap.serial) {
+        trap.failed = true;
+        return 0;
+    }
+    XErrorHandler previous = trap.previous;
+    return previous ? previous(dpy, ev) : 0;
+}
+
+inline void shm_capture_free_segment(ShmCapture& cap) {
+    if (cap.attached) {
+        XShmDetach(cap.dpy, &cap.shminfo);
+        XSync(cap.dpy, False);
+        cap.attached = false;
+    }
+    if (cap.image) {
+        if (cap.use_shm) {
+            // The pixel data belongs to the segment, not to Xlib's allocator
+            cap.image->data = nullptr;
+        }
+        XDestroyImage(cap.image);
+        cap.image = nullptr;
+    }
+    if (cap.shminfo.shmaddr && cap.shminfo.shmaddr != (char*)-1) {
+        shmdt(cap.shminfo.shmaddr);
+    }
+    cap.shminfo = XShmSegmentInfo{};
+    cap.width = cap.height = cap.depth = 0;
+}
+
+// (Re)allocate the shared segment for the given geometry. Returns false and
+// switches the capture to the XGetImage path if anything goes wrong.
+inline bool shm_capture_alloc(ShmCapture& cap, Visual* visual, int depth, int width, int height) {
+    shm_capture_free_segment(cap);
+
+    cap.image = XShmCreateImage(cap.dpy, visual, depth, ZPixmap, nullptr, &cap.shminfo, width, height);
+    if (!cap.image) {
+        std::cerr << "[WARN] XShmCreateImage failed, falling back to XGetImage\n";
+        cap.use_shm = false;
+        return false;
+    }
+
+    cap.shminfo.shmid = shmget(IPC_PRIVATE, cap.image->bytes_per_line * cap.image->height, IPC_CREAT | 0600);
+    if (cap.shminfo.shmid < 0) {
+        perror("shmget");
+        XDestroyImage(cap.image);
+        cap.image = nullptr;
+        cap.use_shm = false;
+        return false;
+    }
+
+    cap.shminfo.shmaddr = cap.image->data = (char*)shmat(cap.shminfo.shmid, nullptr, 0);
+    cap.shminfo.readOnly = False;
+
+    // XShmAttach reports failure asynchronously (BadAccess on remote displays),
+    // so trap the error instead of letting the default handler kill us.
+    bool ok = cap.shminfo.shmaddr != (char*)-1;
+    bool failed = false;
+    if (ok) {
+        ShmAttachTrap& trap = shm_attach_trap();
+        std::lock_guard<std::mutex> lock(trap.mutex);
+        trap.failed = false;
+        trap.dpy = cap.dpy;
+        trap.previous = XSetErrorHandler(shm_attach_error_handler);
+        // The display is shared with other threads: nothing may slip in
+        // between reading the serial and sending the request
+        XLockDisplay(cap.dpy);
+        trap.serial = NextRequest(cap.dpy);
+        ok = XShmAttach(cap.dpy, &cap.shminfo);
+        XUnlockDisplay(cap.dpy);
+        XSync(cap.dpy, False);
+        XSetErrorHandler(trap.previous);
+        trap.dpy = nullptr;
+        failed = trap.failed;
+    }
+
+    // Mark for removal now so the segment goes away even if we crash
+    shmctl(cap.shminfo.shmid, IPC_RMID, nullptr);
+
+    if (!ok || failed) {
+        std::cerr << "[WARN] XShmAttach failed, falling back to XGetImage\n";
+        cap.attached = false;
+        shm_capture_free_segment(cap);
+        cap.use_shm = false;
+        return false;
+    }
+
+    cap.attached = true;
+    cap.width = width;
+    cap.height = height;
+    cap.depth = depth;
+    return true;
+}
+
+inline void shm_capture_init(ShmCapture& cap, Display* dpy) {
+    cap.dpy = dpy;
+    cap.use_shm = XShmQueryExtension(dpy);
+    if (cap.use_shm) {
+        std::cout << "[INFO] Using MIT-SHM capture\n";
+    } else {
+        std::cout << "[INFO] MIT-SHM not available, using XGetImage\n";
+    }
+}
+
+// Point the shared image header at a w x h view of the segment starting at
+// `offset`. XShmGetImage always writes tightly padded rows at
+// image->data, so partial grabs are packed one after another.
+inline void shm_capture_set_view(ShmCapture& cap, int width, int height, size_t offset = 0) {
+    XImage* image = cap.image;
+    image->data = cap.shminfo.shmaddr + offset;
+    image->width = width;
+    image->height = height;
+    image->bytes_per_line = ((width * image->bits_per_pixel + image->bitmap_pad - 1) / image->bitmap_pad)
+                            * (image->bitmap_pad >> 3);
+}
+
+// Grab `drawable` into the capture buffer. The returned image stays valid
+// until the next grab or shm_capture_release.
+inline XImage* shm_capture_grab(ShmCapture& cap, Drawable drawable, Visual* visual, int depth, int width, int height) {
+    if (cap.use_shm) {
+        if (!cap.image || cap.width != width || cap.height != height || cap.depth != depth) {
+            shm_capture_alloc(cap, visual, depth, width, height);
+        }
+        if (cap.use_shm) {
+            shm_capture_set_view(cap, width, height);
+            if (XShmGetImage(cap.dpy, drawable, cap.image, 0, 0, AllPlanes)) {
+                return cap.image;
+            }
+            std::cerr << "[WARN] XShmGetImage failed, falling back to XGetImage\n";
+            shm_capture_free_segment(cap);
+            cap.use_shm = false;
+        }
+    }
+
+    if (cap.image) {
+        XDestroyImage(cap.image);
+        cap.image = nullptr;
+    }
+    cap.image = XGetImage(cap.dpy, drawable, 0, 0, width, height, AllPlanes, ZPixmap);
+    return cap.image;
+}
+
+// Grab only the (x, y, w, h) sub-rectangle of a drawable whose full size is
+// full_width x full_height. With MIT-SHM the rectangles of one frame are
+// packed back to back starting at `offset`, which is advanced past this one,
+// so a whole frame's worth of regions fits in one segment. Without it they
+// are read with XGetSubImage into the full-size image at their own position.
+inline bool shm_capture_grab_region(ShmCapture& cap, Drawable drawable, Visual* visual, int depth,
+                                    int full_width, int full_height, int x, int y, int w, int h,
+                                    size_t& offset, CaptureRegion& out) {
+    out.x = x;
+    out.y = y;
+    out.width = w;
+    out.height = h;
+
+    if (cap.use_shm) {
+        if (!cap.image || cap.width != full_width || cap.height != full_height || cap.depth != depth) {
+            shm_capture_alloc(cap, visual, depth, full_width, full_height);
+        }
+        if (cap.use_shm) {
+            shm_capture_set_view(cap, w, h, offset);
+            if (XShmGetImage(cap.dpy, drawable, cap.image, x, y, AllPlanes)) {
+                out.data = cap.image->data;
+                out.stride = cap.image->bytes_per_line;
+                out.format = pixel_format_of(cap.image);
+                offset += (size_t)cap.image->bytes_per_line * h;
+                return true;
+            }
+            std::cerr << "[WARN] XShmGetImage failed, falling back to XGetImage\n";
+            shm_capture_set_view(cap, cap.width, cap.height);
+            shm_capture_free_segment(cap);
+            cap.use_shm = false;
+        }
+    }
+
+    if (!cap.image || cap.image->width != full_width || cap.image->height != full_height) {
+        if (!shm_capture_grab(cap, drawable, visual, depth, full_width, full_height)) return false;
+    } else if (!XGetSubImage(cap.dpy, drawable, x, y, w, h, AllPlanes, ZPixmap, cap.image, x, y)) {
+        return false;
+    }
+    out.stride = cap.image->bytes_per_line;
+    out.format = pixel_format_of(cap.image);
+    out.data = cap.image->data + (size_t)y * out.stride + (size_t)x * (cap.image->bits_per_pixel / 8);
+    return true;
+}
+
+// Describe the whole image returned by shm_capture_grab as a region
+inline CaptureRegion full_region(XImage* image) {
+    CaptureRegion region;
+    region.width = image->width;
+    region.height = image->height;
+    region.data = image->data;
+    region.stride = image->bytes_per_line;
+    region.format = pixel_format_of(image);
+    return region;
+}
+
+inline void shm_capture_release(ShmCapture& cap) {
+    if (cap.use_shm) {
+        shm_capture_free_segment(cap);
+    } else if (cap.image) {
+        XDestroyImage(cap.image);
+        cap.image = nullptr;
+    }
+}
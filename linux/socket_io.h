@@ -0,0 +1,23 @@
+#pragma once
+
+// Blocking socket helpers shared by the server's stream and input paths.
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cerrno>
+#include <cstddef>
+
+// Send the whole buffer, retrying on short writes
+inline bool send_all(int sock, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        ssize_t n = send(sock, p, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
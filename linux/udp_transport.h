@@ -0,0 +1,155 @@
+#pragma once
+
+// Server side of the UDP video transport (common/udp_protocol.h).
+//
+// One non-blocking socket on the video port, shared by every session and
+// read by the server's event loop: a client's UDP_HELLO subscribes it, and
+// its keepalives and keyframe requests come back on the same socket. Each
+// session streams to its peer through its own UdpTransport, which only
+// borrows the socket.
+//
+// `loss` drops that fraction of outgoing packets at random, to exercise
+// FEC and keyframe recovery over loopback without root. For delay and
+// reordering as well, use netem on the loopback device instead, e.g.
+//   tc qdisc add dev lo root netem loss 2% delay 20ms 5ms
+//   tc qdisc del dev lo root
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../common/udp_protocol.h"
+
+#define UDP_SOCKET_BUFFER (4 * 1024 * 1024)   // room for a keyframe burst
+
+struct UdpTransport {
+    int fd = -1;                    // shared video socket, not owned
+    sockaddr_in peer{};
+    bool has_peer = false;
+    int fec_group = 0;              // 0: no parity
+    double loss = 0;                // simulated packet loss, 0..1
+
+    uint32_t frame_id = 0;
+    uint32_t seq = 0;
+    std::vector<std::vector<uint8_t>> packets;
+    std::mt19937 rng{std::random_device{}()};
+
+    // steady_clock milliseconds of the last packet from and to the peer
+    long long last_heard_ms = 0;
+    long long last_sent_ms = 0;
+    std::vector<uint8_t> control;
+
+    uint64_t packets_sent = 0;
+    uint64_t packets_dropped = 0;   // by the loss simulation
+};
+
+inline long long udp_now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Open the shared video socket. Returns the fd, or -1.
+inline int udp_socket_open(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("udp socket");
+        return -1;
+    }
+    int size = UDP_SOCKET_BUFFER;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("udp bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read one waiting packet. Returns false once there are none left.
+// Malformed packets come back with kind -1.
+inline bool udp_socket_receive(int fd, sockaddr_in& from, int& kind) {
+    uint8_t buf[UDP_MAX_PACKET];
+    socklen_t from_len = sizeof(from);
+    ssize_t n;
+    do {
+        n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &from_len);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return false;
+    UdpHeader h;
+    kind = udp_get_header(buf, (size_t)n, h) ? h.kind : -1;
+    return true;
+}
+
+inline bool udp_same_peer(const sockaddr_in& a, const sockaddr_in& b) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+// Start streaming to `peer` over the shared socket `fd`
+inline void udp_transport_open(UdpTransport& t, int fd, const sockaddr_in& peer) {
+    t.fd = fd;
+    t.peer = peer;
+    t.has_peer = true;
+    t.last_heard_ms = t.last_sent_ms = udp_now_ms();
+    std::cout << "[UDP] Client " << inet_ntoa(peer.sin_addr) << ":" << ntohs(peer.sin_port) << "\n";
+}
+
+inline bool udp_transport_peer_alive(const UdpTransport& t) {
+    return udp_now_ms() - t.last_heard_ms < UDP_PEER_TIMEOUT_MS;
+}
+
+// Send one frame message (type byte first, no length prefix)
+inline bool udp_transport_send(UdpTransport& t, const uint8_t* frame, size_t size, bool keyframe) {
+    t.last_sent_ms = udp_now_ms();
+    size_t count = 0;
+    if (!udp_packetize(frame, size, t.frame_id++, keyframe ? UDP_FLAG_KEYFRAME : 0, t.fec_group, t.seq,
+                       t.packets, count)) {
+        std::cerr << "[UDP] Frame of " << size << " bytes is too large\n";
+        return true;
+    }
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    for (size_t i = 0; i < count; i++) {
+        if (t.loss > 0 && chance(t.rng) < t.loss) {
+            t.packets_dropped++;
+            continue;
+        }
+        const std::vector<uint8_t>& pkt = t.packets[i];
+        ssize_t n;
+        do {
+            n = sendto(t.fd, pkt.data(), pkt.size(), 0, (const sockaddr*)&t.peer, sizeof(t.peer));
+        } while (n < 0 && errno == EINTR);
+        if (n >= 0) {
+            t.packets_sent++;
+        } else if (errno != ENOBUFS && errno != EAGAIN) {
+            // A full queue on a datagram socket is just loss; anything else is fatal
+            perror("udp send");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Tell the peer the stream is still there if no frame went out for a
+// keepalive interval, as when the window does not change
+inline void udp_transport_keepalive(UdpTransport& t) {
+    long long now = udp_now_ms();
+    if (now - t.last_sent_ms < UDP_HELLO_INTERVAL_MS) return;
+    t.last_sent_ms = now;
+    udp_control_packet(t.control, UDP_HELLO);
+    ssize_t n;
+    do {
+        n = sendto(t.fd, t.control.data(), t.control.size(), 0, (const sockaddr*)&t.peer, sizeof(t.peer));
+    } while (n < 0 && errno == EINTR);
+}
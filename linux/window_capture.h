@@ -0,0 +1,128 @@
+#pragma once
+
+// The X side of capturing one redirected window: its composite pixmap,
+// geometry and visual, kept from frame to frame.
+//
+// The pixmap is named once and named again only when the window is resized
+// or mapped again, which is when Composite allocates a new one. Geometry and
+// map state come from StructureNotify events, and the opacity atom is
+// interned once. Events are picked out of the display queue with
+// XCheckWindowEvent, which needs no round trip, so a frame costs the image
+// fetch and nothing else.
+//
+// The window is kept fully opaque while it is captured, as the capture loop
+// always did, but now by answering opacity changes instead of rewriting the
+// property every frame.
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/Xcomposite.h>
+#include <iostream>
+
+#define WINDOW_CAPTURE_EVENTS (StructureNotifyMask | PropertyChangeMask)
+
+struct WindowCapture {
+    Display* dpy = nullptr;
+    Window window = 0;
+    Pixmap pixmap = 0;
+    Visual* visual = nullptr;
+    int depth = 0;
+    int width = 0;
+    int height = 0;
+    bool mapped = false;
+    bool alive = false;             // the window still exists
+    bool stale = true;              // the pixmap has to be named (again)
+    bool renamed = false;           // a new pixmap was named; cleared by the caller
+    Atom opacity_atom = None;
+    int own_opacity_writes = 0;     // PropertyNotify events still due for our writes
+};
+
+inline void window_capture_set_opaque(WindowCapture& c) {
+    if (c.opacity_atom == None) return;
+    unsigned long opacity = 0xFFFFFFFF;
+    XChangeProperty(c.dpy, c.window, c.opacity_atom, XA_CARDINAL, 32, PropModeReplace,
+                    (unsigned char*)&opacity, 1);
+    c.own_opacity_writes++;
+}
+
+// Start watching `window`. The only round trip is reading its attributes.
+inline bool window_capture_open(WindowCapture& c, Display* dpy, Window window) {
+    c.dpy = dpy;
+    c.window = window;
+    XSelectInput(dpy, window, WINDOW_CAPTURE_EVENTS);
+
+    XWindowAttributes attr;
+    if (!XGetWindowAttributes(dpy, window, &attr)) {
+        std::cerr << "[CAPTURE] Window " << window << " does not exist\n";
+        return false;
+    }
+    c.visual = attr.visual;
+    c.depth = attr.depth;
+    c.width = attr.width;
+    c.height = attr.height;
+    c.mapped = attr.map_state == IsViewable;
+    c.alive = true;
+    c.stale = true;
+    c.opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
+    window_capture_set_opaque(c);
+    XFlush(dpy);
+    return true;
+}
+
+// Apply the window's queued events and name a new pixmap if one is due.
+// Returns false once the window has been destroyed.
+inline bool window_capture_update(WindowCapture& c) {
+    XEvent ev;
+    while (XCheckWindowEvent(c.dpy, c.window, WINDOW_CAPTURE_EVENTS, &ev)) {
+        switch (ev.type) {
+        case ConfigureNotify:
+            if (ev.xconfigure.width != c.width || ev.xconfigure.height != c.height) {
+                c.width = ev.xconfigure.width;
+                c.height = ev.xconfigure.height;
+                c.stale = true;
+            }
+            break;
+        case MapNotify:
+            c.mapped = true;
+            c.stale = true;
+            break;
+        case UnmapNotify:
+            c.mapped = false;
+            break;
+        case DestroyNotify:
+            c.alive = false;
+            break;
+        case PropertyNotify:
+            if (ev.xproperty.atom != c.opacity_atom) break;
+            if (c.own_opacity_writes > 0) c.own_opacity_writes--;
+            else window_capture_set_opaque(c);
+            break;
+        }
+    }
+    if (!c.alive) return false;
+
+    if (c.stale && c.mapped) {
+        if (c.pixmap) XFreePixmap(c.dpy, c.pixmap);
+        c.pixmap = XCompositeNameWindowPixmap(c.dpy, c.window);
+        c.stale = false;
+        c.renamed = true;
+    }
+    return true;
+}
+
+// Whether there is something to grab right now
+inline bool window_capture_ready(const WindowCapture& c) {
+    return c.mapped && c.pixmap && c.width > 0 && c.height > 0;
+}
+
+inline void window_capture_close(WindowCapture& c) {
+    if (!c.dpy) return;
+    if (c.pixmap) XFreePixmap(c.dpy, c.pixmap);
+    if (c.alive) XSelectInput(c.dpy, c.window, NoEventMask);
+    // Don't leave this window's events behind in the shared queue
+    XEvent ev;
+    while (XCheckWindowEvent(c.dpy, c.window, WINDOW_CAPTURE_EVENTS, &ev)) {
+    }
+    XFlush(c.dpy);
+    c = WindowCapture{};
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+// In-memory copy of the window tree: parent, children, title, geometry and
+// map state of every window, so looking a window up by title or finding one
+// dragged off screen costs no X round trips.
+//
+// The tree is read once when the index is opened and then kept current from
+// events on a private display connection: SubstructureNotify on every window
+// reports its children being created, destroyed, moved, mapped and
+// reparented, and PropertyNotify reports title changes. Only new windows and
+// new titles are fetched from the server. The server's event loop waits on
+// window_index_fd() and calls window_index_dispatch().
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct WindowInfo {
+    Window parent = 0;
+    std::vector<Window> children;   // bottom to top, as XQueryTree lists them
+    std::string title;              // WM_NAME
+    int x = 0;                      // relative to the parent
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    int border = 0;
+    bool mapped = false;
+};
+
+struct WindowIndex {
+    Display* dpy = nullptr;         // private connection, owned by the index
+    Window root = 0;
+    std::unordered_map<Window, WindowInfo> windows;
+    bool changed = false;           // set on every update, cleared by the caller
+};
+
+inline void window_index_fetch_title(WindowIndex& idx, Window w, WindowInfo& info) {
+    char* name = nullptr;
+    info.title.clear();
+    if (XFetchName(idx.dpy, w, &name) && name) {
+        info.title = name;
+        XFree(name);
+    }
+}
+
+// Add `w` under `parent` and, with `recurse`, everything below it
+inline void window_index_add(WindowIndex& idx, Window w, Window parent, bool recurse) {
+    // Select first, so nothing that happens after the reads below is missed.
+    // New windows are read with their children too, for the ones created
+    // before the selection took effect.
+    XSelectInput(idx.dpy, w, SubstructureNotifyMask | PropertyChangeMask);
+
+    XWindowAttributes attr;
+    if (!XGetWindowAttributes(idx.dpy, w, &attr)) return;   // already gone
+
+    WindowInfo& info = idx.windows[w];
+    info.parent = parent;
+    info.x = attr.x;
+    info.y = attr.y;
+    info.width = attr.width;
+    info.height = attr.height;
+    info.border = attr.border_width;
+    info.mapped = attr.map_state != IsUnmapped;
+    window_index_fetch_title(idx, w, info);
+    auto up = idx.windows.find(parent);
+    if (up != idx.windows.end()) {
+        std::vector<Window>& siblings = up->second.children;
+        if (std::find(siblings.begin(), siblings.end(), w) == siblings.end()) siblings.push_back(w);
+    }
+    idx.changed = true;
+    if (!recurse) return;
+
+    Window root_return, parent_return;
+    Window* children = nullptr;
+    unsigned int nchildren = 0;
+    if (!XQueryTree(idx.dpy, w, &root_return, &parent_return, &children, &nchildren)) return;
+    for (unsigned int i = 0; i < nchildren; i++) window_index_add(idx, children[i], w, true);
+    if (children) XFree(children);
+}
+
+// Make `w` the topmost child of `parent`
+inline void window_index_move(WindowIndex& idx, Window w, WindowInfo& info, Window parent) {
+    auto old_parent = idx.windows.find(info.parent);
+    if (old_parent != idx.windows.end()) {
+        std::vector<Window>& siblings = old_parent->second.children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), w), siblings.end());
+    }
+    info.parent = parent;
+    auto new_parent = idx.windows.find(parent);
+    if (new_parent != idx.windows.end()) new_parent->second.children.push_back(w);
+}
+
+// Drop `w` and everything below it
+inline void window_index_remove(WindowIndex& idx, Window w) {
+    auto it = idx.windows.find(w);
+    if (it == idx.windows.end()) return;
+    auto parent = idx.windows.find(it->second.parent);
+    if (parent != idx.windows.end()) {
+        std::vector<Window>& siblings = parent->second.children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), w), siblings.end());
+    }
+    std::vector<Window> pending = {w};
+    while (!pending.empty()) {
+        Window next = pending.back();
+        pending.pop_back();
+        auto entry = idx.windows.find(next);
+        if (entry == idx.windows.end()) continue;
+        pending.insert(pending.end(), entry->second.children.begin(), entry->second.children.end());
+        idx.windows.erase(entry);
+    }
+    idx.changed = true;
+}
+
+inline bool window_index_open(WindowIndex& idx, const char* display_name) {
+    idx.dpy = XOpenDisplay(display_name);
+    if (!idx.dpy) return false;
+    idx.root = DefaultRootWindow(idx.dpy);
+    // The whole tree in one server grab, so it can't change halfway through
+    XGrabServer(idx.dpy);
+    window_index_add(idx, idx.root, 0, true);
+    XUngrabServer(idx.dpy);
+    XFlush(idx.dpy);
+    return true;
+}
+
+inline void window_index_close(WindowIndex& idx) {
+    if (idx.dpy) XCloseDisplay(idx.dpy);
+    idx = WindowIndex{};
+}
+
+inline int window_index_fd(const WindowIndex& idx) {
+    return ConnectionNumber(idx.dpy);
+}
+
+// Apply whatever events have arrived, without blocking
+inline void window_index_dispatch(WindowIndex& idx) {
+    while (XPending(idx.dpy)) {
+        XEvent ev;
+        XNextEvent(idx.dpy, &ev);
+        switch (ev.type) {
+        case CreateNotify:
+            window_index_add(idx, ev.xcreatewindow.window, ev.xcreatewindow.parent, true);
+            break;
+        case DestroyNotify:
+            window_index_remove(idx, ev.xdestroywindow.window);
+            break;
+        case ConfigureNotify: {
+            auto it = idx.windows.find(ev.xconfigure.window);
+            if (it == idx.windows.end()) break;
+            it->second.x = ev.xconfigure.x;
+            it->second.y = ev.xconfigure.y;
+            it->second.width = ev.xconfigure.width;
+            it->second.height = ev.xconfigure.height;
+            it->second.border = ev.xconfigure.border_width;
+            idx.changed = true;
+            break;
+        }
+        case MapNotify:
+        case UnmapNotify: {
+            Window w = ev.type == MapNotify ? ev.xmap.window : ev.xunmap.window;
+            auto it = idx.windows.find(w);
+            if (it == idx.windows.end()) break;
+            it->second.mapped = ev.type == MapNotify;
+            idx.changed = true;
+            break;
+        }
+        case ReparentNotify: {
+            // Reported to both the old and the new parent; act on the
+            // second. The subtree keeps its contents, so it is only moved.
+            if (ev.xreparent.event != ev.xreparent.parent) break;
+            Window w = ev.xreparent.window;
+            auto it = idx.windows.find(w);
+            if (it == idx.windows.end()) {
+                window_index_add(idx, w, ev.xreparent.parent, true);
+                break;
+            }
+            window_index_move(idx, w, it->second, ev.xreparent.parent);
+            it->second.x = ev.xreparent.x;
+            it->second.y = ev.xreparent.y;
+            idx.changed = true;
+            break;
+        }
+        case PropertyNotify: {
+            if (ev.xproperty.atom != XA_WM_NAME) break;
+            auto it = idx.windows.find(ev.xproperty.window);
+            if (it == idx.windows.end()) break;
+            window_index_fetch_title(idx, it->first, it->second);
+            idx.changed = true;
+            break;
+        }
+        }
+    }
+}
+
+// Position of `w`'s inside on the root, like XTranslateCoordinates
+inline bool window_index_root_position(const WindowIndex& idx, Window w, int& x, int& y) {
+    x = y = 0;
+    while (w != idx.root) {
+        auto it = idx.windows.find(w);
+        if (it == idx.windows.end()) return false;
+        x += it->second.x + it->second.border;
+        y += it->second.y + it->second.border;
+        w = it->second.parent;
+    }
+    return true;
+}
+
+// Mapped, and so are all its ancestors
+inline bool window_index_viewable(const WindowIndex& idx, Window w) {
+    while (w != idx.root) {
+        auto it = idx.windows.find(w);
+        if (it == idx.windows.end() || !it->second.mapped) return false;
+        w = it->second.parent;
+    }
+    return true;
+}
+
+// True if the window lies entirely outside the screen
+inline bool window_index_offscreen(const WindowIndex& idx, Window w) {
+    auto it = idx.windows.find(w);
+    int x, y;
+    if (it == idx.windows.end() || !window_index_root_position(idx, w, x, y)) return false;
+    int screen_width = DisplayWidth(idx.dpy, DefaultScreen(idx.dpy));
+    int screen_height = DisplayHeight(idx.dpy, DefaultScreen(idx.dpy));
+    return x + it->second.width < 0 || x > screen_width ||
+           y + it->second.height < 0 || y > screen_height;
+}
+
+// First window, depth first from `under` (the root by default), whose
+// title contains `title_substr`
+inline Window window_index_find_title(const WindowIndex& idx, const char* title_substr, Window under = 0) {
+    std::vector<Window> pending = {under ? under : idx.root};
+    while (!pending.empty()) {
+        Window w = pending.back();
+        pending.pop_back();
+        auto it = idx.windows.find(w);
+        if (it == idx.windows.end()) continue;
+        if (it->second.title.find(title_substr) != std::string::npos) return w;
+        pending.insert(pending.end(), it->second.children.rbegin(), it->second.children.rend());
+    }
+    return 0;
+}
+
+// First viewable top-level window that is entirely off screen
+inline Window window_index_find_offscreen(const WindowIndex& idx) {
+    auto root = idx.windows.find(idx.root);
+    if (root == idx.windows.end()) return 0;
+    for (Window w : root->second.children) {
+        if (window_index_viewable(idx, w) && window_index_offscreen(idx, w)) return w;
+    }
+    return 0;
+}
@@ -4,55 +4,186 @@
 #include <X11/Xutil.h>
 #include <opencv2/opencv.hpp>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <cstring>
+#include <string>
 #include <thread>
+#include "../linux/shm_capture.h"
+#include "../common/frame_queue.h"
+#include "../common/frame_pool.h"
+#include "../common/frame_scheduler.h"
 
 #define WIDTH  1280
 #define HEIGHT 720
 #define PORT   12345
 #define CLIENT_IP "192.168.0.26"  // Change to the receiver's IP
+#define TARGET_FPS 30
+#define MIN_FPS 2                  // when the display is static
+#define CONNECT_TIMEOUT_MS 500
+#define RECONNECT_DELAY_MS 1000
+#define LOCAL_QUEUE_DEPTH 2
 
-cv::Mat capture_frame(Display* display, Window root) {
-    XImage* img = XGetImage(display, root, 0, 0, WIDTH, HEIGHT, AllPlanes, ZPixmap);
-    cv::Mat frame(HEIGHT, WIDTH, CV_8UC4, img->data);
-    cv::Mat bgr;
-    cv::cvtColor(frame, bgr, cv::COLOR_BGRA2BGR);
-    cv::Mat cloned = bgr.clone();
-    XDestroyImage(img);
-    return cloned;
+std::atomic<bool> running{true};
+
+// Grab the screen into `bgr`, which keeps its memory from the last time it
+// was used. Returns false if the grab failed.
+bool capture_frame(ShmCapture& capture, Window root, cv::Mat& bgr) {
+    Display* display = capture.dpy;
+    int screen = DefaultScreen(display);
+    XImage* img = shm_capture_grab(capture, root, DefaultVisual(display, screen),
+                                   DefaultDepth(display, screen), WIDTH, HEIGHT);
+    if (!img) return false;
+    bgr.create(HEIGHT, WIDTH, CV_8UC3);
+    if (!convert_to_bgr(pixel_format_of(img), (const uint8_t*)img->data, img->bytes_per_line,
+                        bgr.data, (int)bgr.step, WIDTH, HEIGHT)) {
+        cv::Mat frame(HEIGHT, WIDTH, CV_8UC4, img->data, img->bytes_per_line);
+        cv::cvtColor(frame, bgr, cv::COLOR_BGRA2BGR);
+    }
+    return true;
 }
 
-void stream_frame(const cv::Mat& frame) {
-    std::vector<uchar> buffer;
-    cv::imencode(".jpg", frame, buffer);
+bool send_all(int sock, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        ssize_t n = send(sock, p, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
 
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
+bool recv_all(int sock, void* data, size_t size) {
+    char* p = (char*)data;
+    while (size > 0) {
+        ssize_t n = recv(sock, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Connect with a timeout, so an unreachable viewer does not stall capture
+// for the kernel's SYN timeout. Returns the socket or -1.
+int connect_with_timeout(const char* ip, int port, int timeout_ms) {
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(PORT);
-    inet_pton(AF_INET, CLIENT_IP, &addr.sin_addr);
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) return -1;
 
-    if (connect(sock, (sockaddr*)&addr, sizeof(addr)) >= 0) {
-        uint32_t size = htonl(buffer.size());
-        send(sock, &size, sizeof(size), 0);
-        send(sock, buffer.data(), buffer.size(), 0);
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    int ret = connect(sock, (sockaddr*)&addr, sizeof(addr));
+    if (ret < 0 && errno == EINPROGRESS) {
+        pollfd pfd{sock, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (poll(&pfd, 1, timeout_ms) == 1 && getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+            ret = 0;
+        }
+    }
+    if (ret < 0) {
+        close(sock);
+        return -1;
     }
-    close(sock);
+    fcntl(sock, F_SETFL, flags);
+    return sock;
+}
+
+// One long-lived connection to the viewer, re-established when it drops
+struct FrameSender {
+    int sock = -1;
+    std::chrono::steady_clock::time_point next_attempt{};
+    std::vector<uchar> jpeg;        // reused for every frame
+};
+
+// Make sure the sender is connected. Returns true if a new connection was
+// just made, i.e. the viewer has nothing on screen yet.
+bool ensure_connected(FrameSender& sender) {
+    if (sender.sock >= 0) return false;
+    auto now = std::chrono::steady_clock::now();
+    if (now < sender.next_attempt) return false;
+    sender.next_attempt = now + std::chrono::milliseconds(RECONNECT_DELAY_MS);
+
+    sender.sock = connect_with_timeout(CLIENT_IP, PORT, CONNECT_TIMEOUT_MS);
+    if (sender.sock < 0) return false;
+    std::cout << "[SERVER] Connected to viewer " << CLIENT_IP << ":" << PORT << "\n";
+    return true;
 }
 
-void run_server() {
+bool stream_frame(FrameSender& sender, const cv::Mat& frame) {
+    std::vector<uchar>& buffer = sender.jpeg;
+    cv::imencode(".jpg", frame, buffer);
+
+    uint32_t size = htonl(buffer.size());
+    if (!send_all(sender.sock, &size, sizeof(size)) || !send_all(sender.sock, buffer.data(), buffer.size())) {
+        std::cerr << "[SERVER] Viewer connection lost, reconnecting\n";
+        close(sender.sock);
+        sender.sock = -1;
+        return false;
+    }
+    return true;
+}
+
+// `local` set: hand frames to the in-process viewer instead of the network
+void run_server(FrameQueue<std::shared_ptr<cv::Mat>>* local) {
     Display* display = XOpenDisplay(nullptr);
+    if (!display) {
+        std::cerr << "Cannot open display\n";
+        running = false;
+        if (local) local->close();
+        return;
+    }
     Window root = DefaultRootWindow(display);
+    ShmCapture capture;
+    shm_capture_init(capture, display);
+    FrameScheduler scheduler(TARGET_FPS, MIN_FPS, TARGET_FPS);
+    FrameSender sender;
+    // Frames are grabbed into pooled images: one for the last frame, one
+    // being grabbed and whatever the local viewer still holds
+    FramePool<cv::Mat> pool;
+    std::shared_ptr<cv::Mat> last;
 
-    while (true) {
-        cv::Mat frame = capture_frame(display, root);
-        stream_frame(frame);
-        usleep(33000); // ~30 FPS
+    while (running) {
+        std::shared_ptr<cv::Mat> frame = pool.acquire();
+        bool grabbed = capture_frame(capture, root, *frame);
+        // Only send when the picture actually changed; the viewer keeps the last one
+        bool changed = grabbed &&
+                       (!last || memcmp(frame->data, last->data, frame->total() * frame->elemSize()) != 0);
+        if (grabbed) {
+            if (local) {
+                // The viewer holds the image until it's done, so the pool
+                // doesn't hand it out meanwhile
+                if (changed) local->push(frame);
+            } else {
+                bool fresh = ensure_connected(sender);
+                if (sender.sock >= 0 && (changed || fresh)) stream_frame(sender, *frame);
+            }
+        }
+        if (changed) last = frame;
+        scheduler.wait(changed);
     }
 
+    if (sender.sock >= 0) close(sender.sock);
+    if (local) local->close();
+
+    shm_capture_release(capture);
     XCloseDisplay(display);
 }
 
@@ -60,46 +191,93 @@ void run_server() {
 
 void run_client() {
     int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
     sockaddr_in server_addr{};
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(PORT);
     server_addr.sin_addr.s_addr = INADDR_ANY;
 
-    bind(server_sock, (sockaddr*)&server_addr, sizeof(server_addr));
-    listen(server_sock, 1);
-
-    std::cout << "Waiting for connection...\n";
-    int client_sock = accept(server_sock, nullptr, nullptr);
-    std::cout << "Client connected.\n";
-
-    while (true) {
-        uint32_t size_net;
-        if (recv(client_sock, &size_net, sizeof(size_net), MSG_WAITALL) <= 0) break;
-        uint32_t size = ntohl(size_net);
+    if (bind(server_sock, (sockaddr*)&server_addr, sizeof(server_addr)) < 0 || listen(server_sock, 1) < 0) {
+        perror("bind");
+        close(server_sock);
+        running = false;
+        return;
+    }
 
-        std::vector<uchar> buffer(size);
-        int received = 0;
-        while (received < size) {
-            int r = recv(client_sock, buffer.data() + received, size - received, 0);
-            if (r <= 0) break;
-            received += r;
+    // Keep taking connections: the streamer reconnects after every drop
+    while (running) {
+        std::cout << "Waiting for connection...\n";
+        int client_sock = accept(server_sock, nullptr, nullptr);
+        if (client_sock < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
         }
+        std::cout << "Client connected.\n";
 
-        cv::Mat frame = cv::imdecode(buffer, cv::IMREAD_COLOR);
-        if (!frame.empty()) {
-            cv::imshow("Remote", frame);
-            if (cv::waitKey(1) == 27) break;
+        std::vector<uchar> buffer;
+        cv::Mat frame;
+        while (running) {
+            uint32_t size_net;
+            if (!recv_all(client_sock, &size_net, sizeof(size_net))) break;
+            buffer.resize(ntohl(size_net));
+            if (!recv_all(client_sock, buffer.data(), buffer.size())) break;
+
+            cv::imdecode(buffer, cv::IMREAD_COLOR, &frame);
+            if (!frame.empty()) {
+                cv::imshow("Remote", frame);
+                if (cv::waitKey(1) == 27) running = false;
+            }
         }
+        close(client_sock);
+        std::cout << "Client disconnected.\n";
     }
 
-    close(client_sock);
     close(server_sock);
 }
 
-int main() {
-    std::thread server(run_server);
+// In-process viewer: frames come straight from the capture thread, with no
+// socket and no JPEG round trip
+void run_local_client(FrameQueue<std::shared_ptr<cv::Mat>>& frames) {
+    std::shared_ptr<cv::Mat> frame;
+    while (running) {
+        if (frames.try_pop(frame)) {
+            cv::imshow("Remote", *frame);
+            frame.reset();
+        }
+        // Also keeps the window responsive while the display is idle
+        if (cv::waitKey(10) == 27) running = false;
+    }
+}
+
+int main(int argc, char** argv) {
+    bool local = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--local") {
+            local = true;
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--local]\n"
+                      << "  --local   show the display in this process, without the network\n";
+            return 1;
+        }
+    }
+
+    if (local) {
+        // Newest frames win: a slow viewer skips frames instead of lagging
+        FrameQueue<std::shared_ptr<cv::Mat>> frames(LOCAL_QUEUE_DEPTH, QueuePolicy::DropOldest);
+        std::thread server(run_server, &frames);
+        run_local_client(frames);
+        running = false;
+        server.join();
+        return 0;
+    }
+
+    std::thread server(run_server, nullptr);
     std::thread client(run_client);
-    server.join();
     client.join();
+    running = false;
+    server.join();
     return 0;
 }
\ No newline at end of file
@@ -1,175 +1,478 @@
 #include <QApplication>
 #include <QMainWindow>
-#include <QLabel>
+#include <QWidget>
 #include <QImage>
-#include <QPixmap>
+#include <QPainter>
 #include <QTimer>
 #include <QKeyEvent>
 #include <QMouseEvent>
+#include <QResizeEvent>
+#include <QWheelEvent>
+#include <algorithm>
+#include <iostream>
 #include <thread>
 #include <mutex>
 #include <atomic>
-#include <winsock2.h>
-#include <ws2tcpip.h>
 #include <opencv2/opencv.hpp>
-#include <nlohmann/json.hpp>
-
-#pragma comment(lib, "Ws2_32.lib")
-
-using json = nlohmann::json;
+#include "../common/input_protocol.h"
+#include "../common/input_json.h"
+#include "net_socket.h"
+#include "video_receiver.h"
+#include "frame_mailbox.h"
+#include "cursor_receiver.h"
 
 #define SERVER_IP "192.168.0.26"
 #define VIDEO_PORT 12345
 #define INPUT_PORT 12346
 #define RECONNECT_DELAY 2000 // ms
+#define INPUT_HELLO_TIMEOUT 1000 // ms to wait for the server to accept binary input
+#define INPUT_FLUSH_MS 10   // input is sent in batches this often
+#define RECEIVE_IDLE_MS 10  // receive threads poll while there is no socket
+#define FRAME_POLL_MS 10      // longest wait for a frame before checking for shutdown
+#define VIEWPORT_SETTLE_MS 250  // a resize is reported once it stops for this long
 
-SOCKET video_sock = INVALID_SOCKET;
-SOCKET input_sock = INVALID_SOCKET;
+// The receive thread reads the video socket, the cursor thread the input
+// socket and the UI thread writes it; the connect threads fill them in
+std::atomic<SOCKET> video_sock(INVALID_SOCKET);
+std::atomic<SOCKET> input_sock(INVALID_SOCKET);
 std::atomic<bool> is_getting_vid_sock(false);
 std::atomic<bool> is_getting_in_sock(false);
-std::mutex click_mutex;
-json click_position;
-
-SOCKET connectSocket(const char* ip, int port) {
-    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &serverAddr.sin_addr);
-    if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        closesocket(sock);
-        return INVALID_SOCKET;
-    }
-    return sock;
+std::atomic<bool> input_binary(false);  // server accepted the binary input protocol
+std::atomic<bool> input_acks(false);    // and display acks (version 2)
+std::atomic<bool> input_viewport(false);  // and viewport sizes (version 3)
+std::atomic<bool> input_cursor(false);  // and sends the cursor (version 4)
+// Size the frame view shows the stream at, in device pixels, width << 16 |
+// height, and whether the server has yet to hear it
+std::atomic<uint32_t> viewport_size(0);
+std::atomic<bool> viewport_changed(false);
+bool use_udp = false;                   // --udp: video over udp_video.h instead of TCP
+UdpVideo udp_video;
+
+// Events collected since the last flush, sent as one batch
+std::mutex input_mutex;
+std::vector<InputEvent> pending_input;
+
+void queueInput(InputEvent ev) {
+    ev.time_ms = input_time_ms();
+    std::lock_guard<std::mutex> lock(input_mutex);
+    pending_input.push_back(ev);
+}
+
+// Offer the binary input protocol. Servers that predate it never answer the
+// hello, so give up after a moment and keep sending JSON. Returns the version
+// the server speaks, 0 for JSON.
+uint8_t negotiateInput(SOCKET sock) {
+    std::vector<uint8_t> hello;
+    put_u32(hello, INPUT_HELLO_SIZE);
+    input_hello(hello);
+    if (!sendAll(sock, hello.data(), hello.size())) return 0;
+
+    setRecvTimeout(sock, INPUT_HELLO_TIMEOUT);
+    char ack[4 + INPUT_HELLO_SIZE];
+    uint8_t version = 0;
+    bool ok = recvAll(sock, ack, sizeof(ack)) && get_u32((const uint8_t*)ack) == INPUT_HELLO_SIZE &&
+              input_is_hello((const uint8_t*)ack + 4, INPUT_HELLO_SIZE, version) && version >= 1;
+    setRecvTimeout(sock, 0);
+    return ok ? version : 0;
 }
 
-bool recvAll(SOCKET sock, char* buffer, int total) {
-    int received = 0;
-    while (received < total) {
-        int ret = recv(sock, buffer + received, total - received, 0);
-        if (ret <= 0) return false;
-        received += ret;
+// Send everything queued since the last call as one message, after the
+// viewport size if the server has not heard it yet
+void flushInput() {
+    std::vector<InputEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(input_mutex);
+        events.swap(pending_input);
     }
-    return true;
+    SOCKET sock = input_sock;
+    if (sock == INVALID_SOCKET) return;
+    std::vector<uint8_t> msg;
+    if (input_viewport && viewport_changed.exchange(false)) {
+        uint32_t size = viewport_size;
+        input_encode_viewport((int)(size >> 16), (int)(size & 0xffff), msg);
+    }
+    if (input_binary) input_encode_batch(events.data(), events.size(), msg);
+    else input_encode_json(events.data(), events.size(), msg);
+    if (!msg.empty()) sendAll(sock, msg.data(), msg.size());
+}
+
+// Tell the server which frame is on screen now, for its latency numbers
+void ackFrame(const FrameHeader& shown) {
+    SOCKET sock = input_sock;
+    if (!input_acks || sock == INVALID_SOCKET) return;
+    std::vector<uint8_t> msg;
+    input_encode_ack(shown, msg);
+    sendAll(sock, msg.data(), msg.size());
 }
 
+void connectVideo() {
+    is_getting_vid_sock = true;
+    while (video_sock == INVALID_SOCKET) {
+        SOCKET sock = use_udp ? udpVideoOpen(udp_video, SERVER_IP, VIDEO_PORT)
+                              : connectSocket(SERVER_IP, VIDEO_PORT);
+        if (sock != INVALID_SOCKET) {
+            video_sock = sock;
+            std::cout << "[CLIENT] Connected to video stream\n";
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
+        }
+    }
+    is_getting_vid_sock = false;
+}
+
+void connectInput() {
+    is_getting_in_sock = true;
+    while (input_sock == INVALID_SOCKET) {
+        SOCKET sock = connectSocket(SERVER_IP, INPUT_PORT);
+        if (sock != INVALID_SOCKET) {
+            uint8_t version = negotiateInput(sock);
+            input_binary = version >= 1;
+            input_acks = version >= INPUT_ACK_VERSION;
+            input_viewport = version >= INPUT_VIEWPORT_VERSION;
+            input_cursor = version >= INPUT_CURSOR_VERSION;
+            input_sock = sock;
+            // A new connection starts at full size; tell it ours
+            viewport_changed = true;
+            std::cout << "[CLIENT] Connected to input control (" << (input_binary ? "binary" : "json") << ")\n";
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
+        }
+    }
+    is_getting_in_sock = false;
+}
+
+uint8_t buttonFromQt(Qt::MouseButton button) {
+    switch (button) {
+    case Qt::RightButton: return 3;
+    case Qt::MiddleButton: return 2;
+    default: return 1;
+    }
+}
+
+uint32_t keysymFromQt(QKeyEvent* event) {
+    switch (event->key()) {
+    case Qt::Key_Return:
+    case Qt::Key_Enter: return INPUT_KEYSYM_RETURN;
+    case Qt::Key_Backspace: return INPUT_KEYSYM_BACKSPACE;
+    case Qt::Key_Tab: return INPUT_KEYSYM_TAB;
+    case Qt::Key_Escape: return INPUT_KEYSYM_ESCAPE;
+    case Qt::Key_Delete: return INPUT_KEYSYM_DELETE;
+    case Qt::Key_Left: return INPUT_KEYSYM_LEFT;
+    case Qt::Key_Up: return INPUT_KEYSYM_UP;
+    case Qt::Key_Right: return INPUT_KEYSYM_RIGHT;
+    case Qt::Key_Down: return INPUT_KEYSYM_DOWN;
+    }
+    QString text = event->text();
+    if (text.isEmpty()) return 0;
+    return keysym_from_char(text.at(0).unicode());
+}
+
+// Paints the newest frame scaled to fit, aspect ratio kept. Scaling happens
+// in the paint, so a frame costs the UI thread one draw and no copies. The
+// server scales its output to the view's size (viewport_size), so this is
+// normally close to 1:1. The remote cursor is drawn on top at its own size.
+class FrameView : public QWidget {
+public:
+    QImage image;   // wraps the window's current frame, no copy
+    QImage cursor;  // remote cursor shape, null while unknown or hidden
+    uint32_t cursor_serial = 0;
+    QPoint hotspot;
+    QPoint cursor_pos;  // hotspot in frame pixels
+
+    explicit FrameView(QWidget* parent = nullptr) : QWidget(parent) {}
+
+    // Where the image goes: fitted and centered
+    QRect target() const {
+        QSize fit = image.size().scaled(size(), Qt::KeepAspectRatio);
+        return QRect((width() - fit.width()) / 2, (height() - fit.height()) / 2, fit.width(), fit.height());
+    }
+
+    // Map a point on the view to frame pixels, which is what the server
+    // expects; points on the bars around the image go to its nearest edge
+    void toFrame(QPoint pos, int16_t& x, int16_t& y) const {
+        QRect t = target();
+        if (image.isNull() || t.width() <= 0 || t.height() <= 0) {
+            x = (int16_t)pos.x();
+            y = (int16_t)pos.y();
+            return;
+        }
+        int fx = (pos.x() - t.x()) * image.width() / t.width();
+        int fy = (pos.y() - t.y()) * image.height() / t.height();
+        x = (int16_t)std::min(std::max(fx, 0), image.width() - 1);
+        y = (int16_t)std::min(std::max(fy, 0), image.height() - 1);
+    }
+
+    // Where the cursor goes on the view, empty if there is none to draw
+    QRect cursorRect() const {
+        QRect t = target();
+        if (cursor.isNull() || image.isNull() || t.width() <= 0 || t.height() <= 0) return QRect();
+        int x = t.x() + (2 * cursor_pos.x() + 1) * t.width() / (2 * image.width());
+        int y = t.y() + (2 * cursor_pos.y() + 1) * t.height() / (2 * image.height());
+        return QRect(x - hotspot.x(), y - hotspot.y(), cursor.width(), cursor.height());
+    }
+
+    // Take a new cursor position, and its shape if that changed; repaints
+    // only where the cursor was and is now
+    void showCursor(const InputCursor& c, const CursorImage& shape) {
+        QRect before = cursorRect();
+        if (!c.visible || shape.bgra.empty()) {
+            cursor = QImage();
+            cursor_serial = 0;
+        } else if (shape.serial != cursor_serial || cursor.isNull()) {
+            // Premultiplied ARGB32 is B G R A in memory, the wire's order
+            cursor = QImage(shape.bgra.data, shape.bgra.cols, shape.bgra.rows, (int)shape.bgra.step,
+                            QImage::Format_ARGB32_Premultiplied).copy();
+            cursor_serial = shape.serial;
+            hotspot = QPoint(shape.xhot, shape.yhot);
+        }
+        cursor_pos = QPoint(c.x, c.y);
+        update(before);
+        update(cursorRect());
+    }
+
+protected:
+    void paintEvent(QPaintEvent*) override {
+        QPainter painter(this);
+        painter.fillRect(rect(), Qt::black);
+        if (image.isNull()) return;
+        painter.drawImage(target(), image);
+        QRect c = cursorRect();
+        if (!cursor.isNull()) painter.drawImage(QPoint(c.x(), c.y()), cursor);
+    }
+};
+
+// The UI thread only presents and collects input. A receive thread reads
+// and decodes the stream and posts each frame to a latest-wins mailbox, so
+// a slow network or decoder never blocks the UI, and the UI never shows a
+// frame older than the newest decoded one. A cursor thread does the same
+// for the cursor channel, which moves the drawn cursor between frames.
 class RemoteWindow : public QMainWindow {
     Q_OBJECT
 public:
-    QLabel* label;
+    FrameView* view;
     QTimer* timer;
 
     RemoteWindow(QWidget* parent = nullptr) : QMainWindow(parent) {
         setWindowTitle("Remote Window");
         resize(800, 600);
-        label = new QLabel(this);
-        label->setAlignment(Qt::AlignCenter);
-        setCentralWidget(label);
+        view = new FrameView(this);
+        setCentralWidget(view);
+        // Report motion without a button held too, for hover
+        view->setMouseTracking(true);
+        setMouseTracking(true);
 
+        // Frames are presented as they arrive; only input is batched
         timer = new QTimer(this);
-        connect(timer, &QTimer::timeout, this, &RemoteWindow::updateFrame);
-        timer->start(10);
+        connect(timer, &QTimer::timeout, this, flushInput);
+        timer->start(INPUT_FLUSH_MS);
+
+        // Dragging a window edge resizes continuously; only report the size
+        // it settles at, since every new size costs a keyframe
+        viewport_timer = new QTimer(this);
+        viewport_timer->setSingleShot(true);
+        connect(viewport_timer, &QTimer::timeout, this, [this] { updateViewport(); });
+
+        receiver = std::thread(&RemoteWindow::receiveLoop, this);
+        cursor_receiver = std::thread(&RemoteWindow::cursorLoop, this);
+    }
+
+    ~RemoteWindow() {
+        receiving = false;
+        // Unblocks a receive in progress; the thread doesn't reconnect after
+        shutdownSocket(video_sock.exchange(INVALID_SOCKET));
+        shutdownSocket(input_sock.exchange(INVALID_SOCKET));
+        receiver.join();
+        cursor_receiver.join();
     }
 
 protected:
     void mousePressEvent(QMouseEvent* event) override {
-        std::lock_guard<std::mutex> lock(click_mutex);
-        QString button = event->button() == Qt::LeftButton ? "left" : "right";
-        click_position = { {"type", "click"}, {"button", button.toStdString()}, {"x", event->x()}, {"y", event->y()} };
+        queueMouse(INPUT_BUTTON_DOWN, event);
+    }
+
+    void mouseReleaseEvent(QMouseEvent* event) override {
+        queueMouse(INPUT_BUTTON_UP, event);
+    }
+
+    // Qt delivers a double click as press, release, double click, release:
+    // the double click is the second press
+    void mouseDoubleClickEvent(QMouseEvent* event) override {
+        queueMouse(INPUT_BUTTON_DOWN, event);
+    }
+
+    void mouseMoveEvent(QMouseEvent* event) override {
+        queueMouse(INPUT_MOTION, event);
+    }
+
+    void resizeEvent(QResizeEvent* event) override {
+        QMainWindow::resizeEvent(event);
+        viewport_timer->start(VIEWPORT_SETTLE_MS);
+    }
+
+    void wheelEvent(QWheelEvent* event) override {
+        InputEvent ev;
+        ev.type = INPUT_WHEEL;
+        view->toFrame(view->mapFrom(this, event->position().toPoint()), ev.x, ev.y);
+        ev.dx = (int16_t)(event->angleDelta().x() / 120);
+        ev.dy = (int16_t)(event->angleDelta().y() / 120);
+        if (ev.dx || ev.dy) queueInput(ev);
     }
 
     void keyPressEvent(QKeyEvent* event) override {
-        if (input_sock == INVALID_SOCKET) return;
-        char c = event->text().toStdString()[0];
-        json key_event = { {"type", "key"}, {"key", std::string(1, c)} };
-        std::string msg = key_event.dump();
-        uint32_t len = htonl((uint32_t)msg.size());
-        send(input_sock, (char*)&len, 4, 0);
-        send(input_sock, msg.c_str(), (int)msg.size(), 0);
-    }
-
-private slots:
-    void updateFrame() {
-        if (video_sock == INVALID_SOCKET) return;
-
-        try {
-            char size_buf[4];
-            if (!recvAll(video_sock, size_buf, 4)) throw std::runtime_error("Video socket closed");
-
-            int frame_size = ntohl(*(int*)size_buf);
-            std::vector<char> buffer(frame_size);
-            if (!recvAll(video_sock, buffer.data(), frame_size)) throw std::runtime_error("Video socket closed");
-
-            cv::Mat rawData(1, frame_size, CV_8UC1, buffer.data());
-            cv::Mat frame = cv::imdecode(rawData, cv::IMREAD_COLOR);
-            if (!frame.empty()) {
-                cv::cvtColor(frame, frame, cv::COLOR_BGR2RGB);
-                QImage img(frame.data, frame.cols, frame.rows, frame.step, QImage::Format_RGB888);
-                label->setPixmap(QPixmap::fromImage(img).scaled(label->size(), Qt::KeepAspectRatio));
-            }
+        queueKey(INPUT_KEY_DOWN, event);
+    }
+
+    void keyReleaseEvent(QKeyEvent* event) override {
+        queueKey(INPUT_KEY_UP, event);
+    }
+
+private:
+    QTimer* viewport_timer;
+    FrameMailbox mailbox;
+    cv::Mat frame;                  // RGB, on screen; owned by the UI thread
+    CursorMailbox cursor_mailbox;
+    std::thread receiver;
+    std::thread cursor_receiver;
+    std::atomic<bool> receiving{true};
+
+    void queueMouse(uint8_t type, QMouseEvent* event) {
+        InputEvent ev;
+        ev.type = type;
+        if (type != INPUT_MOTION) ev.button = buttonFromQt(event->button());
+        view->toFrame(view->mapFrom(this, event->pos()), ev.x, ev.y);
+        queueInput(ev);
+    }
 
-            std::lock_guard<std::mutex> lock(click_mutex);
-            if (!click_position.is_null()) {
-                std::string msg = click_position.dump();
-                uint32_t len = htonl((uint32_t)msg.size());
-                send(input_sock, (char*)&len, 4, 0);
-                send(input_sock, msg.c_str(), (int)msg.size(), 0);
-                click_position = nullptr;
+    // Store the view's size in device pixels for the next flush to send
+    void updateViewport() {
+        double ratio = view->devicePixelRatioF();
+        uint32_t width = (uint32_t)std::min(0xffff, (int)(view->width() * ratio));
+        uint32_t height = (uint32_t)std::min(0xffff, (int)(view->height() * ratio));
+        uint32_t size = width << 16 | height;
+        if (viewport_size.exchange(size) != size) viewport_changed = true;
+    }
+
+    void queueKey(uint8_t type, QKeyEvent* event) {
+        InputEvent ev;
+        ev.type = type;
+        ev.keysym = keysymFromQt(event);
+        if (ev.keysym) queueInput(ev);
+    }
+
+    // Receive thread: decode everything the server sends, since deltas build
+    // on each other, and post the result. Converting to RGB here leaves the
+    // UI thread nothing to do but paint.
+    void receiveLoop() {
+        VideoReceiver video;
+        cv::Mat rgb;
+        while (receiving) {
+            SOCKET sock = video_sock;
+            if (sock == INVALID_SOCKET) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(RECEIVE_IDLE_MS));
+                continue;
+            }
+            try {
+                if (!receiveFrame(video, sock, use_udp ? &udp_video : nullptr, FRAME_POLL_MS)) continue;
+                cv::cvtColor(video.decoder.canvas, rgb, cv::COLOR_BGR2RGB);
+                // Only wake the UI if it has taken the last frame; otherwise
+                // it is about to, and will find this one instead
+                if (mailboxPost(mailbox, rgb, video.decoder.shown))
+                    QMetaObject::invokeMethod(this, [this] { present(); }, Qt::QueuedConnection);
+            } catch (std::exception& e) {
+                if (!receiving) break;
+                qWarning("[CLIENT] Disconnected or error: %s", e.what());
+                frame_decoder_reset(video.decoder);
+                shutdownSocket(video_sock.exchange(INVALID_SOCKET));
+                // The input socket belongs to the UI thread
+                QMetaObject::invokeMethod(this, [this] { dropInput(); }, Qt::QueuedConnection);
+                if (!is_getting_vid_sock) std::thread(connectVideo).detach();
             }
+        }
+    }
 
-        } catch (std::exception& e) {
-            qWarning("[CLIENT] Disconnected or error: %s", e.what());
-            closesocket(video_sock);
-            closesocket(input_sock);
-            video_sock = INVALID_SOCKET;
-            input_sock = INVALID_SOCKET;
-            if (!is_getting_vid_sock) std::thread(connectVideo).detach();
-            if (!is_getting_in_sock) std::thread(connectInput).detach();
+    // Cursor thread: follow the cursor channel of a server that has one. A
+    // failed read hides the cursor and has the UI thread start the input
+    // connection over.
+    void cursorLoop() {
+        while (receiving) {
+            SOCKET sock = input_sock;
+            if (sock == INVALID_SOCKET || !input_cursor) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(RECEIVE_IDLE_MS));
+                continue;
+            }
+            CursorReceiver cursor;
+            try {
+                while (receiving) {
+                    if (!receiveCursor(cursor, sock)) continue;
+                    postCursor(cursor.cursor, cursorShape(cursor));
+                }
+            } catch (std::exception& e) {
+                if (!receiving) break;
+                qWarning("[CLIENT] Input connection lost: %s", e.what());
+                postCursor(InputCursor{}, nullptr);
+                // The video side may have started over already
+                QMetaObject::invokeMethod(this, [this, sock] { if (input_sock == sock) dropInput(); },
+                                          Qt::QueuedConnection);
+                while (receiving && input_sock == sock)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(RECEIVE_IDLE_MS));
+            }
         }
     }
-};
 
-void connectVideo() {
-    is_getting_vid_sock = true;
-    while (video_sock == INVALID_SOCKET) {
-        video_sock = connectSocket(SERVER_IP, VIDEO_PORT);
-        if (video_sock != INVALID_SOCKET)
-            std::cout << "[CLIENT] Connected to video stream\n";
-        else
-            std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
+    void postCursor(const InputCursor& cursor, const CursorImage* shape) {
+        if (cursorPost(cursor_mailbox, cursor, shape))
+            QMetaObject::invokeMethod(this, [this] { presentCursor(); }, Qt::QueuedConnection);
     }
-    is_getting_vid_sock = false;
-}
 
-void connectInput() {
-    is_getting_in_sock = true;
-    while (input_sock == INVALID_SOCKET) {
-        input_sock = connectSocket(SERVER_IP, INPUT_PORT);
-        if (input_sock != INVALID_SOCKET)
-            std::cout << "[CLIENT] Connected to input control\n";
-        else
-            std::this_thread::sleep_for(std::chrono::milliseconds(RECONNECT_DELAY));
+    void presentCursor() {
+        InputCursor cursor;
+        CursorImage shape;
+        if (cursorTake(cursor_mailbox, cursor, shape)) view->showCursor(cursor, shape);
     }
-    is_getting_in_sock = false;
-}
+
+    // Show the newest decoded frame. Frames replaced in the mailbox before
+    // this ran are never shown.
+    void present() {
+        FrameHeader header;
+        if (!mailboxTake(mailbox, frame, header)) return;
+        view->image = QImage(frame.data, frame.cols, frame.rows, (int)frame.step, QImage::Format_RGB888);
+        view->repaint();
+        ackFrame(header);
+    }
+
+    // Start the input connection over: after the video stream went away, so
+    // the server pairs the new connections, or after the input one did
+    void dropInput() {
+        shutdownSocket(input_sock.exchange(INVALID_SOCKET));
+        {
+            std::lock_guard<std::mutex> lock(input_mutex);
+            pending_input.clear();
+        }
+        if (!is_getting_in_sock) std::thread(connectInput).detach();
+    }
+};
 
 int main(int argc, char *argv[]) {
-    WSAData wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--udp") use_udp = true;
+    }
+
+    netStartup();
 
     std::thread(connectVideo).detach();
     std::thread(connectInput).detach();
 
     QApplication app(argc, argv);
-    RemoteWindow window;
-    window.show();
-    int ret = app.exec();
+    int ret;
+    {
+        RemoteWindow window;
+        window.show();
+        ret = app.exec();
+    }
 
-    closesocket(video_sock);
-    closesocket(input_sock);
-    WSACleanup();
+    shutdownSocket(input_sock.exchange(INVALID_SOCKET));
+    netCleanup();
     return ret;
 }
 
-#include "main.moc"
+#include "client.moc"
@@ -23,6 +23,39 @@ RECONNECT_DELAY = 2  # seconds
 window_name = "Remote Window"
 click_position = None
 
+# Frame types, see common/frame_protocol.h
+FRAME_KEY = 0
+FRAME_DELTA = 1
+FRAME_KEY_TILES = 3
+FRAME_HEADER_SIZE = 13  # type, seq, capture_us
+TILE_HEADER = struct.Struct('!HHHHI')
+
+def apply_tiles(canvas, body):
+    """Draw a tile list (count, then tiles) onto the canvas and return it."""
+    tile_count = struct.unpack('!H', body[:2])[0]
+    offset = 2
+    for _ in range(tile_count):
+        x, y, w, h, size = TILE_HEADER.unpack_from(body, offset)
+        offset += TILE_HEADER.size
+        tile = cv2.imdecode(np.frombuffer(body[offset:offset + size], np.uint8), cv2.IMREAD_COLOR)
+        offset += size
+        if tile is not None and tile.shape[:2] == (h, w):
+            canvas[y:y + h, x:x + w] = tile
+    return canvas
+
+def apply_frame(canvas, msg):
+    """Apply one video message to the canvas. Returns the new canvas, or None if nothing to show."""
+    frame_type = msg[0]
+    body = msg[FRAME_HEADER_SIZE:]
+    if frame_type == FRAME_KEY:
+        return cv2.imdecode(np.frombuffer(body, np.uint8), cv2.IMREAD_COLOR)
+    if frame_type == FRAME_DELTA and canvas is not None:
+        return apply_tiles(canvas, body)
+    if frame_type == FRAME_KEY_TILES:
+        width, height = struct.unpack('!HH', body[:4])
+        return apply_tiles(np.zeros((height, width, 3), np.uint8), body[4:])
+    return None
+
 # --- Mouse callback function ---
 def mouse_callback(event, x, y, flags, param):
     global click_position
@@ -75,6 +108,7 @@ while True:
 
         data = b''
         payload_size = 4
+        canvas = None
 
         while True:
             current_width = cv2.getWindowProperty(window_name, cv2.WND_PROP_AUTOSIZE)
@@ -104,9 +138,10 @@ while True:
             data = data[frame_size:]
 
             # --- Decode and display frame ---
-            frame = cv2.imdecode(np.frombuffer(frame_data, np.uint8), cv2.IMREAD_COLOR)
+            frame = apply_frame(canvas, frame_data)
             if frame is not None:
-                cv2.imshow(window_name, frame)
+                canvas = frame
+                cv2.imshow(window_name, canvas)
 
             # --- Handle mouse click send ---
             if click_position:
@@ -0,0 +1,127 @@
+#pragma once
+
+// The cursor channel (input_protocol.h, version 4), with no UI attached:
+// shared by both clients. A cursor thread reads the input socket, which
+// otherwise only carries client-to-server traffic, keeps the shapes the
+// server sent, and hands the newest position to the UI through a mailbox
+// like the frames'. The UI draws the cursor over the frame itself, so the
+// pointer moves without waiting for the server to encode a frame.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "../common/input_protocol.h"
+#include "net_socket.h"
+
+#define CURSOR_MAX_MESSAGE (1 << 20)  // larger lengths mean a broken stream
+
+// A shape, BGRA with premultiplied alpha. Never written once received, so
+// it can be shared with the UI thread.
+struct CursorImage {
+    uint32_t serial = 0;
+    int xhot = 0;
+    int yhot = 0;
+    cv::Mat bgra;
+};
+
+struct CursorReceiver {
+    std::deque<CursorImage> shapes;     // newest last, INPUT_CURSOR_CACHE at most
+    InputCursor cursor;
+    std::vector<uint8_t> buffer;        // reused for every message
+};
+
+// Read one message from the server. Returns true when it moved, showed or
+// hid the cursor; shapes are only stored, the position that uses one comes
+// next. Throws once the connection is gone.
+inline bool receiveCursor(CursorReceiver& r, SOCKET sock) {
+    char size_buf[4];
+    if (!recvAll(sock, size_buf, 4)) throw std::runtime_error("Input socket closed");
+    uint32_t size = get_u32((const uint8_t*)size_buf);
+    if (size == 0 || size > CURSOR_MAX_MESSAGE) throw std::runtime_error("Bad cursor message");
+    r.buffer.resize(size);
+    if (!recvAll(sock, (char*)r.buffer.data(), (int)size)) throw std::runtime_error("Input socket closed");
+
+    InputCursorShape shape;
+    if (input_decode_cursor_shape(r.buffer.data(), size, shape)) {
+        CursorImage image;
+        image.serial = shape.serial;
+        image.xhot = shape.xhot;
+        image.yhot = shape.yhot;
+        image.bgra.create(shape.height, shape.width, CV_8UC4);
+        if (!image.bgra.empty()) std::memcpy(image.bgra.data, shape.pixels, (size_t)shape.width * shape.height * 4);
+        // The server mirrors this cache, so drop exactly as it expects
+        r.shapes.push_back(std::move(image));
+        if (r.shapes.size() > INPUT_CURSOR_CACHE) r.shapes.pop_front();
+        return false;
+    }
+    InputCursor cursor;
+    if (input_decode_cursor(r.buffer.data(), size, cursor)) {
+        bool changed = cursor.serial != r.cursor.serial || cursor.x != r.cursor.x || cursor.y != r.cursor.y ||
+                       cursor.visible != r.cursor.visible;
+        r.cursor = cursor;
+        return changed;
+    }
+    // Messages from newer servers are skipped
+    return false;
+}
+
+// The shape the cursor shows now, or null
+inline const CursorImage* cursorShape(const CursorReceiver& r) {
+    for (auto it = r.shapes.rbegin(); it != r.shapes.rend(); ++it) {
+        if (it->serial == r.cursor.serial) return &*it;
+    }
+    return nullptr;
+}
+
+// Single-slot hand-off of the newest cursor to the UI thread, like
+// FrameMailbox: positions posted before the UI took the last one replace it.
+struct CursorMailbox {
+    std::mutex mutex;
+    InputCursor cursor;
+    CursorImage image;              // shape for cursor.serial, empty if unknown
+    bool full = false;
+};
+
+// Returns true if the UI has to be told
+inline bool cursorPost(CursorMailbox& m, const InputCursor& cursor, const CursorImage* image) {
+    std::lock_guard<std::mutex> lock(m.mutex);
+    m.cursor = cursor;
+    if (!image) m.image = CursorImage{};
+    else if (m.image.serial != image->serial || m.image.bgra.empty()) m.image = *image;
+    if (m.full) return false;
+    m.full = true;
+    return true;
+}
+
+inline bool cursorTake(CursorMailbox& m, InputCursor& cursor, CursorImage& image) {
+    std::lock_guard<std::mutex> lock(m.mutex);
+    if (!m.full) return false;
+    cursor = m.cursor;
+    image = m.image;
+    m.full = false;
+    return true;
+}
+
+// Blend `image` onto a BGR frame with its hotspot at (x, y), clipped to the
+// frame. The pixels are premultiplied: dst = src + dst * (255 - alpha) / 255.
+inline void drawCursor(cv::Mat& bgr, const CursorImage& image, int x, int y) {
+    int left = x - image.xhot;
+    int top = y - image.yhot;
+    int x0 = std::max(0, -left), x1 = std::min(image.bgra.cols, bgr.cols - left);
+    int y0 = std::max(0, -top), y1 = std::min(image.bgra.rows, bgr.rows - top);
+    for (int row = y0; row < y1; row++) {
+        const uint8_t* src = image.bgra.ptr<uint8_t>(row);
+        uint8_t* dst = bgr.ptr<uint8_t>(top + row);
+        for (int col = x0; col < x1; col++) {
+            const uint8_t* s = src + col * 4;
+            uint8_t* d = dst + (left + col) * 3;
+            int keep = 255 - s[3];
+            for (int c = 0; c < 3; c++) d[c] = (uint8_t)std::min(255, s[c] + (d[c] * keep + 127) / 255);
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Single-slot hand-off of decoded frames from a receive thread to the UI
+// thread. The newest frame always wins: posting over a frame the UI has not
+// taken yet replaces it, so the UI never works through a backlog and what it
+// shows is at most one decode old. Images are swapped in and out of the
+// slot rather than copied, and keep circulating between the two threads, so
+// a stream at a steady size allocates nothing here.
+
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <opencv2/opencv.hpp>
+#include "../common/frame_protocol.h"
+
+struct FrameMailbox {
+    std::mutex mutex;
+    cv::Mat slot;
+    FrameHeader header;
+    bool full = false;              // holds a frame the UI has not taken
+    uint64_t posted = 0;
+    uint64_t replaced = 0;          // posted over before the UI took them
+};
+
+// Hand `frame` over; `frame` comes back holding an old image to fill next.
+// Returns true if the slot was empty, i.e. the UI has to be told; otherwise
+// it already has been and will find this frame instead.
+inline bool mailboxPost(FrameMailbox& m, cv::Mat& frame, const FrameHeader& header) {
+    std::lock_guard<std::mutex> lock(m.mutex);
+    std::swap(m.slot, frame);
+    m.header = header;
+    m.posted++;
+    if (m.full) {
+        m.replaced++;
+        return false;
+    }
+    m.full = true;
+    return true;
+}
+
+// Take the newest frame into `frame`, whose old image goes back to the
+// slot. False if nothing new arrived since the last take.
+inline bool mailboxTake(FrameMailbox& m, cv::Mat& frame, FrameHeader& header) {
+    std::lock_guard<std::mutex> lock(m.mutex);
+    if (!m.full) return false;
+    std::swap(m.slot, frame);
+    header = m.header;
+    m.full = false;
+    return true;
+}
@@ -5,64 +5,150 @@
 #include <atomic>
 #include <vector>
 #include <string>
-#include <winsock2.h>
-#include <ws2tcpip.h>
 #include <opencv2/opencv.hpp>
-#include <nlohmann/json.hpp>
+#include "../common/input_protocol.h"
+#include "../common/input_json.h"
+#include "net_socket.h"
+#include "video_receiver.h"
+#include "cursor_receiver.h"
 
-#pragma comment(lib, "Ws2_32.lib")
-
-using json = nlohmann::json;
 using namespace std;
 
 #define SERVER_IP "192.168.0.26"
 #define VIDEO_PORT 12345
 #define INPUT_PORT 12346
 #define RECONNECT_DELAY 2000 // in milliseconds
+#define INPUT_HELLO_TIMEOUT 1000 // ms to wait for the server to accept binary input
 #define WINDOW_NAME "Remote Window"
+#define FRAME_POLL_MS 10 // longest wait for a frame before handling keys and the cursor
+#define CURSOR_IDLE_MS 10 // cursor thread poll while there is no input socket
 
 SOCKET video_sock = INVALID_SOCKET;
-SOCKET input_sock = INVALID_SOCKET;
+// Read by the cursor thread, written by the main loop
+atomic<SOCKET> input_sock(INVALID_SOCKET);
 
 atomic<bool> is_getting_vid_sock(false);
 atomic<bool> is_getting_in_sock(false);
 atomic<bool> window_open(false);
 atomic<bool> can_make_window(true);
+atomic<bool> input_binary(false);   // server accepted the binary input protocol
+atomic<bool> input_acks(false);     // and display acks (version 2)
+atomic<bool> input_cursor(false);   // and sends the cursor (version 4)
+bool use_udp = false;               // --udp: video over udp_video.h instead of TCP
+UdpVideo udp_video;
+
+// Events collected since the last frame, sent as one batch
+mutex input_mutex;
+vector<InputEvent> pending_input;
 
-mutex click_mutex;
-json click_position;
-
-void mouseCallback(int event, int x, int y, int, void*) {
-    lock_guard<mutex> lock(click_mutex);
-    if (event == cv::EVENT_LBUTTONDOWN) {
-        click_position = { {"type", "click"}, {"button", "left"}, {"x", x}, {"y", y} };
-    } else if (event == cv::EVENT_RBUTTONDOWN) {
-        click_position = { {"type", "click"}, {"button", "right"}, {"x", x}, {"y", y} };
-    } else if (event == cv::EVENT_LBUTTONDBLCLK) {
-        click_position = { {"type", "dclick"}, {"button", "left"}, {"x", x}, {"y", y} };
+// The cursor thread's newest cursor, drawn over the frame by the main loop
+CursorMailbox cursor_mailbox;
+
+void queueInput(InputEvent ev) {
+    ev.time_ms = input_time_ms();
+    lock_guard<mutex> lock(input_mutex);
+    pending_input.push_back(ev);
+}
+
+void mouseCallback(int event, int x, int y, int flags, void*) {
+    InputEvent ev;
+    ev.x = (int16_t)x;
+    ev.y = (int16_t)y;
+    switch (event) {
+    case cv::EVENT_MOUSEMOVE:
+        ev.type = INPUT_MOTION;
+        break;
+    // A double click arrives as down, up, dblclk, up: the dblclk is the
+    // second press, and the target counts the clicks itself
+    case cv::EVENT_LBUTTONDOWN:
+    case cv::EVENT_LBUTTONDBLCLK:
+        ev.type = INPUT_BUTTON_DOWN;
+        ev.button = 1;
+        break;
+    case cv::EVENT_MBUTTONDOWN:
+    case cv::EVENT_MBUTTONDBLCLK:
+        ev.type = INPUT_BUTTON_DOWN;
+        ev.button = 2;
+        break;
+    case cv::EVENT_RBUTTONDOWN:
+    case cv::EVENT_RBUTTONDBLCLK:
+        ev.type = INPUT_BUTTON_DOWN;
+        ev.button = 3;
+        break;
+    case cv::EVENT_LBUTTONUP:
+        ev.type = INPUT_BUTTON_UP;
+        ev.button = 1;
+        break;
+    case cv::EVENT_MBUTTONUP:
+        ev.type = INPUT_BUTTON_UP;
+        ev.button = 2;
+        break;
+    case cv::EVENT_RBUTTONUP:
+        ev.type = INPUT_BUTTON_UP;
+        ev.button = 3;
+        break;
+    case cv::EVENT_MOUSEWHEEL:
+    case cv::EVENT_MOUSEHWHEEL: {
+        ev.type = INPUT_WHEEL;
+        int steps = cv::getMouseWheelDelta(flags) / 120;
+        if (steps == 0) return;
+        if (event == cv::EVENT_MOUSEWHEEL) ev.dy = (int16_t)steps;
+        else ev.dx = (int16_t)steps;
+        break;
+    }
+    default:
+        return;
     }
+    queueInput(ev);
 }
 
-SOCKET connectSocket(const char* ip, int port) {
-    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+// Offer the binary input protocol. Servers that predate it never answer the
+// hello, so give up after a moment and keep sending JSON. Returns the version
+// the server speaks, 0 for JSON.
+uint8_t negotiateInput(SOCKET sock) {
+    vector<uint8_t> hello;
+    put_u32(hello, INPUT_HELLO_SIZE);
+    input_hello(hello);
+    if (!sendAll(sock, hello.data(), hello.size())) return 0;
 
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &serverAddr.sin_addr);
+    setRecvTimeout(sock, INPUT_HELLO_TIMEOUT);
+    char ack[4 + INPUT_HELLO_SIZE];
+    uint8_t version = 0;
+    bool ok = recvAll(sock, ack, sizeof(ack)) && get_u32((const uint8_t*)ack) == INPUT_HELLO_SIZE &&
+              input_is_hello((const uint8_t*)ack + 4, INPUT_HELLO_SIZE, version) && version >= 1;
+    setRecvTimeout(sock, 0);
+    return ok ? version : 0;
+}
 
-    if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        closesocket(sock);
-        return INVALID_SOCKET;
+// Send everything queued since the last call as one message
+void flushInput() {
+    vector<InputEvent> events;
+    {
+        lock_guard<mutex> lock(input_mutex);
+        events.swap(pending_input);
     }
-    return sock;
+    SOCKET sock = input_sock;
+    if (events.empty() || sock == INVALID_SOCKET) return;
+    vector<uint8_t> msg;
+    if (input_binary) input_encode_batch(events.data(), events.size(), msg);
+    else input_encode_json(events.data(), events.size(), msg);
+    if (!msg.empty()) sendAll(sock, msg.data(), msg.size());
+}
+
+// Tell the server which frame is on screen now, for its latency numbers
+void ackFrame(const FrameHeader& shown) {
+    SOCKET sock = input_sock;
+    if (!input_acks || sock == INVALID_SOCKET) return;
+    vector<uint8_t> msg;
+    input_encode_ack(shown, msg);
+    sendAll(sock, msg.data(), msg.size());
 }
 
 void connectVideo() {
     is_getting_vid_sock = true;
     while (video_sock == INVALID_SOCKET) {
-        video_sock = connectSocket(SERVER_IP, VIDEO_PORT);
+        video_sock = use_udp ? udpVideoOpen(udp_video, SERVER_IP, VIDEO_PORT)
+                             : connectSocket(SERVER_IP, VIDEO_PORT);
         if (video_sock != INVALID_SOCKET)
             cout << "[CLIENT] Connected to video stream\n";
         else
@@ -74,31 +160,58 @@ void connectVideo() {
 void connectInput() {
     is_getting_in_sock = true;
     while (input_sock == INVALID_SOCKET) {
-        input_sock = connectSocket(SERVER_IP, INPUT_PORT);
-        if (input_sock != INVALID_SOCKET)
-            cout << "[CLIENT] Connected to input control\n";
-        else
+        SOCKET sock = connectSocket(SERVER_IP, INPUT_PORT);
+        if (sock != INVALID_SOCKET) {
+            uint8_t version = negotiateInput(sock);
+            input_binary = version >= 1;
+            input_acks = version >= INPUT_ACK_VERSION;
+            input_cursor = version >= INPUT_CURSOR_VERSION;
+            input_sock = sock;
+            cout << "[CLIENT] Connected to input control (" << (input_binary ? "binary" : "json") << ")\n";
+        } else {
             this_thread::sleep_for(chrono::milliseconds(RECONNECT_DELAY));
+        }
     }
     is_getting_in_sock = false;
 }
 
-bool recvAll(SOCKET sock, char* buffer, int total) {
-    int received = 0;
-    while (received < total) {
-        int ret = recv(sock, buffer + received, total - received, 0);
-        if (ret <= 0) return false;
-        received += ret;
+// Follow the cursor channel of a server that has one, for the main loop to
+// draw. A failed read hides the cursor and starts the input connection
+// over, since the main loop only notices a failed video connection.
+void receiveCursors() {
+    while (true) {
+        SOCKET sock = input_sock;
+        if (sock == INVALID_SOCKET || !input_cursor) {
+            this_thread::sleep_for(chrono::milliseconds(CURSOR_IDLE_MS));
+            continue;
+        }
+        CursorReceiver cursor;
+        try {
+            while (true) {
+                if (receiveCursor(cursor, sock)) cursorPost(cursor_mailbox, cursor.cursor, cursorShape(cursor));
+            }
+        } catch (exception& e) {
+            cerr << "[CLIENT] Input connection lost: " << e.what() << endl;
+            cursorPost(cursor_mailbox, InputCursor{}, nullptr);
+            // Unless the main loop has already started over
+            if (input_sock.compare_exchange_strong(sock, INVALID_SOCKET)) {
+                shutdownSocket(sock);
+                if (!is_getting_in_sock) thread(connectInput).detach();
+            }
+        }
     }
-    return true;
 }
 
-int main() {
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == "--udp") use_udp = true;
+    }
+
+    netStartup();
 
     thread(connectVideo).detach();
     thread(connectInput).detach();
+    thread(receiveCursors).detach();
 
     while (true) {
         if (video_sock == INVALID_SOCKET || input_sock == INVALID_SOCKET) {
@@ -113,42 +226,41 @@ int main() {
                 window_open = true;
             }
 
-            vector<char> buffer;
+            VideoReceiver video;
+            InputCursor cursor;
+            CursorImage cursor_shape;
+            cv::Mat display;        // canvas with the cursor drawn in
             while (true) {
-                char size_buf[4];
-                if (!recvAll(video_sock, size_buf, 4)) throw runtime_error("Video socket closed");
-
-                int frame_size = ntohl(*(int*)size_buf);
-                buffer.resize(frame_size);
-                if (!recvAll(video_sock, buffer.data(), frame_size))
-                    throw runtime_error("Video socket closed");
-
-                cv::Mat rawData(1, frame_size, CV_8UC1, buffer.data());
-                cv::Mat frame = cv::imdecode(rawData, cv::IMREAD_COLOR);
-                if (!frame.empty()) {
-                    cv::imshow(WINDOW_NAME, frame);
-                }
-
-                {
-                    lock_guard<mutex> lock(click_mutex);
-                    if (!click_position.is_null()) {
-                        string msg = click_position.dump();
-                        uint32_t len = htonl((uint32_t)msg.size());
-                        send(input_sock, (char*)&len, 4, 0);
-                        send(input_sock, msg.c_str(), (int)msg.size(), 0);
-                        click_position = nullptr;
+                // Lost UDP frames are skipped, and a TCP frame may not have
+                // arrived yet, so there may be nothing new to show
+                bool shown = receiveFrame(video, video_sock, use_udp ? &udp_video : nullptr, FRAME_POLL_MS);
+                bool moved = cursorTake(cursor_mailbox, cursor, cursor_shape);
+                if ((shown || moved) && !video.decoder.canvas.empty()) {
+                    if (cursor.visible && !cursor_shape.bgra.empty()) {
+                        video.decoder.canvas.copyTo(display);
+                        drawCursor(display, cursor_shape, cursor.x, cursor.y);
+                        cv::imshow(WINDOW_NAME, display);
+                    } else {
+                        cv::imshow(WINDOW_NAME, video.decoder.canvas);
                     }
                 }
 
+                // imshow only paints in waitKey
                 int key = cv::waitKey(1);
+                if (shown) ackFrame(video.decoder.shown);
                 if (key == 'q') throw runtime_error("Quit key");
                 else if (key != -1 && key != 255) {
-                    json key_event = { {"type", "key"}, {"key", string(1, (char)key)} };
-                    string msg = key_event.dump();
-                    uint32_t len = htonl((uint32_t)msg.size());
-                    send(input_sock, (char*)&len, 4, 0);
-                    send(input_sock, msg.c_str(), (int)msg.size(), 0);
+                    // waitKey only reports presses, so send the release with it
+                    InputEvent ev;
+                    ev.keysym = keysym_from_char(key & 0xff);
+                    if (ev.keysym) {
+                        ev.type = INPUT_KEY_DOWN;
+                        queueInput(ev);
+                        ev.type = INPUT_KEY_UP;
+                        queueInput(ev);
+                    }
                 }
+                flushInput();
             }
 
         } catch (exception& e) {
@@ -158,9 +270,13 @@ int main() {
                 window_open = false;
             }
             closesocket(video_sock);
-            closesocket(input_sock);
             video_sock = INVALID_SOCKET;
-            input_sock = INVALID_SOCKET;
+            // Also wakes the cursor thread
+            shutdownSocket(input_sock.exchange(INVALID_SOCKET));
+            {
+                lock_guard<mutex> lock(input_mutex);
+                pending_input.clear();
+            }
 
             if (!is_getting_vid_sock) thread(connectVideo).detach();
             if (!is_getting_in_sock) thread(connectInput).detach();
@@ -168,6 +284,6 @@ int main() {
         }
     }
 
-    WSACleanup();
+    netCleanup();
     return 0;
 }
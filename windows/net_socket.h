@@ -0,0 +1,127 @@
+#pragma once
+
+// The few socket calls the clients make, on Winsock or BSD sockets, so the
+// client core also builds and runs on Linux. Code above this layer uses the
+// Winsock names (SOCKET, INVALID_SOCKET, closesocket); on POSIX they are
+// defined here.
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#define NET_SEND_FLAGS 0
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+inline int closesocket(SOCKET sock) {
+    return close(sock);
+}
+// A peer that went away must not kill the client with SIGPIPE
+#define NET_SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+// Call once before any other socket function, and netCleanup at exit
+inline void netStartup() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+}
+
+inline void netCleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// Blocking TCP connection to ip:port, or INVALID_SOCKET
+inline SOCKET connectSocket(const char* ip, int port) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &serverAddr.sin_addr);
+    if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// Read exactly `total` bytes. False if the connection closed, failed or
+// timed out first.
+inline bool recvAll(SOCKET sock, char* buffer, int total) {
+    int received = 0;
+    while (received < total) {
+        int ret = (int)recv(sock, buffer + received, total - received, 0);
+#ifndef _WIN32
+        if (ret < 0 && errno == EINTR) continue;
+#endif
+        if (ret <= 0) return false;
+        received += ret;
+    }
+    return true;
+}
+
+// Write all of `size` bytes. False if the connection failed.
+inline bool sendAll(SOCKET sock, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        int ret = (int)send(sock, p, (int)size, NET_SEND_FLAGS);
+#ifndef _WIN32
+        if (ret < 0 && errno == EINTR) continue;
+#endif
+        if (ret <= 0) return false;
+        p += ret;
+        size -= (size_t)ret;
+    }
+    return true;
+}
+
+// Make blocking receives give up after `ms`; 0 waits forever
+inline void setRecvTimeout(SOCKET sock, int ms) {
+#ifdef _WIN32
+    DWORD timeout = (DWORD)ms;
+#else
+    timeval timeout;
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_usec = (ms % 1000) * 1000;
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+
+// Wait up to `ms` for `sock` to have something to read, which includes the
+// peer closing. False on timeout; errors count as readable, so the receive
+// that follows reports them.
+inline bool waitReadable(SOCKET sock, int ms) {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return select((int)sock + 1, &readable, nullptr, nullptr, &tv) != 0;
+}
+
+// Wake a thread blocked receiving on `sock`, then close it
+inline void shutdownSocket(SOCKET sock) {
+    if (sock == INVALID_SOCKET) return;
+#ifdef _WIN32
+    shutdown(sock, SD_BOTH);
+#else
+    shutdown(sock, SHUT_RDWR);
+#endif
+    closesocket(sock);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+// Client side of the UDP video transport (common/udp_protocol.h), shared by
+// the clients. The server streams to the first client that says hello, so
+// opening the socket is all the "connecting" there is; frames start to
+// arrive once the server has a window to stream.
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "../common/udp_protocol.h"
+#include "net_socket.h"
+
+#define UDP_RECV_BUFFER (4 * 1024 * 1024)   // room for a keyframe burst
+#define UDP_STATS_INTERVAL_S 5
+
+struct UdpVideo {
+    SOCKET sock = INVALID_SOCKET;
+    UdpReassembler reassembler;
+    std::chrono::steady_clock::time_point last_hello{};
+    std::chrono::steady_clock::time_point last_packet{};
+    std::chrono::steady_clock::time_point last_stats{};
+    std::vector<uint8_t> control;
+    uint8_t packet[UDP_MAX_PACKET];
+};
+
+inline void udpVideoSend(UdpVideo& v, UdpPacketKind kind) {
+    udp_control_packet(v.control, kind, v.reassembler.last_done);
+    send(v.sock, (const char*)v.control.data(), (int)v.control.size(), NET_SEND_FLAGS);
+}
+
+// Open a socket connected to the server's video port and subscribe to the
+// stream. Returns the socket, or INVALID_SOCKET.
+inline SOCKET udpVideoOpen(UdpVideo& v, const char* ip, int port) {
+    v = UdpVideo{};
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+
+    int size = UDP_RECV_BUFFER;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof(size));
+
+    // Connecting a datagram socket only fixes the peer: send() goes there
+    // and packets from anywhere else are filtered out
+    sockaddr_in serverAddr;
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &serverAddr.sin_addr);
+    if (connect(sock, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    v.sock = sock;
+    v.last_hello = v.last_stats = std::chrono::steady_clock::now();
+    udpVideoSend(v, UDP_HELLO);
+    return sock;
+}
+
+// Wait up to timeout_ms for a frame that should be shown; its message (type
+// byte first) is left in `frame`. Keeps the subscription alive and asks for
+// a keyframe after loss. Throws once a stream that had started goes quiet;
+// any packet counts, since an idle server sends UDP_HELLO instead of frames.
+inline bool udpVideoReceive(UdpVideo& v, int timeout_ms, std::vector<uint8_t>& frame) {
+    using namespace std::chrono;
+    auto deadline = steady_clock::now() + milliseconds(timeout_ms);
+    UdpReassembler& r = v.reassembler;
+
+    while (true) {
+        auto now = steady_clock::now();
+        if (now - v.last_hello >= milliseconds(UDP_HELLO_INTERVAL_MS)) {
+            v.last_hello = now;
+            udpVideoSend(v, UDP_HELLO);
+        }
+        udp_expire(r);
+        if (r.packets > 0 && udp_wants_keyframe(r)) udpVideoSend(v, UDP_KEY_REQUEST);
+        if (r.packets > 0 && now - v.last_packet > milliseconds(UDP_PEER_TIMEOUT_MS)) {
+            throw std::runtime_error("Video stream timed out");
+        }
+        if (now - v.last_stats >= seconds(UDP_STATS_INTERVAL_S) && r.packets > 0) {
+            v.last_stats = now;
+            std::cout << "[UDP] frames shown " << r.frames_shown << ", dropped " << r.frames_dropped
+                      << "; packets " << r.packets << ", lost " << r.lost_packets
+                      << ", recovered " << r.recovered << "\n";
+        }
+
+        long long left = std::max(0LL, (long long)duration_cast<milliseconds>(deadline - now).count());
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(v.sock, &readable);
+        timeval tv;
+        tv.tv_sec = (long)(left / 1000);
+        tv.tv_usec = (long)(left % 1000) * 1000;
+        if (select((int)v.sock + 1, &readable, nullptr, nullptr, &tv) <= 0) {
+            if (steady_clock::now() >= deadline) return false;
+            continue;
+        }
+
+        // Errors here are ICMP "port unreachable" echoes while the server is
+        // not up yet; the next hello retries
+        int n = (int)recv(v.sock, (char*)v.packet, sizeof(v.packet), 0);
+        if (n <= 0) continue;
+        v.last_packet = steady_clock::now();
+        if (udp_receive(r, v.packet, (size_t)n, frame)) return true;
+        if (steady_clock::now() >= deadline) return false;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Receiving and decoding the video stream, with no UI attached: shared by
+// both clients. The Qt client runs it on its receive thread.
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "../common/frame_decoder.h"
+#include "net_socket.h"
+#include "udp_video.h"
+
+struct VideoReceiver {
+    FrameDecoder decoder;
+    std::vector<uint8_t> buffer;    // reused for every message
+};
+
+// Read and decode what the server sent. Over TCP (`udp` null) that is the
+// next message, if one starts within timeout_ms; over UDP every complete
+// frame, waiting up to timeout_ms for the first. All of them are applied, since
+// deltas build on each other. Returns true when the canvas changed. Throws
+// once the stream is gone.
+inline bool receiveFrame(VideoReceiver& r, SOCKET sock, UdpVideo* udp, int timeout_ms) {
+    if (udp) {
+        bool shown = false;
+        while (udpVideoReceive(*udp, shown ? 0 : timeout_ms, r.buffer))
+            shown |= apply_frame_message(r.decoder, r.buffer.data(), r.buffer.size());
+        return shown;
+    }
+
+    if (!waitReadable(sock, timeout_ms)) return false;
+    char size_buf[4];
+    if (!recvAll(sock, size_buf, 4)) throw std::runtime_error("Video socket closed");
+    uint32_t frame_size = get_u32((const uint8_t*)size_buf);
+    r.buffer.resize(frame_size);
+    if (!recvAll(sock, (char*)r.buffer.data(), (int)frame_size)) throw std::runtime_error("Video socket closed");
+    return apply_frame_message(r.decoder, r.buffer.data(), frame_size);
+}